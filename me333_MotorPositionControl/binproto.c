@@ -0,0 +1,408 @@
+#include "binproto.h"
+#include "cmdqueue.h"
+#include "crc16.h"
+#include "config.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "segqueue.h"
+#include "telemetry.h"
+#include "uartdma.h"
+#include <string.h>
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static unsigned char request[CMD_SLOT_SIZE];
+static unsigned char reply[1 + BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE];
+static int reply_length;    // payload bytes so far, status byte included
+
+static const unsigned char supported_opcodes[] = {
+    BIN_OP_CAPS, BIN_OP_STATUS, BIN_OP_ABORT, BIN_OP_LATENCY,
+    BIN_OP_SET_PWM, BIN_OP_SET_CURRENT_GAINS, BIN_OP_GET_CURRENT_GAINS,
+    BIN_OP_SET_POSITION_GAINS, BIN_OP_GET_POSITION_GAINS,
+    BIN_OP_TRAJ_WRITE, BIN_OP_TRAJ_BULK, BIN_OP_RUN, BIN_OP_READ_LOG,
+    BIN_OP_SUBSCRIBE
+};
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// Payload writers, the reply payload starts right after magic, opcode and length
+static void put(const void * data, int length)
+{
+    if (reply_length + length > BIN_MAX_PAYLOAD)
+    {
+        return;
+    }
+    memcpy(&reply[1 + BIN_HEADER_SIZE + reply_length], data, length);
+    reply_length += length;
+}
+
+static void put_u8(unsigned char v) { put(&v, 1); }
+static void put_u16(unsigned short v) { put(&v, 2); }
+static void put_u32(unsigned int v) { put(&v, 4); }
+static void put_float(float v) { put(&v, 4); }
+
+static void send_reply(unsigned char opcode, unsigned char status)
+{
+    reply[0] = BIN_MAGIC;
+    reply[1] = opcode | BIN_REPLY;
+    reply[4] = status;          // first payload byte, reserved by reply_length = 1
+    reply[2] = reply_length & 0xFF;
+    reply[3] = reply_length >> 8;
+    unsigned short crc = crc16(CRC16_INIT, &reply[1], BIN_HEADER_SIZE + reply_length);
+    reply[1 + BIN_HEADER_SIZE + reply_length] = crc & 0xFF;
+    reply[2 + BIN_HEADER_SIZE + reply_length] = crc >> 8;
+
+    int n = 1 + BIN_HEADER_SIZE + reply_length + BIN_CRC_SIZE;
+    if (uartDma_Busy())
+    {
+        uartDma_Insert(reply, n);   // between two lines of the dump, the main loop checked there is room
+        return;
+    }
+    telemetry_Flush();      // never inside a telemetry frame
+    for (int i = 0; i < n; i++)
+    {
+        while (U3STAbits.UTXBF)
+        {
+            ; // wait until tx buffer isn't full
+        }
+        U3TXREG = reply[i];
+    }
+}
+
+static void put_latency(enum cmd_kind_t kind)
+{
+    struct cmd_latency_t l;
+    cmdQueue_GetLatency(kind, &l);
+    put_u32(l.count);
+    put_u32(l.last);
+    put_u32(l.max);
+    put(&l.total, 8);
+}
+
+// Requests that would change what a dump is reading, refused while one goes out
+static int changes_logs(unsigned char opcode)
+{
+    return (opcode == BIN_OP_SET_PWM) || (opcode == BIN_OP_TRAJ_WRITE) || (opcode == BIN_OP_RUN);
+}
+
+static int is_running()
+{
+    enum mode_t m = get_mode();
+    return (m == ITEST) || (m == HOLD) || (m == TRACK);
+}
+
+// Run one request, returns the status byte, the reply payload is filled as it goes
+static unsigned char handle(unsigned char opcode, const unsigned char * payload, int length)
+{
+    switch (opcode)
+    {
+    case BIN_OP_CAPS:
+    {
+        put_u8(BIN_VERSION);
+        put_u16(BIN_MAX_PAYLOAD);
+        put_u16(MAX_REF_TRAJ_LENGTH);
+        put_u16(RUNLOG_LENGTH);
+        put(supported_opcodes, sizeof(supported_opcodes));
+        return BIN_OK;
+    }
+    case BIN_OP_STATUS:
+    {
+        put_u8(get_mode());
+        put_u8((signed char)get_PWM());
+        put_float(readCurrent());
+        put_u32((unsigned int)readEncoderCount());     // low 32 bits of the multi-turn count
+        put_u32(getDesiredAngle());
+        put_u16(referenceTrajectoryLength);
+        return BIN_OK;
+    }
+    case BIN_OP_ABORT:
+    {
+        set_mode(IDLE);
+        set_PWM(0);
+        return BIN_OK;
+    }
+    case BIN_OP_LATENCY:
+    {
+        put_latency(CMD_LINE);
+        put_latency(CMD_FRAME);
+        return BIN_OK;
+    }
+    case BIN_OP_SET_PWM:
+    {
+        short pwm;
+        if (length != 2)
+        {
+            return BIN_ERR_LENGTH;
+        }
+        memcpy(&pwm, payload, 2);
+        set_PWM(pwm);
+        set_mode(PWM);
+        put_u16(get_PWM());
+        return BIN_OK;
+    }
+    case BIN_OP_SET_CURRENT_GAINS:
+    case BIN_OP_GET_CURRENT_GAINS:
+    {
+        if (opcode == BIN_OP_SET_CURRENT_GAINS)
+        {
+            float g[2];
+            if (length != sizeof(g))
+            {
+                return BIN_ERR_LENGTH;
+            }
+            memcpy(g, payload, sizeof(g));
+            setCurrentGains(g[0], g[1]);
+        }
+        put_float(getCurrentP());
+        put_float(getCurrentI());
+        return BIN_OK;
+    }
+    case BIN_OP_SET_POSITION_GAINS:
+    case BIN_OP_GET_POSITION_GAINS:
+    {
+        if (opcode == BIN_OP_SET_POSITION_GAINS)
+        {
+            float g[3];
+            if (length != sizeof(g))
+            {
+                return BIN_ERR_LENGTH;
+            }
+            memcpy(g, payload, sizeof(g));
+            setPositionGains(g[0], g[1], g[2]);
+        }
+        put_float(getPositionP());
+        put_float(getPositionI());
+        put_float(getPositionD());
+        return BIN_OK;
+    }
+    case BIN_OP_TRAJ_WRITE:
+    {
+        unsigned short total, offset;
+        int n = (length - 4) / 4;
+        if ((length < 4) || ((length - 4) % 4))
+        {
+            return BIN_ERR_LENGTH;
+        }
+        memcpy(&total, payload, 2);
+        memcpy(&offset, payload + 2, 2);
+        if ((total > MAX_REF_TRAJ_LENGTH) || (offset + n > total))
+        {
+            return BIN_ERR_RANGE;
+        }
+        if (get_mode() == TRACK)
+        {
+            return BIN_ERR_BUSY;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            float v;
+            memcpy(&v, payload + 4 + 4 * i, 4);
+            referenceTrajectory[offset + i] = DEG_TO_Q16(v);
+        }
+        referenceTrajectoryLength = total;
+        config_ForgetTrajectory();
+        put_u16(offset + n);
+        return BIN_OK;
+    }
+    case BIN_OP_TRAJ_BULK:
+    {
+        // armed by the RX ISR already, the header is only checked again for the reply
+        if (length != BIN_BULK_HEADER_SIZE)
+        {
+            return BIN_ERR_LENGTH;
+        }
+        if (cmdQueue_GetBulkState() == BULK_OFF)
+        {
+            return (get_mode() == TRACK) ? BIN_ERR_BUSY : BIN_ERR_RANGE;
+        }
+        put(payload, 2);
+        return BIN_OK;
+    }
+    case BIN_OP_RUN:
+    {
+        int angle = 0;
+        if ((length != 1) && (length != 5))
+        {
+            return BIN_ERR_LENGTH;
+        }
+        if ((get_mode() == ITEST) || (get_mode() == TRACK))
+        {
+            return BIN_ERR_BUSY;
+        }
+        switch (payload[0])
+        {
+        case ITEST: {set_mode(ITEST); break; }
+        case HOLD:
+        {
+            if (length == 5)
+            {
+                memcpy(&angle, payload + 1, 4);
+            }
+            setDesiredAngle(angle);
+            set_mode(HOLD);
+            break;
+        }
+        case TRACK: {segqueue_Stop(); set_mode(TRACK); break; }
+        default: {return BIN_ERR_RANGE; }
+        }
+        put_u8(get_mode());
+        return BIN_OK;
+    }
+    case BIN_OP_READ_LOG:
+    {
+        unsigned short offset, count;
+        if (length != 5)
+        {
+            return BIN_ERR_LENGTH;
+        }
+        if (is_running())
+        {
+            return BIN_ERR_BUSY;
+        }
+        memcpy(&offset, payload + 1, 2);
+        memcpy(&count, payload + 3, 2);
+        if ((payload[0] > 2) || (offset + count > RUNLOG_LENGTH) || (2 + count * 8 > BIN_MAX_PAYLOAD - 1))
+        {
+            return BIN_ERR_RANGE;
+        }
+        put_u16(offset);
+        for (int i = offset; i < offset + count; i++)
+        {
+            if (payload[0] < 2)
+            {
+                put_u32(runLogRef[i]);
+                put_u32(runLogAct[i]);
+            }
+            else
+            {
+                put_u32(latchTimeArray[i]);
+                put_u32(applyTimeArray[i]);
+            }
+        }
+        return BIN_OK;
+    }
+    case BIN_OP_SUBSCRIBE:
+    {
+        unsigned short decimation;
+        if (length != 3)
+        {
+            return BIN_ERR_LENGTH;
+        }
+        memcpy(&decimation, payload + 1, 2);
+        unsigned int dropped = telemetry_Dropped();     // under the subscription being replaced
+        if (telemetry_Subscribe(payload[0], decimation))
+        {
+            return BIN_ERR_RANGE;
+        }
+        put_u8(telemetry_Mask());
+        put_u16(telemetry_Decimation());
+        put_u32(dropped);
+        return BIN_OK;
+    }
+    default:
+    {
+        return BIN_ERR_OPCODE;
+    }
+    }
+}
+
+// The samples of a bulk upload are all in and are converted to Q16 in place,
+// int16 samples sit packed at the start of the trajectory and are widened from the top down
+static void finish_bulk()
+{
+    struct cmd_bulk_t b;
+    unsigned char status = BIN_OK;
+    cmdQueue_GetBulk(&b);
+    config_ForgetTrajectory();      // the samples streamed in over the slot's, good or not
+    reply_length = 1;
+    if (b.crc != b.expected_crc)
+    {
+        referenceTrajectoryLength = 0;  // the buffer holds a mix of old and bad samples
+        status = BIN_ERR_CRC;
+    }
+    else
+    {
+        const unsigned char * raw = (const unsigned char *)referenceTrajectory;
+        if (b.format == BIN_BULK_INT16)
+        {
+            for (int i = b.count - 1; i >= 0; i--)
+            {
+                short v;
+                memcpy(&v, raw + 2 * i, 2);
+                referenceTrajectory[i] = DEG_TO_Q16(v * b.scale);
+            }
+        }
+        else if (b.format == BIN_BULK_FLOAT32)
+        {
+            for (int i = 0; i < b.count; i++)
+            {
+                float v;
+                memcpy(&v, raw + 4 * i, 4);
+                referenceTrajectory[i] = DEG_TO_Q16(v);
+            }
+        }
+        referenceTrajectoryLength = b.count;
+        put_u16(b.count);
+        put_u32(b.ticks);
+    }
+    send_reply(BIN_OP_TRAJ_BULK, status);
+    cmdQueue_CommandDone();
+}
+
+void binProto_Startup()
+{
+    cmdQueue_SetBulkTarget(referenceTrajectory, sizeof(referenceTrajectory));
+}
+
+void binProto_Poll()
+{
+    unsigned int timeout = NU32_SYS_FREQ / 2 / 1000 * BIN_BULK_TIMEOUT_MS;
+    if (cmdQueue_CancelStalledBulk(timeout))
+    {
+        referenceTrajectoryLength = 0;
+        config_ForgetTrajectory();
+        reply_length = 1;
+        send_reply(BIN_OP_TRAJ_BULK, BIN_ERR_TIMEOUT);
+    }
+}
+
+void binProto_Service()
+{
+    enum cmd_kind_t kind = cmdQueue_NextKind();
+    if (kind == CMD_BULK)
+    {
+        finish_bulk();
+        return;
+    }
+    int n = cmdQueue_GetFrame(request, sizeof(request));
+    if (n == 0)
+    {
+        return;
+    }
+    unsigned char opcode = request[0];
+    int length = request[1] | (request[2] << 8);
+    unsigned char status;
+
+    reply_length = 1;   // status byte
+    if (kind == CMD_BAD_FRAME)
+    {
+        status = BIN_ERR_CRC;
+    }
+    else if (uartDma_Busy() && changes_logs(opcode))
+    {
+        status = BIN_ERR_BUSY;
+    }
+    else
+    {
+        status = handle(opcode, &request[BIN_HEADER_SIZE], length);
+    }
+    if (status != BIN_OK)
+    {
+        reply_length = 1;   // errors carry no payload
+    }
+    send_reply(opcode, status);
+    cmdQueue_CommandDone();
+}
@@ -0,0 +1,67 @@
+#ifndef BINPROTO__H__
+#define BINPROTO__H__
+
+// Binary request/response protocol on UART3, next to the ASCII menu.
+//
+// request:  BIN_MAGIC, opcode, length (uint16 LE), payload, CRC-16 (LE)
+// response: BIN_MAGIC, opcode | BIN_REPLY, length, status byte + payload, CRC-16
+//
+// The CRC is CRC-16/CCITT-FALSE over opcode, length and payload. All multi-byte
+// payload fields are little endian, floats are IEEE 754 single precision.
+//
+// Bulk trajectory upload: send a BIN_OP_TRAJ_BULK header, wait for its OK reply,
+// then stream count raw samples with no framing. A second BIN_OP_TRAJ_BULK reply
+// follows once they are in, carrying the CRC verdict and the on-target time taken.
+//
+// While a text dump goes out by DMA, requests are still answered, each reply
+// between two of the dump's lines (see uartdma.h). SET_PWM, TRAJ_WRITE and RUN
+// would change the logs or trajectory being dumped and get BIN_ERR_BUSY. ASCII
+// menu lines wait until the dump is done, their replies could not be told
+// from its lines, and frames queued behind one wait with it.
+
+#define BIN_MAGIC 0xA5
+#define BIN_REPLY 0x80
+#define BIN_VERSION 2           // 2: angles are Q16.16 degrees
+#define BIN_HEADER_SIZE 3       // opcode + length
+#define BIN_CRC_SIZE 2
+#define BIN_MAX_PAYLOAD 248
+
+// opcodes
+#define BIN_OP_CAPS               0x01  // -> version, max payload, max trajectory, opcode list
+#define BIN_OP_STATUS             0x02  // -> mode, pwm, current, count (low 32 bits), desired angle Q16, trajectory length
+#define BIN_OP_ABORT              0x03  // IDLE with the PWM off, acted on in the RX ISR already
+#define BIN_OP_LATENCY            0x04  // -> count, last, max, total ticks for lines then frames
+#define BIN_OP_SET_PWM            0x10  // int16 duty, enters PWM -> duty
+#define BIN_OP_SET_CURRENT_GAINS  0x11  // float p, i -> p, i
+#define BIN_OP_GET_CURRENT_GAINS  0x12  // -> p, i
+#define BIN_OP_SET_POSITION_GAINS 0x13  // float p, i, d -> p, i, d
+#define BIN_OP_GET_POSITION_GAINS 0x14  // -> p, i, d
+#define BIN_OP_TRAJ_WRITE         0x20  // uint16 length, uint16 offset, float samples -> next offset
+#define BIN_OP_TRAJ_BULK          0x21  // uint16 count, uint8 format, float scale, uint16 CRC -> count
+                                        // second reply after the samples -> count, uint32 ticks
+#define BIN_OP_RUN                0x30  // uint8 mode (ITEST, HOLD, TRACK), int32 Q16 angle for HOLD
+#define BIN_OP_READ_LOG           0x31  // uint8 log (0 ITEST mA, 1 position Q16, both the run log, 2 latch/apply times), uint16 offset, uint16 count -> pairs
+#define BIN_OP_SUBSCRIBE          0x40  // uint8 signal mask (0 stops), uint16 decimation -> mask, decimation, uint32 records the old one dropped
+#define BIN_OP_TELEMETRY          0x41  // never a request, the opcode of the unsolicited frames (see telemetry.h)
+
+// status byte
+#define BIN_OK 0
+#define BIN_ERR_CRC 1
+#define BIN_ERR_OPCODE 2
+#define BIN_ERR_LENGTH 3
+#define BIN_ERR_RANGE 4
+#define BIN_ERR_BUSY 5
+#define BIN_ERR_TIMEOUT 6
+
+// bulk sample formats
+#define BIN_BULK_FLOAT32 0      // degrees
+#define BIN_BULK_INT16 1        // degrees = sample * scale
+#define BIN_BULK_Q16 2          // int32 Q16.16 degrees, stored as sent
+#define BIN_BULK_HEADER_SIZE 9
+#define BIN_BULK_TIMEOUT_MS 1000 // an upload with no byte for this long is dropped
+
+void binProto_Startup();
+void binProto_Service();    // answer the binary frame at the head of the command queue
+void binProto_Poll();       // housekeeping between commands, drops stalled bulk uploads
+
+#endif // BINPROTO__H__
@@ -0,0 +1,287 @@
+#include "biquad.h"
+#include "hotpath.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include <math.h>
+#include <string.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static struct biquad_cascade_t filters[BQ_POINTS];
+static struct biquad_spec_t specs[BQ_POINTS][BIQUAD_MAX_SECTIONS];    // what each point was loaded with
+static float spec_fs[BQ_POINTS];                                    // and the rate it was loaded at
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static int to_q16(float x)
+{
+    x = (x > 32767.0) ? 32767.0 : x;
+    x = (x < -32767.0) ? -32767.0 : x;
+    return (int)(x * 65536.0f);
+}
+
+static int to_coeff(float c)
+{
+    return (int)(c * (float)(1 << BIQUAD_COEFF_SHIFT) + ((c < 0) ? -0.5f : 0.5f));
+}
+
+HOT int biquad_Run(struct biquad_cascade_t * f, int x)
+{
+    for (int i = 0; i < f->sections; i++)
+    {
+        struct biquad_t * s = &f->s[i];
+        long long acc = (long long)s->b0 * x;
+        acc += (long long)s->b1 * s->x1;
+        acc += (long long)s->b2 * s->x2;
+        acc -= (long long)s->a1 * s->y1;
+        acc -= (long long)s->a2 * s->y2;
+        int y = (int)(acc >> BIQUAD_COEFF_SHIFT);
+
+        s->x2 = s->x1;
+        s->x1 = x;
+        s->y2 = s->y1;
+        s->y1 = y;
+        x = y;
+    }
+    return x;
+}
+
+HOT float biquad_Filter(enum biquad_point_t point, float x)
+{
+    struct biquad_cascade_t * f = &filters[point];
+    if (f->sections == 0)
+    {
+        return x;
+    }
+    return biquad_Run(f, to_q16(x)) / 65536.0f;
+}
+
+void biquad_Reset(enum biquad_point_t point)
+{
+    struct biquad_cascade_t * f = &filters[point];
+    for (int i = 0; i < BIQUAD_MAX_SECTIONS; i++)
+    {
+        f->s[i].x1 = f->s[i].x2 = f->s[i].y1 = f->s[i].y2 = 0;
+    }
+}
+
+void biquad_ResetAll()
+{
+    for (int p = 0; p < BQ_POINTS; p++)
+    {
+        biquad_Reset(p);
+    }
+}
+
+// A section's coefficients at from Hz taken to the same analog prototype at
+// to Hz. The bilinear transform s = 2fs (z - 1) / (z + 1) at both ends, so only
+// the ratio of the rates is needed.
+static void remap(const float in[5], float from, float to, float out[5])
+{
+    float r = to / from;
+    float num[3] = {in[0], in[1], in[2]};
+    float den[3] = {1, in[3], in[4]};
+    float n[3], d[3];
+    for (int k = 0; k < 2; k++)
+    {
+        const float * c = k ? den : num;
+        float * o = k ? d : n;
+        float s2 = (c[0] - c[1] + c[2]) * r * r;   // the prototype's s^2, s and 1 terms
+        float s1 = 2 * (c[0] - c[2]) * r;
+        float s0 = c[0] + c[1] + c[2];
+        o[0] = s2 + s1 + s0;
+        o[1] = 2 * (s0 - s2);
+        o[2] = s2 - s1 + s0;
+    }
+    out[0] = n[0] / d[0];
+    out[1] = n[1] / d[0];
+    out[2] = n[2] / d[0];
+    out[3] = d[1] / d[0];
+    out[4] = d[2] / d[0];
+}
+
+static void design_at(const struct biquad_spec_t * spec, float fs, float coeffs[5])
+{
+    if (spec->kind == BQ_LOWPASS)
+    {
+        biquad_DesignLowPass(spec->fc, spec->q, fs, coeffs);
+    }
+    else if (spec->kind == BQ_NOTCH)
+    {
+        biquad_DesignNotch(spec->fc, spec->q, fs, coeffs);
+    }
+    else
+    {
+        memcpy(coeffs, spec->coeffs, sizeof(spec->coeffs));
+    }
+}
+
+// The coefficients of spec at fs, it was loaded at load_fs
+static void design(const struct biquad_spec_t * spec, float load_fs, float fs, float coeffs[5])
+{
+    if ((spec->kind != BQ_COEFFS) && (spec->fc < fs / 2))
+    {
+        design_at(spec, fs, coeffs);
+        return;
+    }
+    float at_load[5];
+    design_at(spec, load_fs, at_load);
+    remap(at_load, load_fs, fs, coeffs);
+}
+
+// fresh clears the history; a retimed filter keeps it, the signal it holds is the same
+static int load(enum biquad_point_t point, int sections, const float coeffs[][5], int fresh)
+{
+    for (int i = 0; i < sections; i++)
+    {
+        for (int k = 0; k < 5; k++)
+        {
+            if (!(fabsf(coeffs[i][k]) <= BIQUAD_COEFF_MAX))
+            {
+                return 1;
+            }
+        }
+    }
+
+    // the ISR passes the signal straight through while the sections change
+    struct biquad_cascade_t * f = &filters[point];
+    f->sections = 0;
+    for (int i = 0; i < sections; i++)
+    {
+        struct biquad_t * s = &f->s[i];
+        s->b0 = to_coeff(coeffs[i][0]);
+        s->b1 = to_coeff(coeffs[i][1]);
+        s->b2 = to_coeff(coeffs[i][2]);
+        s->a1 = to_coeff(coeffs[i][3]);
+        s->a2 = to_coeff(coeffs[i][4]);
+    }
+    if (fresh)
+    {
+        biquad_Reset(point);
+    }
+    f->sections = sections;
+    return 0;
+}
+
+int biquad_Load(enum biquad_point_t point, int sections, const float coeffs[][5])
+{
+    struct biquad_spec_t s[BIQUAD_MAX_SECTIONS];
+    if ((sections < 0) || (sections > BIQUAD_MAX_SECTIONS))
+    {
+        return 1;
+    }
+    for (int i = 0; i < sections; i++)
+    {
+        s[i].kind = BQ_COEFFS;
+        memcpy(s[i].coeffs, coeffs[i], sizeof(s[i].coeffs));
+    }
+    return biquad_LoadSpecs(point, sections, s);
+}
+
+// Designed at the point's rate as it is now
+int biquad_LoadSpecs(enum biquad_point_t point, int sections, const struct biquad_spec_t * s)
+{
+    float coeffs[BIQUAD_MAX_SECTIONS][5];
+    if ((point < 0) || (point >= BQ_POINTS) || (sections < 0) || (sections > BIQUAD_MAX_SECTIONS))
+    {
+        return 1;
+    }
+    float fs = biquad_SampleRate(point);
+    for (int i = 0; i < sections; i++)
+    {
+        design(&s[i], fs, fs, coeffs[i]);
+    }
+    if (load(point, sections, coeffs, 1))
+    {
+        return 1;
+    }
+    memcpy(specs[point], s, sections * sizeof(s[0]));
+    spec_fs[point] = fs;
+    return 0;
+}
+
+int biquad_Retime(enum biquad_point_t point)
+{
+    float coeffs[BIQUAD_MAX_SECTIONS][5];
+    struct biquad_cascade_t * f = &filters[point];
+    for (int i = 0; i < f->sections; i++)
+    {
+        design(&specs[point][i], spec_fs[point], biquad_SampleRate(point), coeffs[i]);
+    }
+    if (load(point, f->sections, coeffs, 0))
+    {
+        f->sections = 0;
+        return 1;
+    }
+    return 0;
+}
+
+int biquad_GetSections(enum biquad_point_t point)
+{
+    return filters[point].sections;
+}
+
+float biquad_SampleRate(enum biquad_point_t point)
+{
+    return (point == BQ_CURRENT) ? getCurrentLoopRate() : getPositionLoopRate();
+}
+
+void biquad_DesignLowPass(float fc, float q, float fs, float coeffs[5])
+{
+    float w = 2 * M_PI * fc / fs;
+    float alpha = sinf(w) / (2 * q);
+    float a0 = 1 + alpha;
+    coeffs[0] = (1 - cosf(w)) / 2 / a0;
+    coeffs[1] = (1 - cosf(w)) / a0;
+    coeffs[2] = coeffs[0];
+    coeffs[3] = -2 * cosf(w) / a0;
+    coeffs[4] = (1 - alpha) / a0;
+}
+
+void biquad_DesignNotch(float fc, float q, float fs, float coeffs[5])
+{
+    float w = 2 * M_PI * fc / fs;
+    float alpha = sinf(w) / (2 * q);
+    float a0 = 1 + alpha;
+    coeffs[0] = 1 / a0;
+    coeffs[1] = -2 * cosf(w) / a0;
+    coeffs[2] = coeffs[0];
+    coeffs[3] = coeffs[1];
+    coeffs[4] = (1 - alpha) / a0;
+}
+
+// The fastest of a few single samples, an interrupt landing inside one only
+// makes that one slower. The core timer ticks once every two CPU cycles.
+unsigned int biquad_Benchmark(int sections)
+{
+    static struct biquad_cascade_t scratch;
+    float lp[5];
+    unsigned int best = 0xFFFFFFFF;
+
+    sections = (sections > BIQUAD_MAX_SECTIONS) ? BIQUAD_MAX_SECTIONS : sections;
+    biquad_DesignLowPass(100, 0.707, 5000, lp);
+    memset(&scratch, 0, sizeof(scratch));
+    for (int i = 0; i < sections; i++)
+    {
+        scratch.s[i].b0 = to_coeff(lp[0]);
+        scratch.s[i].b1 = to_coeff(lp[1]);
+        scratch.s[i].b2 = to_coeff(lp[2]);
+        scratch.s[i].a1 = to_coeff(lp[3]);
+        scratch.s[i].a2 = to_coeff(lp[4]);
+    }
+    scratch.sections = sections;
+
+    for (int n = 0; n < 16; n++)
+    {
+        unsigned int start = _CP0_GET_COUNT();
+        biquad_Run(&scratch, 100 << 16);
+        unsigned int ticks = _CP0_GET_COUNT() - start;
+        best = (ticks < best) ? ticks : best;
+    }
+    return best * 2;
+}
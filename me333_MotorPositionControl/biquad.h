@@ -0,0 +1,95 @@
+#ifndef BIQUAD_H_
+#define BIQUAD_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+
+// Fixed-point biquad cascades at three points in the loops:
+//   BQ_CURRENT  the INA219 reading, before the current PI (5 kHz)
+//   BQ_RATE     the angle rate for the position D term (200 Hz)
+//   BQ_COMMAND  dCurrent, the position PID output (200 Hz)
+//
+// Each section is direct form I,
+//   y = b0 x + b1 x1 + b2 x2 - a1 y1 - a2 y2
+// with Q4.28 coefficients, Q16.16 samples and a 64 bit accumulator, which the
+// M4K does with madd/msub on HI/LO. A point with no sections passes its signal
+// straight through. Coefficients are loaded at run time, either as numbers
+// normalised to a0 = 1 or designed on the target from a corner and a Q.
+//
+// What was loaded is kept, so when a loop's rate changes biquad_Retime can
+// put the same filter back at the new rate: a low-pass or notch is designed
+// again from its corner and Q, numbers are taken through the bilinear
+// transform's analog prototype at the rate they were loaded at and back at the
+// new one. A corner at or past the new Nyquist is mapped that way too.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define BIQUAD_MAX_SECTIONS 3
+#define BIQUAD_COEFF_SHIFT 28
+#define BIQUAD_COEFF_MAX 7.99       // Q4.28 range
+
+enum biquad_point_t {
+    BQ_CURRENT,
+    BQ_RATE,
+    BQ_COMMAND,
+    BQ_POINTS
+};
+
+enum biquad_kind_t {
+    BQ_COEFFS,          // numbers, b0 b1 b2 a1 a2
+    BQ_LOWPASS,
+    BQ_NOTCH
+};
+
+
+/*************************
+ * PUBLIC TYPES
+*************************/
+
+struct biquad_t {
+    int b0, b1, b2, a1, a2;         // Q4.28
+    int x1, x2, y1, y2;             // Q16.16
+};
+
+struct biquad_cascade_t {
+    volatile int sections;
+    struct biquad_t s[BIQUAD_MAX_SECTIONS];
+};
+
+struct biquad_spec_t {
+    enum biquad_kind_t kind;
+    float fc, q;                    // BQ_LOWPASS and BQ_NOTCH, Hz
+    float coeffs[5];                // BQ_COEFFS, for the point's rate at the time they are loaded
+};
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int biquad_Run(struct biquad_cascade_t * f, int x);         // one Q16 sample through every section
+float biquad_Filter(enum biquad_point_t point, float x);    // one sample at a loop point
+void biquad_Reset(enum biquad_point_t point);               // clear the history, coefficients stay
+void biquad_ResetAll();
+
+// coeffs are b0 b1 b2 a1 a2, returns 1 if they do not fit Q4.28 or the point is unknown
+int biquad_Load(enum biquad_point_t point, int sections, const float coeffs[][5]);
+int biquad_LoadSpecs(enum biquad_point_t point, int sections, const struct biquad_spec_t * specs);
+int biquad_Retime(enum biquad_point_t point);          // after its loop's rate changed, 1 and cleared if it cannot be
+int biquad_GetSections(enum biquad_point_t point);
+float biquad_SampleRate(enum biquad_point_t point);    // the rate of the loop the point is in
+
+// Audio EQ cookbook designs, fc and fs in Hz
+void biquad_DesignLowPass(float fc, float q, float fs, float coeffs[5]);
+void biquad_DesignNotch(float fc, float q, float fs, float coeffs[5]);
+
+unsigned int biquad_Benchmark(int sections);   // CPU cycles for one sample through that many sections
+
+
+#endif
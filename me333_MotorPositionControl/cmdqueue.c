@@ -0,0 +1,312 @@
+#include "cmdqueue.h"
+#include "crc16.h"
+#include "trace.h"
+#include <string.h>
+
+// UART3 receive side of the menu, interrupt driven.
+// The ISR assembles '\r' or '\n' terminated lines straight into a ring of message
+// slots, so the main loop never has to sit in NU32_ReadUART3 waiting for the host.
+// A BIN_MAGIC byte where a line would start switches to binary frame reception
+// for one frame, the menu text itself is 7 bit so it can never be mistaken for one.
+// A good BIN_OP_TRAJ_BULK header frame switches to bulk reception, the raw samples
+// that follow are written straight into the bulk target with a running CRC.
+// When every slot is full the RX interrupt is switched off and the UART3 hardware
+// flow control holds the host back until the main loop frees a slot.
+// A CMD_ABORT_CHAR line only aborts from the ISR in command position: with the
+// main loop between commands and no line queued ahead of it. Anywhere else it
+// may be an argument, such as a stored trajectory's name, and is only queued;
+// behind a line the main loop has yet to take, the menu's own 'p' still stops the run.
+
+struct cmd_slot_t {
+  unsigned char kind;
+  unsigned short length;
+  unsigned int stamp;           // core timer when the last byte came in
+  char data[CMD_SLOT_SIZE];
+};
+
+static struct cmd_slot_t slots[CMD_QUEUE_DEPTH];
+static volatile unsigned int head = 0;      // slot the ISR is filling
+static volatile unsigned int tail = 0;      // oldest complete message not yet read
+static int rx_num_bytes = 0;
+static int in_frame = 0;
+static int frame_length = 0;
+static unsigned short frame_crc = CRC16_INIT;
+static volatile unsigned int abort_count = 0;
+static volatile int in_command = 0;         // the main loop took a menu line, its arguments may follow
+static volatile unsigned int dropped_frames = 0;
+
+static unsigned char * bulk_target = 0;
+static int bulk_max_bytes = 0;
+static volatile enum cmd_bulk_state_t bulk_state = BULK_OFF;
+static int bulk_received = 0;
+static int bulk_length = 0;
+static unsigned int bulk_start = 0;
+static volatile unsigned int bulk_last_byte = 0;
+static struct cmd_bulk_t bulk;
+
+static unsigned int taken_stamp = 0;
+static enum cmd_kind_t taken_kind = CMD_NONE;
+static struct cmd_latency_t line_latency;
+static struct cmd_latency_t frame_latency;
+
+static void queue_slot(struct cmd_slot_t * slot, enum cmd_kind_t kind) {
+  slot->kind = kind;
+  slot->length = rx_num_bytes;
+  slot->stamp = _CP0_GET_COUNT();
+  rx_num_bytes = 0;
+  in_frame = 0;
+  ++head;
+  if ((head - tail) == CMD_QUEUE_DEPTH) {
+    IEC1bits.U3RXIE = 0; // no free slot, leave the rest in the FIFO
+  }
+}
+
+// Called on a good BIN_OP_TRAJ_BULK header, payload is
+// uint16 count, uint8 format, float scale, uint16 CRC of the raw samples
+static void arm_bulk(const unsigned char * payload, int length) {
+  unsigned short count = payload[0] | (payload[1] << 8);
+  int format = payload[2];
+  int size = (format == BIN_BULK_INT16) ? 2 : 4;
+  if ((length != BIN_BULK_HEADER_SIZE) || (bulk_state != BULK_OFF) || (format > BIN_BULK_Q16)
+      || (count == 0) || (count * 4 > bulk_max_bytes) || (get_mode() == TRACK)) {
+    return; // the trajectory is in use or the upload cannot fit, the reply says so
+  }
+  bulk.count = count;
+  bulk.format = format;
+  memcpy(&bulk.scale, &payload[3], 4);
+  bulk.expected_crc = payload[7] | (payload[8] << 8);
+  bulk.crc = CRC16_INIT;
+  bulk_length = count * size;
+  bulk_received = 0;
+  bulk_start = bulk_last_byte = _CP0_GET_COUNT();
+  bulk_state = BULK_RECEIVING;
+}
+
+// Whether a line coming in now is a menu command rather than an argument
+static int command_position() {
+  if (in_command) {
+    return 0;
+  }
+  for (unsigned int i = tail; i != head; i++) {
+    if (slots[i & (CMD_QUEUE_DEPTH - 1)].kind == CMD_LINE) {
+      return 0; // a command not taken yet, this may be its argument
+    }
+  }
+  return 1;
+}
+
+void __ISR(_UART_3_VECTOR, IPL3SOFT) U3ISR(void) {
+  int bytes = 0;
+  trace_Record(TRACE_HOST_ISR, TRACE_BEGIN, 0);
+  while (U3STAbits.URXDA && IEC1bits.U3RXIE) {
+    unsigned char data = U3RXREG; // read the data
+    ++bytes;
+    struct cmd_slot_t * slot = &slots[head & (CMD_QUEUE_DEPTH - 1)];
+    if (bulk_state == BULK_RECEIVING) {
+      bulk_target[bulk_received] = data;
+      bulk.crc = CRC16_UPDATE(bulk.crc, data);
+      bulk_last_byte = _CP0_GET_COUNT();
+      ++bulk_received;
+      if (bulk_received == bulk_length) {
+        bulk.ticks = bulk_last_byte - bulk_start;
+        bulk_state = BULK_DONE;
+        queue_slot(slot, CMD_BULK);
+      }
+    }
+    else if (in_frame) {
+      slot->data[rx_num_bytes] = data;
+      ++rx_num_bytes;
+      if ((rx_num_bytes <= BIN_HEADER_SIZE) || (rx_num_bytes <= frame_length - BIN_CRC_SIZE)) {
+        frame_crc = CRC16_UPDATE(frame_crc, data);
+      }
+      if (rx_num_bytes == BIN_HEADER_SIZE) {
+        int payload = (unsigned char)slot->data[1] | ((unsigned char)slot->data[2] << 8);
+        if (payload > BIN_MAX_PAYLOAD) {
+          // cannot be ours, go back to looking for lines
+          ++dropped_frames;
+          rx_num_bytes = 0;
+          in_frame = 0;
+          continue;
+        }
+        frame_length = BIN_HEADER_SIZE + payload + BIN_CRC_SIZE;
+      }
+      if ((rx_num_bytes > BIN_HEADER_SIZE) && (rx_num_bytes == frame_length)) {
+        unsigned short crc = (unsigned char)slot->data[frame_length - 2]
+                             | ((unsigned char)slot->data[frame_length - 1] << 8);
+        if (crc != frame_crc) {
+          queue_slot(slot, CMD_BAD_FRAME);
+        }
+        else {
+          if ((unsigned char)slot->data[0] == BIN_OP_ABORT) {
+            set_mode(IDLE);
+            ++abort_count;
+          }
+          else if ((unsigned char)slot->data[0] == BIN_OP_TRAJ_BULK) {
+            arm_bulk((unsigned char *)&slot->data[BIN_HEADER_SIZE], frame_length - BIN_HEADER_SIZE - BIN_CRC_SIZE);
+          }
+          queue_slot(slot, CMD_FRAME);
+        }
+      }
+    }
+    else if ((rx_num_bytes == 0) && (data == BIN_MAGIC)) {
+      in_frame = 1;
+      frame_length = 0;
+      frame_crc = CRC16_INIT;
+    }
+    else if ((data == '\n') || (data == '\r')) {
+      slot->data[rx_num_bytes] = '\0';
+      // abort is acted on here so it lands within one control tick,
+      // the line is still queued so the menu can echo it as usual
+      if ((rx_num_bytes == 1) && (slot->data[0] == CMD_ABORT_CHAR) && command_position()) {
+        set_mode(IDLE);
+        ++abort_count;
+      }
+      queue_slot(slot, CMD_LINE);
+    }
+    else {
+      slot->data[rx_num_bytes] = data;
+      ++rx_num_bytes;
+      // roll over if the array is too small
+      if (rx_num_bytes >= CMD_LINE_LENGTH) {
+        rx_num_bytes = 0;
+      }
+    }
+  }
+  trace_Record(TRACE_HOST_ISR, TRACE_END, bytes);
+  IFS1bits.U3RXIF = 0;
+}
+
+enum cmd_kind_t cmdQueue_NextKind() {
+  if (head == tail) {
+    return CMD_NONE;
+  }
+  return slots[tail & (CMD_QUEUE_DEPTH - 1)].kind;
+}
+
+static void release_slot(const struct cmd_slot_t * slot) {
+  taken_stamp = slot->stamp;
+  taken_kind = slot->kind;
+  ++tail;
+  IEC1bits.U3RXIE = 1; // a slot is free again
+}
+
+// Copy the oldest line into line, returns 0 straight away if there is none
+int cmdQueue_GetLine(char * line, int maxLength) {
+  if (cmdQueue_NextKind() != CMD_LINE) {
+    return 0;
+  }
+  const struct cmd_slot_t * slot = &slots[tail & (CMD_QUEUE_DEPTH - 1)];
+  int i = 0;
+  while ((slot->data[i] != '\0') && (i < maxLength - 1)) {
+    line[i] = slot->data[i];
+    ++i;
+  }
+  line[i] = '\0';
+  in_command = 1; // before the slot goes, so the ISR always sees one or the other
+  release_slot(slot);
+  return 1;
+}
+
+// Same contract as NU32_ReadUART3, used for the argument lines that follow a command.
+// A frame sitting where an argument line should be is a host error and is dropped.
+void cmdQueue_ReadLine(char * line, int maxLength) {
+  while (!cmdQueue_GetLine(line, maxLength)) {
+    enum cmd_kind_t kind = cmdQueue_NextKind();
+    if ((kind == CMD_FRAME) || (kind == CMD_BAD_FRAME)) {
+      cmdQueue_GetFrame(0, 0);
+    }
+    else if (kind == CMD_BULK) {
+      struct cmd_bulk_t dropped;
+      cmdQueue_GetBulk(&dropped);
+    }
+  }
+}
+
+// Copy the oldest frame (opcode, length, payload, CRC) into frame, returns its length
+// or 0 if the oldest message is not a frame. A frame longer than maxLength is dropped.
+int cmdQueue_GetFrame(unsigned char * frame, int maxLength) {
+  enum cmd_kind_t kind = cmdQueue_NextKind();
+  if ((kind != CMD_FRAME) && (kind != CMD_BAD_FRAME)) {
+    return 0;
+  }
+  const struct cmd_slot_t * slot = &slots[tail & (CMD_QUEUE_DEPTH - 1)];
+  int length = slot->length;
+  if (length > maxLength) {
+    length = 0;
+  }
+  for (int i = 0; i < length; i++) {
+    frame[i] = slot->data[i];
+  }
+  release_slot(slot);
+  return length;
+}
+
+unsigned int cmdQueue_GetAbortCount() {
+  return abort_count;
+}
+
+unsigned int cmdQueue_GetDroppedFrames() {
+  return dropped_frames;
+}
+
+void cmdQueue_SetBulkTarget(void * dest, int maxBytes) {
+  bulk_target = dest;
+  bulk_max_bytes = maxBytes;
+}
+
+enum cmd_bulk_state_t cmdQueue_GetBulkState() {
+  return bulk_state;
+}
+
+int cmdQueue_GetBulk(struct cmd_bulk_t * out) {
+  if (cmdQueue_NextKind() != CMD_BULK) {
+    return 0;
+  }
+  *out = bulk;
+  release_slot(&slots[tail & (CMD_QUEUE_DEPTH - 1)]);
+  bulk_state = BULK_OFF;
+  return 1;
+}
+
+int cmdQueue_CancelStalledBulk(unsigned int ticks) {
+  int cancelled = 0;
+  IEC1bits.U3RXIE = 0;
+  if ((bulk_state == BULK_RECEIVING) && ((_CP0_GET_COUNT() - bulk_last_byte) > ticks)) {
+    bulk_state = BULK_OFF;
+    cancelled = 1;
+  }
+  IEC1bits.U3RXIE = ((head - tail) < CMD_QUEUE_DEPTH);
+  return cancelled;
+}
+
+// latency runs until the last reply byte is in the UART3 TX FIFO
+void cmdQueue_CommandDone() {
+  in_command = 0;
+  if (taken_kind == CMD_NONE) {
+    return;
+  }
+  struct cmd_latency_t * l = (taken_kind == CMD_LINE) ? &line_latency : &frame_latency;
+  l->last = _CP0_GET_COUNT() - taken_stamp;
+  l->max = (l->last > l->max) ? l->last : l->max;
+  l->total += l->last;
+  ++l->count;
+  taken_kind = CMD_NONE;
+}
+
+void cmdQueue_GetLatency(enum cmd_kind_t kind, struct cmd_latency_t * latency) {
+  *latency = (kind == CMD_LINE) ? line_latency : frame_latency;
+}
+
+//  Hand UART3 receive over to the interrupt, NU32_Startup has already set up the port
+void cmdQueue_Startup() {
+  // disable interrupts
+  __builtin_disable_interrupts();
+
+  U3STAbits.URXISEL = 0; // interrupt when a char is rcvd
+  IPC7bits.U3IP = 3;     // below the control loops and the encoder
+  IPC7bits.U3IS = 0;
+  IFS1bits.U3RXIF = 0;
+  IEC1bits.U3RXIE = 1;
+
+  __builtin_enable_interrupts();
+}
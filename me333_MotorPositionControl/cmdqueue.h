@@ -0,0 +1,62 @@
+#ifndef CMDQUEUE__H__
+#define CMDQUEUE__H__
+
+#include <xc.h> // processor SFR definitions
+#include <sys/attribs.h> // __ISR macro
+
+#include "NU32.h"
+#include "utilities.h"
+#include "binproto.h"
+
+#define CMD_LINE_LENGTH 100   // longest line kept, longer lines roll over like NU32_ReadUART3
+#define CMD_QUEUE_DEPTH 8     // number of complete messages buffered, must be a power of two
+#define CMD_ABORT_CHAR 'p'    // a command line holding only this char drops to IDLE straight from the ISR
+#define CMD_SLOT_SIZE (BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE)
+
+enum cmd_kind_t {
+    CMD_NONE,
+    CMD_LINE,       // ASCII menu line, terminator stripped
+    CMD_FRAME,      // binary frame, magic stripped, CRC good
+    CMD_BAD_FRAME,  // binary frame whose CRC did not match
+    CMD_BULK        // a bulk upload has finished streaming in
+};
+
+enum cmd_bulk_state_t {
+    BULK_OFF,
+    BULK_RECEIVING, // raw bytes go straight to the bulk target
+    BULK_DONE       // all bytes in, CMD_BULK queued
+};
+
+struct cmd_bulk_t {
+    int count;                  // samples
+    int format;                 // BIN_BULK_FLOAT32, BIN_BULK_INT16 or BIN_BULK_Q16
+    float scale;                // int16 samples are multiplied by this
+    unsigned short crc;         // CRC over the raw bytes as they arrived
+    unsigned short expected_crc;
+    unsigned int ticks;         // core timer ticks from header to last byte
+};
+
+struct cmd_latency_t {
+    unsigned int count;         // commands answered
+    unsigned int last;          // core timer ticks from last byte in to reply written
+    unsigned int max;
+    unsigned long long total;
+};
+
+void cmdQueue_Startup();
+enum cmd_kind_t cmdQueue_NextKind();                // kind of the oldest queued message, CMD_NONE if empty
+int cmdQueue_GetLine(char * line, int maxLength);   // non-blocking, returns 1 if a line was copied out
+void cmdQueue_ReadLine(char * line, int maxLength); // blocking, drop-in for NU32_ReadUART3
+int cmdQueue_GetFrame(unsigned char * frame, int maxLength); // non-blocking, returns the frame length or 0
+unsigned int cmdQueue_GetAbortCount();
+unsigned int cmdQueue_GetDroppedFrames();
+
+void cmdQueue_SetBulkTarget(void * dest, int maxBytes); // where BIN_OP_TRAJ_BULK streams to
+enum cmd_bulk_state_t cmdQueue_GetBulkState();
+int cmdQueue_GetBulk(struct cmd_bulk_t * bulk);     // takes the CMD_BULK message, returns 1 if there was one
+int cmdQueue_CancelStalledBulk(unsigned int ticks); // gives up on an upload idle for ticks, returns 1 if it did
+
+void cmdQueue_CommandDone();                        // reply is out, account the last message taken
+void cmdQueue_GetLatency(enum cmd_kind_t kind, struct cmd_latency_t * latency);
+
+#endif // CMDQUEUE__H__
@@ -0,0 +1,196 @@
+#include "cogging.h"
+#include "hotpath.h"
+#include <string.h>
+
+
+/*************************
+ * CONSTANTS
+*************************/
+enum cogging_state_t {
+    COG_IDLE,
+    COG_FORWARD,
+    COG_BACKWARD,
+    COG_FIT         // sweep done, the main loop turns the sums into the table
+};
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static volatile int compensation_enabled = 0;
+static volatile enum cogging_state_t state = COG_IDLE;
+
+static int sweep_start;         // Q16 degrees
+static int sweep_reference;     // Q16 degrees
+static float sums[2][COG_BINS];             // commanded mA, forward and backward
+static unsigned short counts[2][COG_BINS];
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static HOT int wrap_count(int count)
+{
+    count %= COUNTS_PER_REV;
+    return (count < 0) ? count + COUNTS_PER_REV : count;
+}
+
+static HOT short to_q4(float ma)
+{
+    float q = ma * (1 << COG_SHIFT);
+    q = (q > 32767.0) ? 32767.0 : q;
+    q = (q < -32767.0) ? -32767.0 : q;
+    return (short)(q + ((q < 0) ? -0.5f : 0.5f));
+}
+
+void setCoggingCompensation(int enabled)
+{
+    compensation_enabled = enabled ? 1 : 0;
+}
+
+int getCoggingCompensation()
+{
+    return compensation_enabled;
+}
+
+float getCoggingFriction()
+{
+    return coggingTable.friction / (float)(1 << COG_SHIFT);
+}
+
+float getCoggingRipple()
+{
+    int lo = coggingTable.bins[0], hi = coggingTable.bins[0];
+    for (int b = 1; b < COG_BINS; b++)
+    {
+        lo = (coggingTable.bins[b] < lo) ? coggingTable.bins[b] : lo;
+        hi = (coggingTable.bins[b] > hi) ? coggingTable.bins[b] : hi;
+    }
+    return (hi - lo) / (float)(1 << COG_SHIFT);
+}
+
+float cogging_StartCalibration(int start)
+{
+    if ((get_mode() != IDLE) || (state != COG_IDLE))
+    {
+        return -1;
+    }
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+    sweep_start = sweep_reference = start;
+    state = COG_FORWARD;
+    return 2 * COG_SWEEP_SPAN / COG_SWEEP_RATE;
+}
+
+int cogging_Calibrating()
+{
+    return (state != COG_IDLE);
+}
+
+int cogging_Sweeping()
+{
+    return (state == COG_FORWARD) || (state == COG_BACKWARD);
+}
+
+void cogging_Cancel()
+{
+    if (cogging_Sweeping())
+    {
+        state = COG_IDLE;   // left HOLD before the sweep finished
+    }
+}
+
+// Fit the table from a finished sweep. A bin either direction missed leaves
+// the table marked invalid.
+void cogging_Poll()
+{
+    if (state != COG_FIT)
+    {
+        return;
+    }
+    float friction = 0;
+    int valid = 1;
+    for (int b = 0; b < COG_BINS; b++)
+    {
+        if ((counts[0][b] == 0) || (counts[1][b] == 0))
+        {
+            valid = 0;
+            coggingTable.bins[b] = 0;
+            continue;
+        }
+        float forward = sums[0][b] / counts[0][b];
+        float backward = sums[1][b] / counts[1][b];
+        coggingTable.bins[b] = to_q4((forward + backward) / 2);
+        friction += (forward - backward) / 2;
+    }
+    coggingTable.friction = valid ? to_q4(friction / COG_BINS) : 0;
+    coggingTable.valid = valid;
+    state = COG_IDLE;
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT int cogging_CalibrationStep(int count, float current)
+{
+    const int step = DEG_TO_Q16(COG_SWEEP_RATE * getPositionDT());
+    const int lead_in = DEG_TO_Q16(COG_SWEEP_LEAD_IN);
+    const int span = DEG_TO_Q16(COG_SWEEP_SPAN);
+    int bin = ((wrap_count(count) + COG_BIN_COUNTS / 2) / COG_BIN_COUNTS) % COG_BINS;
+
+    if (state == COG_FORWARD)
+    {
+        if (Q16_DIFF(sweep_reference, sweep_start) >= lead_in)
+        {
+            sums[0][bin] += current;
+            counts[0][bin]++;
+        }
+        sweep_reference = Q16_ADD(sweep_reference, step);
+        if (Q16_DIFF(sweep_reference, sweep_start) >= span)
+        {
+            state = COG_BACKWARD;
+        }
+    }
+    else if (state == COG_BACKWARD)
+    {
+        if (span - Q16_DIFF(sweep_reference, sweep_start) >= lead_in)
+        {
+            sums[1][bin] += current;
+            counts[1][bin]++;
+        }
+        sweep_reference = Q16_ADD(sweep_reference, -step);
+        if (Q16_DIFF(sweep_reference, sweep_start) <= 0)
+        {
+            sweep_reference = sweep_start;
+            state = COG_FIT;
+        }
+    }
+    return sweep_reference;
+}
+
+HOT float cogging_Feedforward(int count, float velocity)
+{
+    if (!compensation_enabled || !coggingTable.valid || (state != COG_IDLE))
+    {
+        return 0;
+    }
+    int c = wrap_count(count);
+    int bin = c / COG_BIN_COUNTS;
+    int frac = c - bin * COG_BIN_COUNTS;
+    int next = (bin + 1 == COG_BINS) ? 0 : bin + 1;
+    int q = coggingTable.bins[bin] * (COG_BIN_COUNTS - frac) + coggingTable.bins[next] * frac;
+    float ff = q / (float)(COG_BIN_COUNTS << COG_SHIFT);
+
+    if (velocity > COG_FRICTION_DEADBAND)
+    {
+        ff += getCoggingFriction();
+    }
+    else if (velocity < -COG_FRICTION_DEADBAND)
+    {
+        ff -= getCoggingFriction();
+    }
+    return ff;
+}
@@ -0,0 +1,84 @@
+#ifndef COGGING_H_
+#define COGGING_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "positioncontrol.h"
+
+// Position-indexed cogging and friction compensation.
+//
+// A calibration run holds the shaft in HOLD while the setpoint sweeps one way
+// and then back, slowly, over a little more than a revolution. The current the
+// loop commands is averaged per encoder bin for each direction. Half the sum of
+// the two directions is the position-dependent holding current (cogging, load
+// ripple), half the difference is the friction, kept as one Coulomb value. The
+// viscous part at the sweep speed ends up in the friction too.
+//
+// The table is indexed by the encoder count modulo one revolution, so it is only
+// good while the encoder keeps the zero it had during the calibration.
+//
+// With compensation on, the position loop adds the table value, linearly
+// interpolated between bins, plus the friction against the direction the
+// reference moves, to the current it commands.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define COG_BIN_COUNTS 4                            // encoder counts per bin, one encoder line
+#define COG_BINS (COUNTS_PER_REV / COG_BIN_COUNTS)
+#define COG_SHIFT 4                                 // table entries are Q4 mA
+#define COG_SWEEP_RATE 5.0                          // deg/s, slow enough that inertia drops out
+#define COG_SWEEP_LEAD_IN 15.0                      // degrees swept before recording starts
+#define COG_SWEEP_SPAN (360.0 + COG_SWEEP_LEAD_IN)  // degrees each way
+#define COG_FRICTION_DEADBAND 1.0                   // deg/s of reference speed before friction is added
+
+
+/*************************
+ * PUBLIC TYPES
+*************************/
+
+struct cogging_table_t {
+    short friction;             // Q4 mA
+    short valid;                // 1 once a calibration has filled every bin
+    short bins[COG_BINS];       // Q4 mA, holding current at the first count of each bin
+};
+
+
+/*************************
+ * PUBLIC GLOBAL VARIABLES
+*************************/
+struct cogging_table_t coggingTable;
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+void setCoggingCompensation(int enabled);
+int getCoggingCompensation();
+float getCoggingFriction();     // mA
+float getCoggingRipple();       // mA, peak to peak over the table
+
+// Returns the seconds the sweep takes, or -1 outside IDLE. The caller then
+// sets the desired angle to start and puts the motor in HOLD.
+float cogging_StartCalibration(int start);   // start in Q16 degrees
+int cogging_Calibrating();      // sweeping, or the table is still being fitted
+int cogging_Sweeping();
+void cogging_Cancel();          // current loop, every IDLE tick
+void cogging_Poll();            // main loop, fits the table once a sweep has finished
+
+// Called from the HOLD branch of the Timer4 ISR during a calibration. Takes this
+// tick's count and the current last commanded, returns the next setpoint.
+int cogging_CalibrationStep(int count, float current);
+
+// Position loop side, mA to add at count while the reference moves at velocity deg/s
+float cogging_Feedforward(int count, float velocity);
+
+
+#endif
@@ -0,0 +1,312 @@
+#include "config.h"
+#include "crc16.h"
+#include "utilities.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "cogging.h"
+#include <string.h>
+
+
+/*************************
+ * CONSTANTS
+*************************/
+#define RECORD_MAGIC 0xC0F6
+#define RECORD_CONFIG 1
+#define RECORD_TRAJECTORY 2
+#define RECORD_COGGING 3
+#define RECORD_CRC_START 10     // header bytes covered by the CRC, everything before crc
+
+#define PAD4(n) (((n) + 3) & ~3)
+
+
+/*************************
+ * PRIVATE TYPES AND GLOBAL VARIABLES
+*************************/
+struct record_t {
+    unsigned short magic;
+    unsigned char version;
+    unsigned char type;
+    unsigned int seq;
+    unsigned short length;      // payload bytes that follow the header
+    unsigned short crc;         // over the header up to here and the payload
+};
+
+static int trajectory_id = -1;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static unsigned short record_crc(const struct record_t * r, const unsigned char * payload)
+{
+    unsigned short crc = crc16(CRC16_INIT, r, RECORD_CRC_START);
+    return crc16(crc, payload, r->length);
+}
+
+static int is_blank(const unsigned char * p, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (p[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Walk the records of one settings page. Returns the offset just past the last
+// record header that parses, so appending can carry on from there, and keeps
+// the newest good settings record seen so far in best/best_seq.
+static int scan_page(int page, const struct record_t ** best, unsigned int * best_seq)
+{
+    const unsigned char * base = nvm_page(page);
+    int offset = 0;
+    while (offset + (int)sizeof(struct record_t) <= NVM_PAGE_SIZE)
+    {
+        const struct record_t * r = (const struct record_t *)(base + offset);
+        int size = sizeof(struct record_t) + PAD4(r->length);
+        if ((r->magic != RECORD_MAGIC) || (offset + size > NVM_PAGE_SIZE))
+        {
+            break;      // blank from here on, or a header that was cut short
+        }
+        if ((r->type == RECORD_CONFIG) && (record_crc(r, (const unsigned char *)(r + 1)) == r->crc)
+            && ((*best == 0) || (r->seq > *best_seq)))
+        {
+            *best = r;
+            *best_seq = r->seq;
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+static const struct record_t * latest_config(int * page, int * end)
+{
+    const struct record_t * best = 0;
+    unsigned int best_seq = 0;
+    *page = 0;
+    *end = 0;
+    for (int p = 0; p < NVM_CONFIG_PAGES; p++)
+    {
+        const struct record_t * before = best;
+        int e = scan_page(p, &best, &best_seq);
+        if (best != before)
+        {
+            *page = p;
+            *end = e;
+        }
+    }
+    return best;
+}
+
+static const struct record_t * trajectory_record(int id)
+{
+    if ((id < 0) || (id >= NVM_TRAJ_SLOTS))
+    {
+        return 0;
+    }
+    const struct record_t * r = (const struct record_t *)nvm_page(NVM_CONFIG_PAGES + id * NVM_TRAJ_SLOT_PAGES);
+    if ((r->magic != RECORD_MAGIC) || (r->type != RECORD_TRAJECTORY) || (r->version != CONFIG_TRAJ_VERSION)
+        || (record_crc(r, (const unsigned char *)(r + 1)) != r->crc))
+    {
+        return 0;
+    }
+    return r;
+}
+
+static const struct record_t * cogging_record()
+{
+    const struct record_t * r = (const struct record_t *)nvm_page(NVM_COG_PAGE);
+    if ((r->magic != RECORD_MAGIC) || (r->type != RECORD_COGGING) || (r->version != CONFIG_COG_VERSION)
+        || (r->length != sizeof(coggingTable)) || (record_crc(r, (const unsigned char *)(r + 1)) != r->crc))
+    {
+        return 0;
+    }
+    return r;
+}
+
+// Rewrites the cogging page only when the table in RAM differs from the stored one
+static int store_cogging()
+{
+    struct record_t r;
+    const struct record_t * stored = cogging_record();
+    if (!coggingTable.valid || (stored && (memcmp(stored + 1, &coggingTable, sizeof(coggingTable)) == 0)))
+    {
+        return 0;
+    }
+    r.magic = RECORD_MAGIC;
+    r.version = CONFIG_COG_VERSION;
+    r.type = RECORD_COGGING;
+    r.seq = 0;
+    r.length = sizeof(coggingTable);
+    r.crc = record_crc(&r, (const unsigned char *)&coggingTable);
+    if (nvm_erase_page(NVM_COG_PAGE) || nvm_write(NVM_COG_PAGE, sizeof(r), &coggingTable, sizeof(coggingTable))
+        || nvm_write(NVM_COG_PAGE, 0, &r, sizeof(r)))
+    {
+        return 1;
+    }
+    return (cogging_record() == 0);
+}
+
+
+/*************************
+ * PUBLIC FUNCTIONS
+*************************/
+
+void config_Startup()
+{
+    struct config_t c;
+    int page, end;
+    const struct record_t * cog = cogging_record();
+    if (cog != 0)
+    {
+        memcpy(&coggingTable, cog + 1, sizeof(coggingTable));
+    }
+
+    const struct record_t * r = latest_config(&page, &end);
+    if (r == 0)
+    {
+        return;     // nothing stored, keep the compiled-in defaults
+    }
+
+    // start from the defaults so an older, shorter record leaves new fields alone
+    c.current_p = getCurrentP();
+    c.current_i = getCurrentI();
+    c.position_p = getPositionP();
+    c.position_i = getPositionI();
+    c.position_d = getPositionD();
+    c.trajectory_id = -1;
+    c.cogging_enabled = getCoggingCompensation();
+    memcpy(&c, r + 1, (r->length < sizeof(c)) ? r->length : sizeof(c));
+
+    setCurrentGains(c.current_p, c.current_i);
+    setPositionGains(c.position_p, c.position_i, c.position_d);
+    setCoggingCompensation(c.cogging_enabled);
+    if (c.trajectory_id >= 0)
+    {
+        config_SelectTrajectory(c.trajectory_id);
+    }
+}
+
+int config_Save()
+{
+    struct config_t c;
+    struct record_t r;
+    int page, end;
+
+    if ((get_mode() != IDLE) || cogging_Calibrating() || store_cogging())
+    {
+        return 1;
+    }
+    c.current_p = getCurrentP();
+    c.current_i = getCurrentI();
+    c.position_p = getPositionP();
+    c.position_i = getPositionI();
+    c.position_d = getPositionD();
+    c.trajectory_id = trajectory_id;
+    c.cogging_enabled = getCoggingCompensation();
+
+    const struct record_t * latest = latest_config(&page, &end);
+    r.magic = RECORD_MAGIC;
+    r.version = CONFIG_VERSION;
+    r.type = RECORD_CONFIG;
+    r.seq = latest ? latest->seq + 1 : 0;
+    r.length = sizeof(c);
+    r.crc = record_crc(&r, (const unsigned char *)&c);
+
+    int size = sizeof(r) + PAD4(sizeof(c));
+    if ((end + size > NVM_PAGE_SIZE) || !is_blank(nvm_page(page) + end, size))
+    {
+        // this page is used up, move on to the next one and erase it
+        page = latest ? (page + 1) % NVM_CONFIG_PAGES : page;
+        end = 0;
+        if (nvm_erase_page(page))
+        {
+            return 1;
+        }
+    }
+    // payload first, the header last, so a cut-off write never looks like a record
+    if (nvm_write(page, end + sizeof(r), &c, sizeof(c)) || nvm_write(page, end, &r, sizeof(r)))
+    {
+        return 1;
+    }
+    latest = latest_config(&page, &end);
+    return !(latest && (latest->seq == r.seq));
+}
+
+int config_StoreTrajectory(int id, const char * name)
+{
+    struct record_t r;
+    char padded[CONFIG_NAME_LENGTH];
+    int length = referenceTrajectoryLength;
+    int samples = length * sizeof(referenceTrajectory[0]);
+    int first = NVM_CONFIG_PAGES + id * NVM_TRAJ_SLOT_PAGES;
+    unsigned short crc;
+
+    if ((id < 0) || (id >= NVM_TRAJ_SLOTS) || (length <= 0) || (get_mode() != IDLE)
+        || (sizeof(r) + sizeof(padded) + samples > NVM_TRAJ_SLOT_PAGES * NVM_PAGE_SIZE))
+    {
+        return 1;
+    }
+    memset(padded, 0, sizeof(padded));
+    strncpy(padded, name, sizeof(padded) - 1);
+
+    r.magic = RECORD_MAGIC;
+    r.version = CONFIG_TRAJ_VERSION;
+    r.type = RECORD_TRAJECTORY;
+    r.seq = 0;
+    r.length = sizeof(padded) + samples;
+    crc = crc16(CRC16_INIT, &r, RECORD_CRC_START);
+    crc = crc16(crc, padded, sizeof(padded));
+    r.crc = crc16(crc, referenceTrajectory, samples);
+
+    for (int p = first; p < first + NVM_TRAJ_SLOT_PAGES; p++)
+    {
+        if (nvm_erase_page(p))
+        {
+            return 1;
+        }
+    }
+    if (nvm_write(first, sizeof(r), padded, sizeof(padded))
+        || nvm_write(first, sizeof(r) + sizeof(padded), referenceTrajectory, samples)
+        || nvm_write(first, 0, &r, sizeof(r)))
+    {
+        return 1;
+    }
+    return (trajectory_record(id) == 0);
+}
+
+int config_SelectTrajectory(int id)
+{
+    const struct record_t * r = trajectory_record(id);
+    if ((r == 0) || (get_mode() == TRACK))
+    {
+        return -1;
+    }
+    int samples = r->length - CONFIG_NAME_LENGTH;
+    memcpy(referenceTrajectory, (const unsigned char *)(r + 1) + CONFIG_NAME_LENGTH, samples);
+    referenceTrajectoryLength = samples / sizeof(referenceTrajectory[0]);
+    trajectory_id = id;
+    return referenceTrajectoryLength;
+}
+
+// Whatever the trajectory came from last, the next boot loads that and not a slot
+void config_ForgetTrajectory()
+{
+    trajectory_id = -1;
+}
+
+int config_GetTrajectoryInfo(int id, char * name)
+{
+    const struct record_t * r = trajectory_record(id);
+    if (r == 0)
+    {
+        name[0] = '\0';
+        return -1;
+    }
+    memcpy(name, r + 1, CONFIG_NAME_LENGTH);
+    name[CONFIG_NAME_LENGTH - 1] = '\0';
+    return (r->length - CONFIG_NAME_LENGTH) / sizeof(referenceTrajectory[0]);
+}
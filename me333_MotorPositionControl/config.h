@@ -0,0 +1,40 @@
+#ifndef CONFIG__H__
+#define CONFIG__H__
+
+#include "nvm.h"
+
+// Settings and trajectories kept in flash across power cycles.
+//
+// Settings are appended as CRC checked records to the NVM_CONFIG_PAGES pages in turn,
+// a page is only erased once the one before it is full, and the newest good record
+// wins at start up. A record written by an older firmware is loaded over the
+// compiled-in defaults, so new settings fields can be added at the end of config_t
+// with CONFIG_VERSION bumped.
+//
+// Each stored trajectory has its own slot of NVM_TRAJ_SLOT_PAGES pages with a name.
+// The cogging table has a page of its own, rewritten by a save only when it changed.
+
+#define CONFIG_VERSION 2         // 2: cogging_enabled
+#define CONFIG_TRAJ_VERSION 2    // 2: Q16 samples
+#define CONFIG_COG_VERSION 1
+#define CONFIG_NAME_LENGTH 16
+
+struct config_t {
+    float current_p;
+    float current_i;
+    float position_p;
+    float position_i;
+    float position_d;
+    int trajectory_id;      // stored trajectory loaded at start up, -1 for none
+    int cogging_enabled;
+};
+
+void config_Startup();      // apply the newest stored settings and trajectory
+int config_Save();          // 0 on success, the motor has to be IDLE, also stores a new cogging table
+
+int config_StoreTrajectory(int id, const char * name); // referenceTrajectory into slot id, 0 on success
+int config_SelectTrajectory(int id);                   // slot id into referenceTrajectory, returns its length or -1
+int config_GetTrajectoryInfo(int id, char * name);     // returns the stored length or -1 for an empty slot
+void config_ForgetTrajectory();     // referenceTrajectory was loaded from the host, a save keeps no slot id
+
+#endif // CONFIG__H__
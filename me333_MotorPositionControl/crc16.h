@@ -0,0 +1,16 @@
+#ifndef CRC16__H__
+#define CRC16__H__
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), used by every checked block on the wire
+
+#define CRC16_INIT 0xFFFF
+
+extern const unsigned short crc16_table[256];
+
+// one byte at a time, cheap enough to run inside the UART ISRs
+#define CRC16_UPDATE(crc, byte) \
+  ((unsigned short)(((crc) << 8) ^ crc16_table[(((crc) >> 8) ^ (unsigned char)(byte)) & 0xFF]))
+
+unsigned short crc16(unsigned short crc, const void * data, int length);
+
+#endif // CRC16__H__
@@ -1,4 +1,14 @@
 #include "currentcontrol.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "cogging.h"
+#include "segqueue.h"
+#include "looprate.h"
+#include "itest.h"
+#include "trace.h"
+#include "hotpath.h"
+#include "record.h"
+#include <stdlib.h>
 
 
 /*************************
@@ -9,7 +19,7 @@ void currentControl_Startup()
     // setup 5 kHZ interrupt on Timer 2 for current control
 
     T2CONbits.TCKPS = 0b011; // Timer2 prescaler N=8 (1:8)
-    PR2 = 1999;              // period = (PR2+1) * N * 12.5 ns = 0.2 ms, 5kHz
+    PR2 = TIMER2_HZ / current_rate - 1;  // period = (PR2+1) * N * 12.5 ns = 0.2 ms, 5kHz by default
     TMR2 = 0;                // initialize TMR2 count to 0
     T2CONbits.TGATE = 0;     // gated accumualtion mode disabled
     IPC2 = 24;               // priority level 6
@@ -36,8 +46,9 @@ void currentControl_Startup()
 
 }
 
-void set_PWM(int pwm)
+HOT void set_PWM(int pwm)
 {
+    record_PWM(pwm);
     PWMDutyCycle = abs(pwm);
     PWMDutyCycle = PWMDutyCycle > 100 ? 100 : PWMDutyCycle;
     motor_direction = pwm > 0 ? 1 : 0;
@@ -71,31 +82,105 @@ float getDesiredCurrent()
     return desiredCurrent;
 }
 
+float getCurrentErrorSum()
+{
+    return error_sum;
+}
+
 void setDesiredCurrent(float current){
     desiredCurrent = current;
+    command_fresh = 1;
 }
 
-/****************************
- * INTERRUPT SERVICE ROUTINES
-*****************************/
+// Only while IDLE, the next period is the first at the new rate
+void setCurrentLoopRate(int hz)
+{
+    current_rate = hz;
+    error_sum_scale = (float)CURRENT_RATE_DEFAULT / hz;
+    PR2 = TIMER2_HZ / hz - 1;
+    TMR2 = 0;
+}
 
-void __ISR(_TIMER_2_VECTOR, IPL6SRS) CurrentController(void) // _TIMER_2_VECTOR = 8
+int getCurrentLoopRate()
+{
+    return current_rate;
+}
+
+float getCurrentDT()
 {
+    return 1.0f / current_rate;
+}
+
+// Arm before the command is issued, or after it in cascade where the velocity
+// loop issues it from this ISR, so the stamp is never taken for an older one
+void currentControl_ArmStamp()
+{
+    stamp_state = 1;
+}
+
+int currentControl_AppliedAt(unsigned int * t)
+{
+    if (stamp_state != 2)
+    {
+        return 0;
+    }
+    *t = applied_at;
+    return 1;
+}
+
+// The PWM has just been written, from desiredCurrent as it is now
+static HOT void stamp_command()
+{
+    if (command_fresh)
+    {
+        if ((stamp_state == 1) && !looprate_SkipLog(LOOP_CURRENT))
+        {
+            applied_at = _CP0_GET_COUNT();
+            stamp_state = 2;
+        }
+        command_fresh = 0;
+    }
+}
+
+// Live INA219 read, or the latest sample while the current loop owns I2C
+float readCurrent()
+{
+    enum mode_t m = get_mode();
+    if ((m == ITEST) || (m == HOLD) || (m == TRACK))
+    {
+        return measuredCurrent;
+    }
+    return INA219_read_current();
+}
 
+// One Timer2 period of the current loop
+static HOT void current_tick()
+{
     // // test
     // OC1RS = 1000;                           // set to 25% duty cycle
     // MOTOR_DIR = !MOTOR_DIR;                 // toggle the motor direction
 
     // operating mode dependence
     enum mode_t m = get_mode();
+    if ((m != HOLD) && (m != TRACK))
+    {
+        velocityControl_Reset();    // hand UART2 back to the blocking encoder reads
+    }
+    if (((m == HOLD) || (m == TRACK) || (m == ITEST)) && looprate_HoldCommand(LOOP_CURRENT))
+    {
+        return;     // the last call overran, OC1RS keeps its command
+    }
     switch (m)
     {
     case IDLE:
     {
         OC1RS = PWMDutyCycle = 0;
         MOTOR_DIR = motor_direction = 0;
-        itest_count = 0;
+        itest_Reset();
         error_sum = 0;
+        biquad_ResetAll();
+        cogging_Cancel();
+        segqueue_Stop();
         break;
     }
     case PWM:
@@ -107,31 +192,11 @@ void __ISR(_TIMER_2_VECTOR, IPL6SRS) CurrentController(void) // _TIMER_2_VECTOR
     case ITEST:
     {
     
-        float refCurrent = 0;
+        float refCurrent = itest_Reference();
 
-        if (itest_count < 25)
-        {
-            refCurrent = 200;
-        }
-        else if (itest_count < 50)
-        {
-            refCurrent = -200;
-        }
-        else if (itest_count < 75)
-        {
-            refCurrent = 200;
-        }
-        else if (itest_count < 100)
-        {
-            refCurrent = -200;
-        }
-        if (itest_count == 99)
-        {
-            set_mode(IDLE);
-        }
-
-        float current_error = refCurrent - INA219_read_current();
-        error_sum += current_error;
+        measuredCurrent = biquad_Filter(BQ_CURRENT, INA219_read_current());
+        float current_error = refCurrent - measuredCurrent;
+        error_sum += current_error * error_sum_scale;
         error_sum = (error_sum > ERROR_SUM_MAX) ? ERROR_SUM_MAX : error_sum;
         error_sum = (error_sum < -ERROR_SUM_MAX) ? -ERROR_SUM_MAX : error_sum;
         int pi_current = (int)(P_current_control * current_error + I_current_control * error_sum);
@@ -140,45 +205,53 @@ void __ISR(_TIMER_2_VECTOR, IPL6SRS) CurrentController(void) // _TIMER_2_VECTOR
         MOTOR_DIR = motor_direction;
         
 
-        refCurrentArray[itest_count] = refCurrent;
-        int curr = INA219_read_current();
-        actCurrentArray[itest_count] = (int) (curr);
-
-
-        itest_count++;
-        if (get_mode() == IDLE){
-            itest_count = 0;
-            error_sum =0;
+        if (!itest_Log(refCurrent, measuredCurrent))
+        {
+            set_mode(IDLE);
+            itest_Reset();
+            error_sum = 0;
         }
         break;
     }
     case HOLD:
         {   
-            volatile float curr =  INA219_read_current();
+            if (getCascadeEnabled())
+            {
+                velocityControl_Tick();     // sets desiredCurrent at the velocity loop rate
+            }
+            volatile float curr =  biquad_Filter(BQ_CURRENT, INA219_read_current());
+            measuredCurrent = curr;
             volatile float current_error = desiredCurrent - curr;
             
-            error_sum += current_error;
+            error_sum += current_error * error_sum_scale;
             error_sum = (error_sum > ERROR_SUM_MAX) ? ERROR_SUM_MAX : error_sum;
             error_sum = (error_sum < -ERROR_SUM_MAX) ? -ERROR_SUM_MAX : error_sum;
             volatile int pi_current = (int)(P_current_control * current_error + I_current_control * error_sum);
             set_PWM(pi_current);
             OC1RS = (int)(PWMDutyCycle / 100.0 * 4000.0);
             MOTOR_DIR = motor_direction;
+            stamp_command();
 
             break;
         }
     case TRACK:
         {
-            volatile float curr =  INA219_read_current();
+            if (getCascadeEnabled())
+            {
+                velocityControl_Tick();
+            }
+            volatile float curr =  biquad_Filter(BQ_CURRENT, INA219_read_current());
+            measuredCurrent = curr;
             volatile float current_error = desiredCurrent - curr;
             
-            error_sum += current_error;
+            error_sum += current_error * error_sum_scale;
             error_sum = (error_sum > ERROR_SUM_MAX) ? ERROR_SUM_MAX : error_sum;
             error_sum = (error_sum < -ERROR_SUM_MAX) ? -ERROR_SUM_MAX : error_sum;
             volatile int pi_current = (int)(P_current_control * current_error + I_current_control * error_sum);
             set_PWM(pi_current);
             OC1RS = (int)(PWMDutyCycle / 100.0 * 4000.0);
             MOTOR_DIR = motor_direction;
+            stamp_command();
             break;
         }
 
@@ -188,7 +261,22 @@ void __ISR(_TIMER_2_VECTOR, IPL6SRS) CurrentController(void) // _TIMER_2_VECTOR
             break;
         }
     }
+}
 
+/****************************
+ * INTERRUPT SERVICE ROUTINES
+*****************************/
+
+void __ISR(_TIMER_2_VECTOR, IPL6SRS) CurrentController(void) // _TIMER_2_VECTOR = 8
+{
+    unsigned int start = _CP0_GET_COUNT();
+    unsigned int count = TMR2;      // how late this call is
+    trace_Record(TRACE_CURRENT_ISR, TRACE_BEGIN, get_mode());
+    record_Enter();
+    current_tick();
+    record_LeaveCurrent();
+    looprate_Record(LOOP_CURRENT, _CP0_GET_COUNT() - start, count);
+    trace_Record(TRACE_CURRENT_ISR, TRACE_END, get_mode());
     IFS0bits.T2IF = 0; // clear interrupt flag
 }
 
@@ -17,8 +17,9 @@
  * CONSTANTS
 *************************/
 #define MOTOR_DIR LATDbits.LATD8
-#define NUM_DATA_POINTS 100
 #define ERROR_SUM_MAX 25
+#define CURRENT_RATE_DEFAULT 5000   // Hz, the rate the current gains are tuned at
+#define TIMER2_HZ (NU32_SYS_FREQ / 8)
 
 
 /*************************
@@ -29,18 +30,17 @@ static volatile int motor_direction = 0;
 static float P_current_control = 0.0; //0.05, 0.02;
 static float I_current_control = 1.0; //q0.8, 0.8;
 static volatile float desiredCurrent = 0;
+static volatile float measuredCurrent = 0;
 
-static int itest_count = 0;
 static volatile float error_sum = 0;
+static volatile int current_rate = CURRENT_RATE_DEFAULT;
+static volatile float error_sum_scale = 1.0;    // keeps I meaning the same at any rate
 
-static char cbuff[100];
-
+static volatile int command_fresh = 0;          // desiredCurrent changed since the last PWM update
+static volatile int stamp_state = 0;            // 0 none, 1 armed, 2 applied_at holds the stamp
+static volatile unsigned int applied_at = 0;    // core timer
 
-/*************************
- * PUBLIC GLOBAL VARIABLES
-*************************/
-int refCurrentArray[NUM_DATA_POINTS];
-int actCurrentArray[NUM_DATA_POINTS];
+static char cbuff[100];
 
 
 /*************************
@@ -53,7 +53,14 @@ void setCurrentGains(float p, float i);
 float getCurrentP();
 float getCurrentI();
 float getDesiredCurrent();
+float getCurrentErrorSum();
 void setDesiredCurrent(float current);
+float readCurrent();
+void setCurrentLoopRate(int hz);
+int getCurrentLoopRate();
+float getCurrentDT();
+void currentControl_ArmStamp();                     // stamp the next PWM update with a new command
+int currentControl_AppliedAt(unsigned int * t);     // 1 once that update has happened
 
 
 #endif
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "encoder.h"
+#include "trace.h"
+#include "hotpath.h"
 #include <stdio.h>
 
 #define UART2_DESIRED_BAUD 230400
@@ -8,25 +10,88 @@ volatile int rx_num_bytes = 0;
 char rx_message[MAX_RX_MESSAGE];
 volatile int pos = 0;
 volatile int newPosFlag = 0;
+volatile long long ext_pos = 0;   // pos extended past the counter's width
+volatile int rev_pos = 0;         // ext_pos modulo COUNTS_PER_REV
+static int last_pos = 0;
+static volatile int drop_reply = 0;   // the reply on its way is for a request no one waits on
 
-int get_encoder_flag(){
+HOT int get_encoder_flag(){
     return newPosFlag;
 }
 
-void set_encoder_flag(int f){
+HOT void set_encoder_flag(int f){
     newPosFlag = f;
 }
 
 int get_encoder_count(){
-    return pos;
+    return (int)get_encoder_count64();
 }
 
-void __ISR(_UART_2_VECTOR, IPL7SOFT) U2ISR(void) { 
-  char data = U2RXREG; // read the data
+// The UART ISR can land between the two halves of a read, read again until a
+// whole value is seen
+HOT long long get_encoder_count64(){
+    long long c;
+    do {
+        c = ext_pos;
+    } while (c != ext_pos);
+    return c;
+}
+
+HOT int get_encoder_rev_count(){
+    return rev_pos;
+}
+
+// From a loop giving up UART2 with a request still unanswered. Its reply, in
+// already or still on the way, is not taken for the answer to the next request;
+// one that comes later still moves the count on.
+void encoder_DropReply(){
+  __builtin_disable_interrupts();
+  if (newPosFlag) {
+    newPosFlag = 0;
+  }
+  else {
+    drop_reply = 1;
+  }
+  __builtin_enable_interrupts();
+}
+
+void encoder_Zero(){
+    WriteUART2("b");
+    __builtin_disable_interrupts();
+    ext_pos = 0;
+    rev_pos = 0;
+    last_pos = 0;
+    __builtin_enable_interrupts();
+}
+
+// Sign extended difference to the last reply, modulo the counter's width
+static HOT void extend_count(int raw){
+    const int shift = 32 - ENCODER_RAW_BITS;
+    int delta = (int)(((unsigned int)raw - (unsigned int)last_pos) << shift) >> shift;
+    last_pos = raw;
+    ext_pos += delta;
+    rev_pos += delta % COUNTS_PER_REV;
+    if (rev_pos >= COUNTS_PER_REV) {
+      rev_pos -= COUNTS_PER_REV;
+    }
+    else if (rev_pos < 0) {
+      rev_pos += COUNTS_PER_REV;
+    }
+}
+
+// One byte of the encoder PIC's reply, the count is in at the newline
+static HOT void receive_byte(char data){
   if (data == '\n') {
     rx_message[rx_num_bytes] = '\0';
     sscanf(rx_message,"%d",&pos);
-    newPosFlag = 1;
+    extend_count(pos);
+    trace_Record(TRACE_ENCODER_REPLY, TRACE_INSTANT, pos);
+    if (drop_reply) {
+      drop_reply = 0;
+    }
+    else {
+      newPosFlag = 1;
+    }
     rx_num_bytes = 0;
   } 
   else {
@@ -37,11 +102,19 @@ void __ISR(_UART_2_VECTOR, IPL7SOFT) U2ISR(void) {
       rx_num_bytes = 0;
     }
   }
+}
+
+void __ISR(_UART_2_VECTOR, IPL7SOFT) U2ISR(void) { 
+  char data = U2RXREG; // read the data
+  trace_Record(TRACE_ENCODER_ISR, TRACE_BEGIN, data);
+  receive_byte(data);
+  trace_Record(TRACE_ENCODER_ISR, TRACE_END, data);
   IFS1bits.U2RXIF = 0;
 }
 
 // Write a character array using UART2
-void WriteUART2(const char * string) {
+HOT void WriteUART2(const char * string) {
+  trace_Record(TRACE_ENCODER_REQUEST, TRACE_INSTANT, string[0]);
   while (*string != '\0') {
     while (U2STAbits.UTXBF) {
       ; // wait until tx buffer isn't full
@@ -6,11 +6,23 @@
 
 #include "NU32.h"
 
+#define COUNTS_PER_REV (334*4)
+#define ENCODER_RAW_BITS 32   // width of the encoder PIC's counter, replies wrap at this
+
+// Every reply is extended into a 64 bit multi-turn count, so the count does not
+// wrap with the encoder PIC's counter however far the axis turns. Replies must
+// come often enough that the axis moves less than half the counter's range
+// between two of them.
+
 void UART2_Startup();
 void WriteUART2(const char * string);
 int get_encoder_flag();
 void set_encoder_flag();
-int get_encoder_count();
+int get_encoder_count();           // low 32 bits of the multi-turn count
+long long get_encoder_count64();   // multi-turn count
+int get_encoder_rev_count();       // count within the revolution, 0 to COUNTS_PER_REV-1
+void encoder_Zero();               // zero the encoder PIC's counter and the multi-turn count
+void encoder_DropReply();          // the reply to the last request is not waited for, ISR safe
 
 
 #endif // ENCODER__H__
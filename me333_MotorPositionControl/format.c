@@ -0,0 +1,179 @@
+#include "format.h"
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static const unsigned int powers[FORMAT_DECIMALS_MAX + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// At least min_digits, zero padded on the left. 32 bit divisions only, the
+// 64 bit ones are library calls on the M4K.
+static char * put_uint(char * p, unsigned int v, int min_digits)
+{
+    char digits[10];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while ((v != 0) || (n < min_digits));
+    while (n > 0)
+    {
+        *p++ = digits[--n];
+    }
+    *p = '\0';
+    return p;
+}
+
+static char * put_uint64(char * p, unsigned long long v)
+{
+    if (v <= 0xFFFFFFFFu)
+    {
+        return put_uint(p, (unsigned int)v, 1);
+    }
+    // at most 20 digits, the low 9 at a time as 32 bit numbers
+    unsigned long long high = v / 1000000000u;
+    p = put_uint64(p, high);
+    return put_uint(p, (unsigned int)(v - high * 1000000000u), 9);
+}
+
+// mantissa * 2^exponent to decimals places, rounded to nearest with an exact
+// half going to the even digit. The fraction bits times 10^decimals must fit
+// 64 bits, under 2^30 of them does for any decimals up to the maximum.
+static char * put_scaled(char * p, int negative, unsigned long long mantissa, int exponent, int decimals)
+{
+    unsigned long long whole;
+    unsigned int fraction = 0;
+    if (negative)
+    {
+        *p++ = '-';
+    }
+    if (exponent >= 0)
+    {
+        whole = mantissa << exponent;
+    }
+    else
+    {
+        int shift = -exponent;
+        unsigned long long bits;
+        if (shift < 64)
+        {
+            whole = mantissa >> shift;
+            bits = mantissa - (whole << shift);
+        }
+        else
+        {
+            whole = 0;
+            bits = mantissa;
+        }
+        if (shift > 62)
+        {
+            bits = 0;           // under 2^-39, far below half of any last digit
+            shift = 62;
+        }
+        unsigned long long scaled = bits * powers[decimals];
+        unsigned long long q = scaled >> shift;
+        unsigned long long rest = scaled - (q << shift);
+        unsigned long long half = 1ull << (shift - 1);
+        unsigned int last = (decimals > 0) ? (unsigned int)q : (unsigned int)whole;
+        if ((rest > half) || ((rest == half) && (last & 1)))
+        {
+            q++;
+        }
+        if (q == powers[decimals])
+        {
+            whole++;    // carried into the whole part, 0.9999996 to 1.000000
+            q = 0;
+        }
+        fraction = (unsigned int)q;
+    }
+    p = put_uint64(p, whole);
+    if (decimals > 0)
+    {
+        *p++ = '.';
+        p = put_uint(p, fraction, decimals);
+    }
+    return p;
+}
+
+char * format_Str(char * p, const char * s)
+{
+    while (*s != '\0')
+    {
+        *p++ = *s++;
+    }
+    *p = '\0';
+    return p;
+}
+
+char * format_Int(char * p, int v)
+{
+    if (v < 0)
+    {
+        *p++ = '-';
+        return put_uint(p, 0u - (unsigned int)v, 1);
+    }
+    return put_uint(p, v, 1);
+}
+
+char * format_Uint(char * p, unsigned int v)
+{
+    return put_uint(p, v, 1);
+}
+
+char * format_Int64(char * p, long long v)
+{
+    if (v < 0)
+    {
+        *p++ = '-';
+        return put_uint64(p, 0ull - (unsigned long long)v);
+    }
+    return put_uint64(p, v);
+}
+
+char * format_Float(char * p, float v, int decimals)
+{
+    union {
+        float f;
+        unsigned int u;
+    } bits = {v};
+    int negative = bits.u >> 31;
+    int biased = (bits.u >> 23) & 0xFF;
+    unsigned int mantissa = bits.u & 0x7FFFFF;
+
+    decimals = (decimals < 0) ? 0 : decimals;
+    decimals = (decimals > FORMAT_DECIMALS_MAX) ? FORMAT_DECIMALS_MAX : decimals;
+    if (biased == 0xFF)
+    {
+        return format_Str(p, (mantissa != 0) ? (negative ? "-nan" : "nan") : (negative ? "-inf" : "inf"));
+    }
+    if (biased == 0)
+    {
+        biased = 1;     // subnormal, no implicit one
+    }
+    else
+    {
+        mantissa |= 1u << 23;
+    }
+    int exponent = biased - 127 - 23;
+    if (exponent > 63 - 24)
+    {
+        exponent = 63 - 24;     // out of range, clamped below 2^63
+    }
+    return put_scaled(p, negative, mantissa, exponent, decimals);
+}
+
+char * format_Q16(char * p, int q, int decimals)
+{
+    decimals = (decimals < 0) ? 0 : decimals;
+    decimals = (decimals > FORMAT_DECIMALS_MAX) ? FORMAT_DECIMALS_MAX : decimals;
+    unsigned int magnitude = (q < 0) ? 0u - (unsigned int)q : (unsigned int)q;
+    return put_scaled(p, q < 0, magnitude, -16, decimals);
+}
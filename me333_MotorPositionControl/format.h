@@ -0,0 +1,42 @@
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+// Decimal text for the menu replies and the log dumps, without stdio.
+//
+// sprintf's %f goes through soft double arithmetic on the M4K, far too slow
+// for a line a sample. These write the same characters as %d, %u, %lld and
+// %.Nf give for a float, worked out exactly in integers from the float's bits:
+// the digits are the float's value rounded to the chosen number of decimals,
+// an exact half going to the even digit as glibc's printf does. Q16 numbers
+// can also be written exactly, with no rounding to float on the way.
+//
+// Each call writes at p, ends the text with a NUL and returns where the NUL
+// is, so calls chain:  p = format_Float(p, x, 6); p = format_Str(p, "\r\n");
+// Floats up to 2^63 in magnitude and up to FORMAT_DECIMALS_MAX decimals.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define FORMAT_DECIMALS_MAX 9
+#define FORMAT_LENGTH_MAX 32        // the longest a single call writes, NUL included
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+char * format_Str(char * p, const char * s);
+char * format_Int(char * p, int v);                         // %d
+char * format_Uint(char * p, unsigned int v);               // %u
+char * format_Int64(char * p, long long v);                 // %lld
+char * format_Float(char * p, float v, int decimals);       // %.*f of (double)v
+char * format_Q16(char * p, int q, int decimals);           // q / 65536, exactly rounded
+
+
+#endif
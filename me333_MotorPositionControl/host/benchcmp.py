@@ -0,0 +1,73 @@
+# compare two sim/nu32bench results, the old commit's first
+# usage: python benchcmp.py old.json new.json [--all]
+# prints each figure that changed, --all every one, and marks those that got worse by more
+# than their tolerance. Exits 1 if any did, so it can gate a change.
+# The control figures are deterministic, any change at all comes from the code. The ISR
+# times are the host's and swing by more than half between runs on a busy machine, they
+# are shown but not judged; the instruction counts, where perf counters are allowed, are.
+import json
+import sys
+
+# figure -> relative tolerance, lower is better for all of them, None to show but not judge
+TOLERANCE = {
+    'rms_error_deg': 0.01,
+    'max_error_deg': 0.01,
+    'settling_s': 0.01,
+    'overshoot_deg': 0.01,
+    'peak_current_ma': 0.01,
+    'calls': None,
+    'ns_mean': None,
+    'ns_p50': None,
+    'ns_p99': None,
+    'instructions_mean': 0.02,
+    'instructions_max': 0.05,
+    'stack_bytes': 0,
+}
+
+
+def figures(result):
+    out = {}
+    for run, r in result['runs'].items():
+        for key, value in r.items():
+            if key == 'isr':
+                for isr, stats in value.items():
+                    for k, v in stats.items():
+                        out[(run, isr, k)] = v
+            else:
+                out[(run, '', key)] = value
+    return out
+
+
+def worse(key, old, new):
+    tolerance = TOLERANCE.get(key)
+    if tolerance is None or old is None:
+        return False
+    if new is None:         # never settled, or no longer measured
+        return key == 'settling_s'
+    return new > old * (1 + tolerance) + 1e-9
+
+
+def main():
+    paths = [a for a in sys.argv[1:] if not a.startswith('--')]
+    if len(paths) != 2:
+        sys.exit('usage: python benchcmp.py old.json new.json [--all]')
+    old_result, new_result = (json.load(open(p)) for p in paths)
+    old, new = figures(old_result), figures(new_result)
+    show_all = '--all' in sys.argv
+
+    print('%s -> %s' % (old_result.get('label') or paths[0], new_result.get('label') or paths[1]))
+    regressions = 0
+    for key in sorted(set(old) | set(new)):
+        a, b = old.get(key), new.get(key)
+        bad = worse(key[2], a, b)
+        regressions += bad
+        if a == b and not show_all:
+            continue
+        change = '' if a in (None, 0) or b is None else '%+.1f%%' % (100.0 * (b - a) / a)
+        print('%-18s %-9s %-18s %12s %12s %8s %s' % (key[0], key[1], key[2], a, b, change, 'WORSE' if bad else ''))
+    print('%d worse' % regressions)
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == '__main__':
+    main()
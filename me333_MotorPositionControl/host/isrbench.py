@@ -0,0 +1,75 @@
+# cycles the Timer2, Timer4 and UART2 ISRs take in a HOLD, from the event trace, to compare
+# a flash build against a HOT_IN_RAM=1 one
+# usage: python isrbench.py /dev/ttyUSB1 [angle]   (traces a HOLD to angle for half a second)
+#        python isrbench.py dump.txt               (a saved 'D' dump of the same events, - for stdin)
+# each call is timed from its begin record to its end record, less the time spent in the
+# higher priority ISRs that preempted it. The ISR prologue and epilogue are not in it.
+import os
+import sys
+import time
+
+from trace import CORE_TIMER_HZ, BEGIN, END, read_dump, unwrap
+
+CYCLES_PER_TICK = 2     # the core timer counts at half the system clock
+# highest priority first
+ISRS = ['encoder_isr', 'current_isr', 'position_isr']
+
+
+def calls(entries):
+    spans = {isr: [] for isr in ISRS}
+    open_at = {}
+    for us, event, phase, payload in unwrap(entries):
+        if event not in spans:
+            continue
+        if phase == BEGIN:
+            open_at[event] = us
+        elif phase == END and event in open_at:
+            spans[event].append((open_at.pop(event), us))
+    return spans
+
+
+def exclusive(spans):
+    cycles = {}
+    for k, isr in enumerate(ISRS):
+        higher = sorted(s for h in ISRS[:k] for s in spans[h])
+        out = []
+        for b, e in spans[isr]:
+            inner = sum(he - hb for hb, he in higher if hb >= b and he <= e)
+            out.append((e - b - inner) * 1e-6 * CORE_TIMER_HZ * CYCLES_PER_TICK)
+        cycles[isr] = out
+    return cycles
+
+
+def report(cycles):
+    print('%-14s %6s %9s %9s %9s %9s' % ('isr', 'calls', 'min', 'mean', 'p99', 'max'))
+    for isr in ISRS:
+        c = sorted(cycles[isr])
+        if not c:
+            print('%-14s %6d' % (isr, 0))
+            continue
+        p99 = c[min(len(c) - 1, int(round(0.99 * (len(c) - 1))))]
+        print('%-14s %6d %9.0f %9.0f %9.0f %9.0f  cycles' % (isr, len(c), c[0], sum(c) / len(c), p99, c[-1]))
+
+
+def from_device(port, angle):
+    from nu32proto import NU32     # needs pyserial, saved dumps do not
+    dev = NU32(port)
+    dev.trace_start(ISRS)
+    dev.run('HOLD', angle)
+    time.sleep(0.5)
+    entries = dev.trace_dump()
+    dev.run('IDLE')
+    return entries
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1'
+    if source == '-' or os.path.isfile(source):
+        entries = read_dump(sys.stdin if source == '-' else open(source))
+    else:
+        entries = from_device(source, float(sys.argv[2]) if len(sys.argv) > 2 else 45.0)
+    report(exclusive(calls(entries)))
+
+
+if __name__ == '__main__':
+    main()
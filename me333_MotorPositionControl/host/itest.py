@@ -0,0 +1,147 @@
+# current loop step and frequency response from an ITEST run
+# usage: python itest.py /dev/ttyUSB1 [shape amplitude period count end_hz decimation]
+#        python itest.py log.txt     (the 'W' reply and the ITEST dump as the board sends them, - for stdin)
+# shape 0 square: rise time 10-90%, overshoot and steady error per edge
+# shape 1 sine:   gain and phase at 1/period
+# shape 2 chirp:  gain and phase over the sweep and the -3 dB bandwidth
+import cmath
+import math
+import os
+import sys
+
+SQUARE, SINE, CHIRP = range(3)
+
+
+def parse(lines):
+    lines = iter(lines)
+    reply = next(lines).split()
+    ok, shape = int(reply[0]), int(reply[1])
+    if not ok:
+        raise SystemExit('waveform refused: ' + ' '.join(reply))
+    params = dict(shape=shape, amplitude=float(reply[2]), period=float(reply[3]), count=int(reply[4]),
+                  end_hz=float(reply[5]), decimation=int(reply[6]), dt=float(reply[8]))
+    n = int(next(lines))
+    ref, act = [], []
+    for _ in range(n):
+        r, a = next(lines).split()
+        ref.append(int(r))
+        act.append(int(a))
+    return params, ref, act
+
+
+def crossing(values, start, level, rising, dt):
+    for i in range(start + 1, len(values)):
+        a, b = values[i - 1], values[i]
+        if (rising and a < level <= b) or (not rising and a > level >= b):
+            return (i - 1 + (level - a) / float(b - a)) * dt
+    return None
+
+
+def square(p, ref, act):
+    dt = p['dt']
+    edges = [0] + [i for i in range(1, len(ref)) if ref[i] != ref[i - 1]] + [len(ref)]
+    rows = []
+    for e, end in zip(edges, edges[1:]):
+        if end <= e + 2:
+            continue
+        initial = act[e - 1] if e > 0 else 0
+        target = ref[e]
+        swing = target - initial
+        if swing == 0:
+            continue
+        rising = swing > 0
+        seg = act[e:end]
+        t10 = crossing(act[:end], e - 1 if e > 0 else 0, initial + 0.1 * swing, rising, dt)
+        t90 = crossing(act[:end], e - 1 if e > 0 else 0, initial + 0.9 * swing, rising, dt)
+        peak = max(seg) if rising else min(seg)
+        tail = seg[len(seg) * 3 // 4:]
+        rows.append(dict(edge_s=e * dt, rise_ms=(t90 - t10) * 1e3 if t10 is not None and t90 is not None else None,
+                         overshoot_pct=max(0.0, (peak - target) / swing * 100.0),
+                         steady_error_ma=sum(tail) / float(len(tail)) - target))
+    for r in rows:
+        print('edge %8.4f s  rise %s  overshoot %6.1f %%  steady error %7.2f mA'
+              % (r['edge_s'], '%7.3f ms' % r['rise_ms'] if r['rise_ms'] is not None else '   none   ',
+                 r['overshoot_pct'], r['steady_error_ma']))
+    rises = [r['rise_ms'] for r in rows if r['rise_ms'] is not None]
+    if rises:
+        print('mean    rise %.3f ms  overshoot %.1f %%  steady error %.2f mA'
+              % (sum(rises) / len(rises), sum(r['overshoot_pct'] for r in rows) / len(rows),
+                 sum(r['steady_error_ma'] for r in rows) / len(rows)))
+
+
+def dft(values, f, dt):
+    w = -2j * math.pi * f * dt
+    return sum(v * cmath.exp(w * k) for k, v in enumerate(values))
+
+
+def response(ref, act, f, dt):
+    h = dft(act, f, dt) / dft(ref, f, dt)
+    return abs(h), math.degrees(cmath.phase(h))
+
+
+def sine(p, ref, act):
+    f = 1.0 / p['period']
+    gain, phase = response(ref, act, f, p['dt'])
+    print('%.2f Hz  gain %.3f (%.2f dB)  phase %.1f deg' % (f, gain, 20 * math.log10(gain), phase))
+
+
+# The chirp's energy is spread over the sweep, so the ratio of the two spectra
+# bin by bin is the loop's response there. Bins are averaged in bands of about
+# a fifth of an octave to take the ripple out.
+def chirp(p, ref, act):
+    dt, f0, f1 = p['dt'], 1.0 / p['period'], p['end_hz']
+    duration = len(ref) * dt
+    nyquist = 0.5 / dt
+    top = min(f1, 0.9 * nyquist)
+    bins = [k / duration for k in range(int(f0 * duration) + 1, int(top * duration) + 1)]
+    bands, edge = [], f0
+    while edge < top:
+        nxt = edge * 2 ** 0.2
+        members = [f for f in bins if edge <= f < nxt]
+        if members:
+            hs = [dft(act, f, dt) / dft(ref, f, dt) for f in members]
+            h = sum(hs) / len(hs)
+            bands.append((math.sqrt(edge * nxt), abs(h), math.degrees(cmath.phase(h))))
+        edge = nxt
+    if not bands:
+        print('no frequencies between %.1f and %.1f Hz' % (f0, top))
+        return
+    low = bands[0][1]
+    bandwidth = None
+    for f, gain, phase in bands:
+        print('%9.2f Hz  gain %6.3f (%6.2f dB re low)  phase %7.1f deg' % (f, gain, 20 * math.log10(gain / low), phase))
+        if bandwidth is None and gain < low / math.sqrt(2):
+            bandwidth = f
+    if bandwidth is None:
+        print('bandwidth above %.1f Hz, the top of the sweep' % top)
+    else:
+        print('bandwidth (-3 dB) about %.1f Hz' % bandwidth)
+
+
+def from_device(port, args):
+    import serial
+    ser = serial.Serial(port, 230400, rtscts=True, timeout=30)
+    ser.write(b'W\n' + ' '.join(args).encode() + b'\n')
+    reply = ser.readline().decode()
+    ser.write(b'k\n')
+    first = ser.readline().decode()
+    n = int(first)
+    return [reply, first] + [ser.readline().decode() for _ in range(n)]
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1'
+    if source == '-':
+        lines = sys.stdin.read().splitlines()
+    elif os.path.isfile(source):
+        lines = open(source).read().splitlines()
+    else:
+        args = sys.argv[2:8] if len(sys.argv) >= 8 else ['0', '200', '0.01', '2', '0', '1']
+        lines = from_device(source, args)
+    p, ref, act = parse(lines)
+    print('%d samples, %.1f us apart' % (len(ref), p['dt'] * 1e6))
+    {SQUARE: square, SINE: sine, CHIRP: chirp}[p['shape']](p, ref, act)
+
+
+if __name__ == '__main__':
+    main()
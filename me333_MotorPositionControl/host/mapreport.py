@@ -0,0 +1,107 @@
+# RAM and flash use of the firmware by section and by symbol, against the linker script's regions
+# usage: python mapreport.py out.elf [--objdump xc32-objdump] [--script NU32bootloaded.ld] [--top 25]
+#        (make report does this for the last build, HOT_IN_RAM=1 builds show their .ramfunc code)
+# RAM functions and initialised data are counted in both, their images are in flash until startup
+# copies them in. The stack and heap get what RAM is left, they are not in the symbol table.
+import argparse
+import re
+import subprocess
+from collections import defaultdict
+
+RAM_SECTIONS = ('.data', '.sdata', '.bss', '.sbss', '.ramfunc', '.stack', '.heap', '.tbss', '.tdata')
+COPIED = ('.data', '.sdata', '.ramfunc', '.tdata')
+
+
+def region_lengths(script):
+    text = open(script).read()
+    lengths = {}
+    for name in ('kseg0_program_mem', 'kseg1_data_mem'):
+        m = re.search(name + r'\s*\([^)]*\)\s*:\s*ORIGIN\s*=\s*[^,]+,\s*LENGTH\s*=\s*(0x[0-9A-Fa-f]+|\d+)', text)
+        lengths[name] = int(m.group(1), 0)
+    return lengths['kseg0_program_mem'], lengths['kseg1_data_mem']
+
+
+def in_ram(section):
+    return section.startswith(RAM_SECTIONS) or section == '*COM*'
+
+
+# name -> (size, flags) of the sections that take memory on the target
+def sections(objdump, elf):
+    out = subprocess.run([objdump, '-h', elf], capture_output=True, text=True, check=True).stdout.splitlines()
+    found = {}
+    for line, flags in zip(out, out[1:]):
+        f = line.split()
+        if len(f) >= 7 and f[0].isdigit() and 'ALLOC' in flags:
+            found[f[1]] = (int(f[2], 16), flags)
+    return found
+
+
+# (section, size, name) of every sized object and function
+def symbols(objdump, elf):
+    out = subprocess.run([objdump, '-t', '-C', elf], capture_output=True, text=True, check=True).stdout.splitlines()
+    found = []
+    for line in out:
+        m = re.match(r'^[0-9a-fA-F]+ (.{7}) (\S+)\s+([0-9a-fA-F]+) (.+)$', line)
+        if m and ('F' in m.group(1) or 'O' in m.group(1) or m.group(2) == '*COM*'):
+            size = int(m.group(3), 16)
+            if size > 0:
+                found.append((m.group(2), size, m.group(4).split()[-1]))
+    return found
+
+
+def kind(section):
+    if section.startswith('.ramfunc'):
+        return 'RAM code'
+    if in_ram(section):
+        return 'RAM data'
+    if section.startswith(('.rodata', '.romdata', '.dinit')):
+        return 'flash const'
+    return 'flash code'
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('elf')
+    ap.add_argument('--objdump', default='xc32-objdump')
+    ap.add_argument('--script', default='NU32bootloaded.ld')
+    ap.add_argument('--top', type=int, default=25)
+    args = ap.parse_args()
+
+    flash_budget, ram_budget = region_lengths(args.script)
+    secs = sections(args.objdump, args.elf)
+    images_in_dinit = '.dinit' in secs      # xc32 keeps the copied images there
+    flash = ram = 0
+    by_section = []
+    for name, (size, flags) in secs.items():
+        if in_ram(name):
+            ram += size
+            if not images_in_dinit and name.startswith(COPIED) and 'LOAD' in flags:
+                flash += size
+        else:
+            flash += size
+        by_section.append((size, name))
+
+    print('flash %8d of %8d bytes  %5.1f%%' % (flash, flash_budget, 100.0 * flash / flash_budget))
+    print('RAM   %8d of %8d bytes  %5.1f%%  (%d left for the stack and heap)'
+          % (ram, ram_budget, 100.0 * ram / ram_budget, ram_budget - ram))
+    print()
+    print('%-24s %8s  %s' % ('section', 'bytes', 'in'))
+    for size, name in sorted(by_section, reverse=True):
+        if size > 0:
+            print('%-24s %8d  %s' % (name, size, 'RAM' if in_ram(name) else 'flash'))
+
+    groups = defaultdict(list)
+    for section, size, name in symbols(args.objdump, args.elf):
+        groups[kind(section)].append((size, name, section))
+    for k in ('RAM data', 'RAM code', 'flash code', 'flash const'):
+        entries = sorted(groups[k], reverse=True)
+        if not entries:
+            continue
+        print()
+        print('%s: %d bytes in %d symbols, the largest' % (k, sum(e[0] for e in entries), len(entries)))
+        for size, name, section in entries[:args.top]:
+            print('  %8d  %-32s %s' % (size, name, section))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,321 @@
+# host side of the binary protocol in binproto.h
+# usage: python nu32proto.py /dev/ttyUSB1   (compares ASCII and binary command latency and upload time)
+import struct
+import sys
+import time
+
+import serial
+
+MAGIC = 0xA5
+REPLY = 0x80
+
+OP_CAPS = 0x01
+OP_STATUS = 0x02
+OP_ABORT = 0x03
+OP_LATENCY = 0x04
+OP_SET_PWM = 0x10
+OP_SET_CURRENT_GAINS = 0x11
+OP_GET_CURRENT_GAINS = 0x12
+OP_SET_POSITION_GAINS = 0x13
+OP_GET_POSITION_GAINS = 0x14
+OP_TRAJ_WRITE = 0x20
+OP_TRAJ_BULK = 0x21
+OP_RUN = 0x30
+OP_READ_LOG = 0x31
+OP_SUBSCRIBE = 0x40
+OP_TELEMETRY = 0x41
+
+BULK_FLOAT32 = 0
+BULK_INT16 = 1
+BULK_Q16 = 2
+
+Q16 = 65536.0   # angles on the wire are Q16.16 degrees
+
+MODES = ['IDLE', 'PWM', 'ITEST', 'HOLD', 'TRACK']
+# telemetry signals by mask bit, as in telemetry.h, and their word formats
+SIGNALS = ['angle', 'angle_error', 'command', 'current', 'pwm', 'error_sum']
+SIGNAL_FORMATS = 'ifffif'
+CORE_TIMER_HZ = 40e6
+# trace events by id, as in trace.h
+TRACE_EVENTS = ['current_isr', 'position_isr', 'encoder_isr', 'host_isr', 'dma_isr', 'command', 'mode',
+                'encoder_request', 'encoder_reply', 'i2c']
+# loop overrun responses, as in looprate.h
+OVERRUN_POLICIES = ['count', 'skip_log', 'hold', 'slow', 'fault']
+
+
+def crc16(data, crc=0xFFFF):
+    # CRC-16/CCITT-FALSE, same as crc16.c
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frame(opcode, payload=b''):
+    body = struct.pack('<BH', opcode, len(payload)) + payload
+    return bytes([MAGIC]) + body + struct.pack('<H', crc16(body))
+
+
+class ProtocolError(Exception):
+    pass
+
+
+# the payload of an unsolicited telemetry frame, status byte removed, into
+# records. A frame sent before it was full pads with sequence 0xFFFFFFFF.
+def parse_telemetry(payload):
+    mask = payload[0]
+    names = ['seq'] + [s for k, s in enumerate(SIGNALS) if mask & (1 << k)]
+    fmt = '<I' + ''.join(f for k, f in enumerate(SIGNAL_FORMATS) if mask & (1 << k))
+    size = struct.calcsize(fmt)
+    records = []
+    for r in range((len(payload) - 1) // size):
+        record = dict(zip(names, struct.unpack_from(fmt, payload, 1 + r * size)))
+        if record['seq'] == 0xFFFFFFFF:
+            continue
+        if 'angle' in record:
+            record['angle'] /= Q16
+        records.append(record)
+    return records
+
+
+class NU32:
+    def __init__(self, port, baud=230400):
+        self.ser = serial.Serial(port, baud, rtscts=True, timeout=2)
+        self.telemetry = []     # records that came in while waiting for replies, oldest first
+        self.frames = []        # frames that came between the lines of a dump, oldest first
+
+    # send one request, optionally without waiting so several can be in flight
+    def send(self, opcode, payload=b''):
+        self.ser.write(frame(opcode, payload))
+
+    # the next frame from the board -> opcode, status, payload, None if nothing came
+    def read_frame(self, magic=b''):
+        if self.frames and not magic:
+            return self.frames.pop(0)
+        head = magic + self.ser.read(4 - len(magic))
+        if not head:
+            return None
+        if len(head) != 4 or head[0] != MAGIC:
+            raise ProtocolError('bad reply header %r' % head)
+        length = struct.unpack('<H', head[2:4])[0]
+        rest = self.ser.read(length + 2)
+        body, crc = head[1:] + rest[:-2], struct.unpack('<H', rest[-2:])[0]
+        if len(rest) != length + 2 or crc16(body) != crc:
+            raise ProtocolError('bad reply CRC')
+        return body[0], body[3], body[4:]
+
+    # one line of menu text, replies sent between the lines of a dump are kept
+    # for receive and read_telemetry. Dump lines end in \n\r, so a reply comes
+    # after the \r the line before left.
+    def readline(self):
+        lead = b''
+        while True:
+            c = self.ser.read(1)
+            if c == b'\r':
+                lead += c
+            elif c == bytes([MAGIC]):
+                self.frames.append(self.read_frame(c))
+            else:
+                return lead + c + self.ser.readline() if c else lead
+
+    # telemetry frames met on the way are kept in self.telemetry
+    def receive(self, opcode):
+        while True:
+            f = self.read_frame()
+            if f is None:
+                raise ProtocolError('no reply to 0x%02x' % opcode)
+            op, status, payload = f
+            if op == (OP_TELEMETRY | REPLY):
+                self.telemetry.extend(parse_telemetry(payload))
+                continue
+            if op != (opcode | REPLY):
+                raise ProtocolError('reply to 0x%02x while waiting for 0x%02x' % (op & ~REPLY, opcode))
+            if status != 0:
+                raise ProtocolError('opcode 0x%02x failed with status %d' % (opcode, status))
+            return payload
+
+    def request(self, opcode, payload=b''):
+        self.send(opcode, payload)
+        return self.receive(opcode)
+
+    def caps(self):
+        p = self.request(OP_CAPS)
+        version, max_payload, max_traj, log_length = struct.unpack('<BHHH', p[:7])
+        return dict(version=version, max_payload=max_payload, max_trajectory=max_traj,
+                    log_length=log_length, opcodes=list(p[7:]))
+
+    def status(self):
+        mode, pwm, current, count, angle, length = struct.unpack('<BbfiiH', self.request(OP_STATUS))
+        return dict(mode=MODES[mode], pwm=pwm, current=current, count=count,
+                    desired_angle=angle / Q16, trajectory_length=length)
+
+    def abort(self):
+        self.request(OP_ABORT)
+
+    def set_current_gains(self, p, i):
+        return struct.unpack('<ff', self.request(OP_SET_CURRENT_GAINS, struct.pack('<ff', p, i)))
+
+    def current_gains(self):
+        return struct.unpack('<ff', self.request(OP_GET_CURRENT_GAINS))
+
+    def set_position_gains(self, p, i, d):
+        return struct.unpack('<fff', self.request(OP_SET_POSITION_GAINS, struct.pack('<fff', p, i, d)))
+
+    def position_gains(self):
+        return struct.unpack('<fff', self.request(OP_GET_POSITION_GAINS))
+
+    # all chunks go out back to back, then the acks are collected
+    def write_trajectory(self, samples, chunk=61):
+        total = len(samples)
+        for offset in range(0, total, chunk):
+            part = samples[offset:offset + chunk]
+            self.send(OP_TRAJ_WRITE, struct.pack('<HH%df' % len(part), total, offset, *part))
+        for offset in range(0, total, chunk):
+            self.receive(OP_TRAJ_WRITE)
+
+    # header, wait for the go ahead, then the raw samples in one stream
+    def upload_trajectory(self, samples, int16_scale=None, q16=False):
+        if q16:
+            ints = [int(round(v * Q16)) for v in samples]
+            fmt, scale, data = BULK_Q16, 1.0, struct.pack('<%di' % len(ints), *ints)
+        elif int16_scale is None:
+            fmt, scale, data = BULK_FLOAT32, 1.0, struct.pack('<%df' % len(samples), *samples)
+        else:
+            ints = [int(round(v / int16_scale)) for v in samples]
+            fmt, scale, data = BULK_INT16, int16_scale, struct.pack('<%dh' % len(ints), *ints)
+        self.request(OP_TRAJ_BULK, struct.pack('<HBfH', len(samples), fmt, scale, crc16(data)))
+        self.ser.write(data)
+        count, ticks = struct.unpack('<HI', self.receive(OP_TRAJ_BULK))
+        return ticks / CORE_TIMER_HZ
+
+    # the menu 'm' path, finished once the 'r' after it is answered
+    def ascii_upload_trajectory(self, samples):
+        lines = ['m', str(len(samples))] + ['%f' % v for v in samples] + ['r']
+        for line in lines:
+            self.ser.write((line + '\n').encode())
+        self.readline()
+
+    def run(self, mode, angle=0):
+        self.request(OP_RUN, struct.pack('<Bi', MODES.index(mode), int(round(angle * Q16))))
+
+    def read_log(self, which, length, chunk=30):
+        pairs = []
+        for offset in range(0, length, chunk):
+            n = min(chunk, length - offset)
+            p = self.request(OP_READ_LOG, struct.pack('<BHH', which, offset, n))[2:]
+            pairs += [struct.unpack_from('<ii', p, 8 * k) for k in range(n)]
+        if which == 1:
+            pairs = [(ref / Q16, act / Q16) for ref, act in pairs]
+        return pairs
+
+    # latch and apply core timer counts of the position log, 0 apply if none
+    def read_times(self, length):
+        return [(latch % (1 << 32), apply % (1 << 32)) for latch, apply in self.read_log(2, length)]
+
+    # the menu 'T' path, there is no binary opcode for it
+    def set_timestamps(self, enabled):
+        self.ser.write(b'T\n%d\n' % (1 if enabled else 0))
+        return int(self.readline())
+
+    # the menu 'E' path: record the named trace events from now on, none stops
+    # -> the mask in use and the entries the ring holds
+    def trace_start(self, events=TRACE_EVENTS):
+        mask = sum(1 << TRACE_EVENTS.index(e) for e in events)
+        self.ser.write(b'E\n%d\n' % mask)
+        mask, length = self.readline().split()
+        return int(mask), int(length)
+
+    # the menu 'D' path: stop the trace and read it, (time, event, phase, payload) oldest first
+    def trace_dump(self):
+        self.ser.write(b'D\n')
+        count = int(self.readline())
+        return [tuple(int(f) for f in self.readline().split()) for _ in range(count)]
+
+    # the menu 'O' path: the overrun policy of the current and position loops by name,
+    # None keeps one, reset clears the counters -> taken, the policies and rates in
+    # use, and per loop overruns, periods lost, furthest exit past a match in us, responses
+    def overruns(self, current=None, position=None, reset=False):
+        codes = [-1 if p is None else OVERRUN_POLICIES.index(p) for p in (current, position)]
+        self.ser.write(b'O\n%d %d %d\n' % (codes[0], codes[1], 1 if reset else 0))
+        f = [int(v) for v in self.readline().split()]
+        keys = ['overruns', 'lost', 'worst_us', 'responses']
+        return {'ok': bool(f[0]), 'policy': [OVERRUN_POLICIES[f[1]], OVERRUN_POLICIES[f[2]]],
+                'rates': f[3:5], 'current': dict(zip(keys, f[5:9])), 'position': dict(zip(keys, f[9:13]))}
+
+    # the menu 'Y' path: start an input recording, only while IDLE, or stop it
+    # -> taken, recording, words used, words it holds
+    def record(self, start=True):
+        self.ser.write(b'Y\n%d\n' % (1 if start else 0))
+        return tuple(int(f) for f in self.readline().split())
+
+    # the menu 'X' path: stop the recording and read it as the text the board
+    # sends, for sim/nu32sim replay
+    def record_dump(self):
+        self.ser.write(b'X\n')
+        first = self.readline()
+        header, trajectory, length = (int(f) for f in first.split())
+        lines = [first] + [self.readline() for _ in range(header + trajectory + length)]
+        return b''.join(lines)
+
+    # stream the named signals every decimation-th position tick of HOLD and
+    # TRACK, none stops the stream -> mask, decimation, records the old one dropped
+    def subscribe(self, signals=(), decimation=1):
+        mask = sum(1 << SIGNALS.index(s) for s in signals)
+        return struct.unpack('<BHI', self.request(OP_SUBSCRIBE, struct.pack('<BH', mask, decimation)))
+
+    # the records kept so far, or those of the next frame, [] if none comes in time
+    def read_telemetry(self):
+        if not self.telemetry:
+            f = self.read_frame()
+            if f is None:
+                return []
+            if f[0] != (OP_TELEMETRY | REPLY):
+                raise ProtocolError('reply to 0x%02x in the telemetry stream' % (f[0] & ~REPLY))
+            self.telemetry.extend(parse_telemetry(f[2]))
+        records, self.telemetry = self.telemetry, []
+        return records
+
+    def latency(self):
+        p = self.request(OP_LATENCY)
+        stats = []
+        for k in range(2):
+            count, last, mx, total = struct.unpack_from('<IIIQ', p, 20 * k)
+            stats.append(dict(count=count, mean_us=(total / count / CORE_TIMER_HZ * 1e6) if count else 0,
+                              last_us=last / CORE_TIMER_HZ * 1e6, max_us=mx / CORE_TIMER_HZ * 1e6))
+        return dict(ascii=stats[0], binary=stats[1])
+
+    # the same gain query both ways, timed at the host
+    def ascii_round_trip(self):
+        self.ser.write(b'j\n')
+        for _ in range(3):
+            self.readline()
+
+    def binary_round_trip(self):
+        self.position_gains()
+
+
+def main():
+    dev = NU32(sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1')
+    print(dev.caps())
+    print(dev.status())
+    n = 200
+    for name, fn in (('ascii', dev.ascii_round_trip), ('binary', dev.binary_round_trip)):
+        start = time.perf_counter()
+        for _ in range(n):
+            fn()
+        print('%-6s round trip %.3f ms' % (name, (time.perf_counter() - start) / n * 1e3))
+    print('on target', dev.latency())
+
+    samples = [90.0 * k / 1999 for k in range(2000)]
+    for name, fn in (('ascii', lambda: dev.ascii_upload_trajectory(samples)),
+                     ('float32', lambda: dev.upload_trajectory(samples)),
+                     ('int16', lambda: dev.upload_trajectory(samples, int16_scale=0.01))):
+        start = time.perf_counter()
+        fn()
+        print('%-7s upload of %d samples %.1f ms' % (name, len(samples), (time.perf_counter() - start) * 1e3))
+
+
+if __name__ == '__main__':
+    main()
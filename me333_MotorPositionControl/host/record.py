@@ -0,0 +1,22 @@
+# input recording from record.c, saved for replay in the simulator
+# usage: python record.py /dev/ttyUSB1 start        (while IDLE, then run HOLD or TRACK as usual)
+#        python record.py /dev/ttyUSB1 > run.txt    (stops the recording and saves it)
+#        ../sim/nu32sim replay run.txt              (the PWM going into each current loop tick)
+import sys
+
+from nu32proto import NU32
+
+
+def main():
+    dev = NU32(sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1')
+    if len(sys.argv) > 2 and sys.argv[2] in ('start', 'stop'):
+        ok, recording, used, length = dev.record(sys.argv[2] == 'start')
+        if not ok:
+            sys.exit('refused, recordings start while IDLE')
+        print('recording' if recording else 'stopped', '%d of %d words' % (used, length))
+        return
+    sys.stdout.write(dev.record_dump().decode())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,69 @@
+# live view of the signals streamed by telemetry.c during HOLD and TRACK runs
+# usage: python telemetry.py /dev/ttyUSB1 [signals] [decimation] [--plot]
+#        signals is a comma separated list out of angle,angle_error,command,current,pwm,error_sum
+#        (all by default). Records print one per line until ctrl-C, or with --plot
+#        scroll past in a matplotlib window. Runs are started from the menu or another tool.
+import sys
+
+from nu32proto import NU32, SIGNALS
+
+WINDOW = 1000   # records kept on the plot
+
+
+def print_records(dev, names):
+    print(' '.join(['seq'] + names))
+    expected = None
+    while True:
+        for r in dev.read_telemetry():
+            if expected is not None and r['seq'] != expected:
+                print('# %d records dropped' % (r['seq'] - expected))
+            expected = r['seq'] + 1
+            print(' '.join(['%d' % r['seq']] + ['%g' % r[n] for n in names]))
+
+
+def plot_records(dev, names):
+    import matplotlib.pyplot as plt     # only needed for --plot
+    fig, axes = plt.subplots(len(names), 1, sharex=True, squeeze=False)
+    lines = [ax[0].plot([], [])[0] for ax in axes]
+    for ax, n in zip(axes, names):
+        ax[0].set_ylabel(n)
+    axes[-1][0].set_xlabel('record')
+    seq, values = [], {n: [] for n in names}
+    plt.ion()
+    plt.show()
+    while plt.fignum_exists(fig.number):
+        for r in dev.read_telemetry():
+            seq.append(r['seq'])
+            for n in names:
+                values[n].append(r[n])
+        del seq[:-WINDOW]
+        for n, line, ax in zip(names, lines, axes):
+            del values[n][:-WINDOW]
+            line.set_data(seq, values[n])
+            ax[0].relim()
+            ax[0].autoscale_view()
+        plt.pause(0.05)
+
+
+def main():
+    args = [a for a in sys.argv[1:] if a != '--plot']
+    dev = NU32(args[0] if args else '/dev/ttyUSB1')
+    names = args[1].split(',') if len(args) > 1 else SIGNALS
+    names = [n for n in SIGNALS if n in names]     # records come in mask order
+    decimation = int(args[2]) if len(args) > 2 else 1
+    mask, decimation, _ = dev.subscribe(names, decimation)
+    print('# mask 0x%02x, every %d position ticks' % (mask, decimation), file=sys.stderr)
+    try:
+        if '--plot' in sys.argv:
+            plot_records(dev, names)
+        else:
+            print_records(dev, names)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        dropped = dev.subscribe()[2]
+        print('# %d records dropped on the board' % dropped, file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,89 @@
+# sample interval and control latency from a timestamped HOLD or TRACK log
+# usage: python timing.py /dev/ttyUSB1 [angle]   (runs a HOLD to angle with timestamps on)
+#        python timing.py log.txt                (a saved log, "ref act latch apply" per line, - for stdin)
+# the latch is when the position loop had the encoder count, the apply when the
+# current loop first drove the PWM from the command computed from it
+import math
+import os
+import sys
+import time
+
+CORE_TIMER_HZ = 40e6
+WRAP = 1 << 32
+
+
+def ticks_between(a, b):
+    return (b - a) % WRAP
+
+
+def percentile(values, p):
+    s = sorted(values)
+    return s[min(len(s) - 1, int(round(p / 100.0 * (len(s) - 1))))]
+
+
+def summary(name, us):
+    mean = sum(us) / len(us)
+    std = math.sqrt(sum((v - mean) ** 2 for v in us) / len(us))
+    print('%-9s n %5d  mean %9.2f  std %7.2f  min %9.2f  p1 %9.2f  p99 %9.2f  max %9.2f  us'
+          % (name, len(us), mean, std, min(us), percentile(us, 1), percentile(us, 99), max(us)))
+
+
+def histogram(us, bins=16, width=50):
+    lo, hi = min(us), max(us)
+    step = (hi - lo) / bins or 1.0
+    counts = [0] * bins
+    for v in us:
+        counts[min(bins - 1, int((v - lo) / step))] += 1
+    for k, c in enumerate(counts):
+        print('  %9.2f us %6d %s' % (lo + k * step, c, '#' * int(round(c * width / max(counts)))))
+
+
+def analyse(latch, apply):
+    intervals = [ticks_between(a, b) / CORE_TIMER_HZ * 1e6 for a, b in zip(latch, latch[1:])]
+    latency = [ticks_between(l, a) / CORE_TIMER_HZ * 1e6 for l, a in zip(latch, apply) if a != 0]
+    if not intervals:
+        print('no timestamped samples')
+        return
+    summary('interval', intervals)
+    print('  effective rate %.3f Hz' % (1e6 / (sum(intervals) / len(intervals))))
+    histogram(intervals)
+    if latency:
+        summary('latency', latency)
+        histogram(latency)
+    print('%d of %d samples without an apply time' % (len(latch) - len(latency), len(latch)))
+
+
+def from_file(path):
+    latch, apply = [], []
+    lines = sys.stdin if path == '-' else open(path)
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 4:
+            latch.append(int(fields[2]))
+            apply.append(int(fields[3]))
+    return latch, apply
+
+
+def from_device(port, angle):
+    from nu32proto import NU32     # needs pyserial, saved logs do not
+    dev = NU32(port)
+    dev.set_timestamps(True)
+    dev.run('HOLD', angle)
+    while dev.status()['mode'] == 'HOLD':
+        time.sleep(0.2)
+    caps = dev.caps()
+    times = dev.read_times(caps['log_length'] - 1)     # a HOLD logs one short of the log
+    return [t[0] for t in times], [t[1] for t in times]
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1'
+    if source == '-' or os.path.isfile(source):
+        latch, apply = from_file(source)
+    else:
+        latch, apply = from_device(source, float(sys.argv[2]) if len(sys.argv) > 2 else 45.0)
+    analyse(latch, apply)
+
+
+if __name__ == '__main__':
+    main()
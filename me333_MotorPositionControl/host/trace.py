@@ -0,0 +1,109 @@
+# event trace from trace.c as a Chrome trace_event timeline, for chrome://tracing or ui.perfetto.dev
+# usage: python trace.py /dev/ttyUSB1 start [events]   (clears the ring and records the events, comma
+#                                                       separated out of nu32proto.TRACE_EVENTS, all by default)
+#        python trace.py /dev/ttyUSB1 > trace.json     (stops the trace and converts what it holds)
+#        python trace.py dump.txt > trace.json         (a saved 'D' dump, count line first, - for stdin)
+# each ISR and the main loop get a row, ordered by priority, I2C transfers and the
+# encoder's requests and replies a row of their own, mode changes mark the whole timeline
+import json
+import os
+import sys
+
+CORE_TIMER_HZ = 40e6
+WRAP = 1 << 32
+MODES = ['IDLE', 'PWM', 'ITEST', 'HOLD', 'TRACK']
+EVENTS = ['current_isr', 'position_isr', 'encoder_isr', 'host_isr', 'dma_isr', 'command', 'mode',
+          'encoder_request', 'encoder_reply', 'i2c']
+INSTANT, BEGIN, END = 0, 1, 2
+
+# event -> (row, name), rows top down as the priorities go
+ROWS = {
+    'encoder_isr': (1, 'U2ISR encoder IPL7'),
+    'current_isr': (2, 'CurrentController Timer2 IPL6'),
+    'position_isr': (3, 'PositionController Timer4 IPL5'),
+    'host_isr': (4, 'U3ISR host IPL3'),
+    'dma_isr': (5, 'UartDmaController IPL2'),
+    'command': (6, 'main loop'),
+    'i2c': (7, 'I2C1'),
+    'encoder_request': (8, 'encoder UART2'),
+    'encoder_reply': (8, 'encoder UART2'),
+}
+
+
+def read_dump(lines):
+    lines = iter(lines)
+    count = int(next(lines))
+    return [tuple(int(f) for f in next(lines).split()) for _ in range(count)]
+
+
+# core timer counts to us from the first entry, unwrapped. A preempted record
+# can be a little behind the one before it, so a step back of under half the
+# counter's range is taken as that rather than a wrap.
+def unwrap(entries):
+    t, last, out = 0, None, []
+    for time, event, phase, payload in entries:
+        if last is not None:
+            step = (time - last) % WRAP
+            t += step - WRAP if step >= WRAP // 2 else step
+        last = time
+        out.append((t / CORE_TIMER_HZ * 1e6, EVENTS[event], phase, payload))
+    return sorted(out, key=lambda e: e[0])
+
+
+def label(event, payload):
+    if event == 'command':
+        return 'frame' if payload == 0 else 'menu %s' % chr(payload)
+    if event in ('current_isr', 'position_isr'):
+        return '%s %s' % (event, MODES[payload] if 0 <= payload < len(MODES) else payload)
+    return event
+
+
+def convert(entries):
+    out = []
+    for row, name in sorted(set(ROWS.values())):
+        out.append(dict(name='thread_name', ph='M', pid=1, tid=row, args=dict(name=name)))
+        out.append(dict(name='thread_sort_index', ph='M', pid=1, tid=row, args=dict(sort_index=row)))
+    depth = {}
+    timeline = unwrap(entries)
+    for ts, event, phase, payload in timeline:
+        if event == 'mode':
+            old, new = payload >> 8, payload & 0xFF
+            out.append(dict(name='%s -> %s' % (MODES[old], MODES[new]), ph='i', s='g', ts=ts, pid=1, tid=0))
+            continue
+        row = ROWS[event][0]
+        if phase == INSTANT:
+            args = dict(count=payload) if event == 'encoder_reply' else dict(letter=chr(payload))
+            out.append(dict(name=event, ph='i', s='t', ts=ts, pid=1, tid=row, args=args))
+        elif phase == BEGIN:
+            depth[row] = depth.get(row, 0) + 1
+            out.append(dict(name=label(event, payload), ph='B', ts=ts, pid=1, tid=row, args=dict(payload=payload)))
+        elif depth.get(row, 0) > 0:
+            # an end whose begin the ring overwrote is dropped
+            depth[row] -= 1
+            out.append(dict(ph='E', ts=ts, pid=1, tid=row, args=dict(payload=payload)))
+    # a begin still open when the trace stopped ends with it
+    last = timeline[-1][0] if timeline else 0
+    for row, n in depth.items():
+        out += [dict(ph='E', ts=last, pid=1, tid=row)] * n
+    return dict(traceEvents=out, displayTimeUnit='ns')
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB1'
+    if source == '-' or os.path.isfile(source):
+        entries = read_dump(sys.stdin if source == '-' else open(source))
+    else:
+        from nu32proto import NU32, TRACE_EVENTS     # needs pyserial, saved dumps do not
+        dev = NU32(source)
+        if len(sys.argv) > 2 and sys.argv[2] == 'start':
+            events = sys.argv[3].split(',') if len(sys.argv) > 3 else TRACE_EVENTS
+            mask, length = dev.trace_start(events)
+            print('recording mask 0x%x, the last %d entries are kept' % (mask, length))
+            return
+        entries = dev.trace_dump()
+    json.dump(convert(entries), sys.stdout)
+    print()
+
+
+if __name__ == '__main__':
+    main()
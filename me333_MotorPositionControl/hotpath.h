@@ -0,0 +1,32 @@
+#ifndef HOTPATH_H_
+#define HOTPATH_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include <sys/attribs.h>
+
+// Placement of the control ISRs' code.
+//
+// Flash runs with 2 wait states (CHECONbits.PFMWS in NU32.c), so every line
+// the prefetch cache misses costs the ISRs a stall. Built with
+// "make HOT_IN_RAM=1" the functions marked HOT run from RAM instead: xc32
+// puts them in .ramfunc, its allocator places that past the data and works
+// out the BMX split that NU32bootloaded.ld leaves to it, and the startup code
+// copies them in before main. The build adds -mlong-calls, a RAM function and
+// a flash one are too far apart for a jal either way.
+//
+// HOT marks what the Timer2, Timer4 and UART2 ISRs run a tick, the ISR entry
+// points themselves stay in flash as the vector dispatch jumps there. Library
+// calls (soft float, the sscanf in the encoder reply) stay in flash.
+
+#ifdef HOT_IN_RAM
+#define HOT __ramfunc__
+#else
+#define HOT
+#endif
+
+
+#endif
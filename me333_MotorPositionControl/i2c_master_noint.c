@@ -1,4 +1,6 @@
 #include "NU32.h"          // constants, funcs for startup and UART
+#include "trace.h"
+#include "hotpath.h"
 // I2C Master utilities, 100 kHz, using polling rather than interrupts
 // The functions must be callled in the correct order as per the I2C protocol
 // Master will use I2C1 SDA1 (D9) and SCL1 (D10)
@@ -13,17 +15,18 @@ void i2c_master_setup(void) {
 }
 
 // Start a transmission on the I2C bus
-void i2c_master_start(void) {
+HOT void i2c_master_start(void) {
+    trace_Record(TRACE_I2C, TRACE_BEGIN, 0);
     I2C1CONbits.SEN = 1;            // send the start bit
     while(I2C1CONbits.SEN) { ; }    // wait for the start bit to be sent
 }
 
-void i2c_master_restart(void) {     
+HOT void i2c_master_restart(void) {     
     I2C1CONbits.RSEN = 1;           // send a restart 
     while(I2C1CONbits.RSEN) { ; }   // wait for the restart to clear
 }
 
-void i2c_master_send(unsigned char byte) { // send a byte to slave
+HOT void i2c_master_send(unsigned char byte) { // send a byte to slave
   I2C1TRN = byte;                   // if an address, bit 0 = 0 for write, 1 for read
   while(I2C1STATbits.TRSTAT) { ; }  // wait for the transmission to finish
   if(I2C1STATbits.ACKSTAT) {        // if this is high, slave has not acknowledged
@@ -31,20 +34,21 @@ void i2c_master_send(unsigned char byte) { // send a byte to slave
   }
 }
 
-unsigned char i2c_master_recv(void) { // receive a byte from the slave
+HOT unsigned char i2c_master_recv(void) { // receive a byte from the slave
     I2C1CONbits.RCEN = 1;             // start receiving data
     while(!I2C1STATbits.RBF) { ; }    // wait to receive the data
     return I2C1RCV;                   // read and return the data
 }
 
-void i2c_master_ack(int val) {        // sends ACK = 0 (slave should send another byte)
+HOT void i2c_master_ack(int val) {        // sends ACK = 0 (slave should send another byte)
                                       // or NACK = 1 (no more bytes requested from slave)
     I2C1CONbits.ACKDT = val;          // store ACK/NACK in ACKDT
     I2C1CONbits.ACKEN = 1;            // send ACKDT
     while(I2C1CONbits.ACKEN) { ; }    // wait for ACK/NACK to be sent
 }
 
-void i2c_master_stop(void) {          // send a STOP:
+HOT void i2c_master_stop(void) {          // send a STOP:
   I2C1CONbits.PEN = 1;                // comm is complete and master relinquishes bus
   while(I2C1CONbits.PEN) { ; }        // wait for STOP to complete
+  trace_Record(TRACE_I2C, TRACE_END, 0);
 }
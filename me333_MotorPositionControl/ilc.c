@@ -0,0 +1,166 @@
+#include "ilc.h"
+#include "hotpath.h"
+#include <math.h>
+#include <string.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static volatile int ilc_enabled = 0;
+static volatile float ilc_gain = 30.0;      // mA of feedforward per degree of error
+static volatile float ilc_q = 0.3;          // Q-filter smoothing, 1 leaves the table unfiltered
+static volatile int ilc_lead = 3;           // samples between a current command and the error it shows up in
+
+static volatile float error_sq_sum = 0;     // this run so far
+static volatile int run_pending = 0;        // a complete run waiting for ilc_Poll
+static volatile int run_length = 0;
+static volatile float run_error_sq_sum = 0;
+
+static int iteration = 0;
+static int learned_length = 0;
+static float last_rms = 0;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static HOT float clamp_ff(float u)
+{
+    u = (u > ILC_FF_MAX) ? ILC_FF_MAX : u;
+    u = (u < -ILC_FF_MAX) ? -ILC_FF_MAX : u;
+    return u;
+}
+
+static void clear_table()
+{
+    memset(ilcFeedforward, 0, sizeof(ilcFeedforward));
+    iteration = 0;
+    learned_length = 0;
+}
+
+// Forward then backward first order low-pass, the two phase lags cancel
+static void q_filter(int length)
+{
+    float q = ilc_q;
+    if ((q >= 1.0) || (q <= 0.0) || (length < 2))
+    {
+        return;
+    }
+    float y = ilcFeedforward[0];
+    for (int i = 1; i < length; i++)
+    {
+        y += q * (ilcFeedforward[i] - y);
+        ilcFeedforward[i] = y;
+    }
+    y = ilcFeedforward[length - 1];
+    for (int i = length - 2; i >= 0; i--)
+    {
+        y += q * (ilcFeedforward[i] - y);
+        ilcFeedforward[i] = y;
+    }
+}
+
+void setILC(int enabled, float gain, float q, int lead)
+{
+    lead = (lead < 0) ? 0 : lead;
+    ilc_gain = gain;
+    ilc_q = q;
+    ilc_lead = lead;
+    if (!enabled && ilc_enabled)
+    {
+        ilc_enabled = 0;
+        clear_table();
+    }
+    ilc_enabled = enabled ? 1 : 0;
+}
+
+int getILCEnabled()
+{
+    return ilc_enabled;
+}
+
+float getILCGain()
+{
+    return ilc_gain;
+}
+
+float getILCQ()
+{
+    return ilc_q;
+}
+
+int getILCLead()
+{
+    return ilc_lead;
+}
+
+int getILCIteration()
+{
+    return iteration;
+}
+
+float getILCError()
+{
+    return last_rms;
+}
+
+void ilc_Poll()
+{
+    if (!run_pending || (get_mode() == TRACK))
+    {
+        return;
+    }
+    run_pending = 0;
+    int length = run_length;
+    last_rms = sqrtf(run_error_sq_sum / length);
+    if (!ilc_enabled)
+    {
+        return;
+    }
+
+    if ((learned_length != 0) && (length != learned_length))
+    {
+        clear_table();      // learned on another trajectory, start over
+        return;
+    }
+    q_filter(length);
+    learned_length = length;
+    iteration++;
+}
+
+/*************************
+ * POSITION LOOP HOOKS
+*************************/
+
+HOT float ilc_Feedforward(int idx)
+{
+    return ilc_enabled ? ilcFeedforward[idx] : 0;
+}
+
+HOT void ilc_Learn(int idx, float error)
+{
+    if (idx == 0)
+    {
+        error_sq_sum = 0;
+    }
+    error_sq_sum += error * error;
+
+    int target = idx - ilc_lead;
+    if (ilc_enabled && (target >= 0))
+    {
+        ilcFeedforward[target] = clamp_ff(ilcFeedforward[target] + ilc_gain * error);
+    }
+}
+
+void ilc_RunDone(int length)
+{
+    if (length <= 0)
+    {
+        return;
+    }
+    run_length = length;
+    run_error_sq_sum = error_sq_sum;
+    run_pending = 1;
+}
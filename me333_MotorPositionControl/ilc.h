@@ -0,0 +1,57 @@
+#ifndef ILC_H_
+#define ILC_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "utilities.h"
+#include "positioncontrol.h"
+
+// Iterative learning control for repeated TRACK runs.
+//
+// While a run is going the position loop adds ilcFeedforward[i] to its current
+// command at sample i, and adds gain * error[i] to the entry ilc_lead samples
+// earlier, which it has already used. error is runLogRef - runLogAct
+// as the loop logs them. When the run has finished ilc_Poll() passes the table
+// through the Q-filter, a zero-phase first order low-pass, so run k+1 starts from
+//     u(k+1) = Q(u(k) + gain * e(k) shifted by ilc_lead)
+// Runs that are aborted leave their partial update unfiltered until the next
+// complete run. The table is cleared when learning is turned off or when the
+// trajectory length changes.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define ILC_FF_MAX 2000.0       // mA, feedforward limit per sample
+
+
+/*************************
+ * PUBLIC GLOBAL VARIABLES
+*************************/
+float ilcFeedforward[MAX_REF_TRAJ_LENGTH];
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+void setILC(int enabled, float gain, float q, int lead);
+int getILCEnabled();
+float getILCGain();
+float getILCQ();
+int getILCLead();
+int getILCIteration();      // complete runs learned from since the table was cleared
+float getILCError();        // RMS tracking error of the last complete run, degrees
+
+void ilc_Poll();            // main loop, filters the table once a TRACK run has finished
+
+// Position loop side, called from the TRACK branch of the Timer4 ISR
+float ilc_Feedforward(int idx);
+void ilc_Learn(int idx, float error);
+void ilc_RunDone(int length);
+
+
+#endif
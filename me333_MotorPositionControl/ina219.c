@@ -1,4 +1,6 @@
 #include "ina219.h"
+#include "hotpath.h"
+#include "record.h"
 
 #define INA219_ADDR 0b1000000 // I2C address
 #define INA219_REG_CONFIG 0x00 // config register address
@@ -23,8 +25,9 @@ void INA219_Startup() {
 }
 
 // get the current in mA
-float INA219_read_current(){
+HOT float INA219_read_current(){
   signed short value = readINA219(INA219_REG_CURRENT);
+  record_Current(value);
   float ma = value / 3.0;
   return ma;
 }
@@ -40,7 +43,7 @@ void writeINA219(unsigned char reg, unsigned short value){
 }
 
 // read 2 bytes
-signed short readINA219(unsigned char reg){
+HOT signed short readINA219(unsigned char reg){
   i2c_master_start();
   i2c_master_send(INA219_ADDR<<1); // write to the INA219
   i2c_master_send(reg); // the reg to read from
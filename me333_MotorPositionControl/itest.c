@@ -0,0 +1,137 @@
+#include "itest.h"
+#include "hotpath.h"
+#include "currentcontrol.h"
+#include <math.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+#define SINE_TABLE_LENGTH 256
+
+static float sine_table[SINE_TABLE_LENGTH + 1];     // one period, the last entry is the first again
+static int sine_ready = 0;
+
+static struct itest_params_t params = {ITEST_SQUARE, ITEST_AMPLITUDE, ITEST_PERIOD, ITEST_COUNT, 0, 1};
+
+static int tick = 0;            // ISR, current loop ticks into the run
+static int run_ticks = 0;       // ISR, latched at the first tick
+static float period_ticks = 0;
+static int until_log = 0;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static int total_ticks(const struct itest_params_t * p)
+{
+    return (int)(p->count * p->period * getCurrentLoopRate() + 0.5f);
+}
+
+static int samples(const struct itest_params_t * p)
+{
+    return (total_ticks(p) + p->decimation - 1) / p->decimation;
+}
+
+// Linear interpolation in the table, cycle in [0, 1)
+static float sine(float cycle)
+{
+    float x = cycle * SINE_TABLE_LENGTH;
+    int i = (int)x;
+    return sine_table[i] + (sine_table[i + 1] - sine_table[i]) * (x - i);
+}
+
+int setITest(const struct itest_params_t * p)
+{
+    if ((get_mode() == ITEST) || (p->shape < 0) || (p->shape >= ITEST_SHAPES)
+        || (p->amplitude < 0) || (p->amplitude > ITEST_AMPLITUDE_MAX)
+        || (p->count < 1) || (p->decimation < 1) || ((p->shape == ITEST_CHIRP) && (p->end_hz <= 0)))
+    {
+        return 1;
+    }
+    // at least two ticks a period, and a run that fits the log
+    if ((p->period * getCurrentLoopRate() < 2) || (samples(p) > RUNLOG_LENGTH))
+    {
+        return 1;
+    }
+    if (!sine_ready)
+    {
+        for (int i = 0; i <= SINE_TABLE_LENGTH; i++)
+        {
+            sine_table[i] = sinf(2 * M_PI * i / SINE_TABLE_LENGTH);
+        }
+        sine_ready = 1;
+    }
+    params = *p;
+    return 0;
+}
+
+void getITest(struct itest_params_t * p)
+{
+    *p = params;
+}
+
+int itest_Samples()
+{
+    return samples(&params);
+}
+
+float itest_SamplePeriod()
+{
+    return params.decimation * getCurrentDT();
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT float itest_Reference()
+{
+    if (tick == 0)
+    {
+        run_ticks = total_ticks(&params);
+        period_ticks = params.period * getCurrentLoopRate();
+        until_log = 0;
+        runLogLength = 0;
+    }
+
+    // periods since the start, in ticks so a square lands on whole ticks
+    float cycles;
+    if (params.shape == ITEST_CHIRP)
+    {
+        float f0 = 1.0f / period_ticks;
+        float f1 = params.end_hz / getCurrentLoopRate();
+        cycles = f0 * tick + (f1 - f0) * tick * tick / (2.0f * run_ticks);
+    }
+    else
+    {
+        cycles = tick / period_ticks;
+    }
+    cycles -= (int)cycles;
+
+    if (params.shape == ITEST_SQUARE)
+    {
+        return (cycles < 0.5f) ? params.amplitude : -params.amplitude;
+    }
+    return params.amplitude * sine(cycles);
+}
+
+HOT int itest_Log(float reference, float measured)
+{
+    if (until_log == 0)
+    {
+        runLogRef[runLogLength] = (int)(reference + ((reference < 0) ? -0.5f : 0.5f));
+        runLogAct[runLogLength] = (int)(measured + ((measured < 0) ? -0.5f : 0.5f));
+        runLogLength++;
+        until_log = params.decimation;
+    }
+    until_log--;
+    return ++tick < run_ticks;
+}
+
+void itest_Reset()
+{
+    tick = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef ITEST_H_
+#define ITEST_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "runlog.h"
+
+// Current loop test waveforms for ITEST.
+//
+// A run is count periods of a square, a sine or a chirp of the given amplitude
+// around 0 mA. A chirp is a sine whose frequency rises linearly from 1/period
+// at the start to end_hz at the end, over the same count * period seconds. The
+// reference and the measured current are logged in the run log every
+// decimation-th current loop tick, and the run is refused unless it fits the log
+// whole. The defaults are the original test, two 10 ms periods of +-200 mA
+// logged at every tick.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+enum itest_shape_t {
+    ITEST_SQUARE,
+    ITEST_SINE,
+    ITEST_CHIRP,
+    ITEST_SHAPES
+};
+
+#define ITEST_AMPLITUDE 200.0       // mA
+#define ITEST_AMPLITUDE_MAX 1000.0
+#define ITEST_PERIOD 0.01           // s
+#define ITEST_COUNT 2
+
+struct itest_params_t {
+    int shape;              // enum itest_shape_t
+    float amplitude;        // mA
+    float period;           // s, for a chirp the period it starts at
+    int count;              // periods
+    float end_hz;           // chirp only, the frequency it ends at
+    int decimation;         // current loop ticks per logged sample
+};
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int setITest(const struct itest_params_t * p);     // 0 if taken, only outside ITEST
+void getITest(struct itest_params_t * p);
+int itest_Samples();            // samples the run logs
+float itest_SamplePeriod();     // s between logged samples
+
+// Called from the Timer2 ISR. Reference is this tick's reference in mA, Log
+// logs it and the measured current when the tick is due one and returns 0 once
+// the run is over. Reset starts the next run from the beginning.
+float itest_Reference();
+int itest_Log(float reference, float measured);
+void itest_Reset();
+
+
+#endif
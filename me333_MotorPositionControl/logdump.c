@@ -0,0 +1,80 @@
+#include "logdump.h"
+#include "uartdma.h"
+#include "positioncontrol.h"
+#include "format.h"
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static enum mode_t dump_mode = IDLE;
+static int timestamps = 0;      // the setting when the dump started
+static int count = 0;           // samples to send
+static int next = -1;           // the next sample, -1 for the count line
+
+static unsigned int started = 0;
+static volatile unsigned int ticks = 0;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static int format_line(char * line)
+{
+    if (next >= count)
+    {
+        return 0;
+    }
+    char * p = line;
+    if (next < 0)
+    {
+        p = format_Int(p, count);
+    }
+    else if (dump_mode == ITEST)
+    {
+        p = format_Int(p, runLogRef[next]);
+        *p++ = ' ';
+        p = format_Int(p, runLogAct[next]);
+    }
+    else
+    {
+        p = format_Float(p, Q16_TO_DEG(runLogRef[next]), 6);     // as %f
+        *p++ = ' ';
+        p = format_Float(p, Q16_TO_DEG(runLogAct[next]), 6);
+        if (timestamps)
+        {
+            *p++ = ' ';
+            p = format_Uint(p, latchTimeArray[next]);
+            *p++ = ' ';
+            p = format_Uint(p, applyTimeArray[next]);
+        }
+    }
+    p = format_Str(p, "\n\r");
+    next++;
+    return p - line;
+}
+
+static void finished()
+{
+    ticks = _CP0_GET_COUNT() - started;
+}
+
+int logDump_Start(enum mode_t m)
+{
+    if (uartDma_Busy())
+    {
+        return 1;
+    }
+    dump_mode = m;
+    timestamps = getTimestamps();
+    count = (m == HOLD) ? RUNLOG_LENGTH : runLogLength;
+    next = -1;
+    started = _CP0_GET_COUNT();
+    return uartDma_StartLines(format_line, finished);
+}
+
+unsigned int logDump_Ticks()
+{
+    return ticks;
+}
@@ -0,0 +1,30 @@
+#ifndef LOGDUMP_H_
+#define LOGDUMP_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "utilities.h"
+#include "runlog.h"
+
+// The run log sent back to the host after an ITEST, HOLD or TRACK run, as
+// the lines the host scripts read: the sample count, then one line a sample.
+// ITEST lines are the reference and measured mA, HOLD and TRACK lines the
+// reference and measured degrees, with the latch and apply times when
+// timestamps are on. HOLD always sends the whole log.
+//
+// The lines are formatted a block at a time as UART3's DMA asks for them,
+// the control loops and the main loop carry on while the dump goes out.
+// Binary replies can come between its lines, menu commands wait for its end.
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int logDump_Start(enum mode_t m);   // 0 on success, 1 while the UART is busy
+unsigned int logDump_Ticks();       // core timer ticks the last finished dump took
+
+
+#endif
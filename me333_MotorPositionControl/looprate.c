@@ -0,0 +1,215 @@
+#include "looprate.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "hotpath.h"
+
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define CORE_TIMER_HZ (NU32_SYS_FREQ / 2)
+
+// core timer ticks a count of each loop's timer
+static const unsigned int timer_scale[LOOPS] = {CORE_TIMER_HZ / TIMER2_HZ, CORE_TIMER_HZ / TIMER4_HZ};
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static volatile unsigned int max_ticks[LOOPS];
+static volatile enum overrun_policy_t policy[LOOPS] = {OVERRUN_COUNT, OVERRUN_COUNT};
+static volatile struct overrun_stats_t overruns[LOOPS];
+static volatile unsigned char respond[LOOPS];      // the next call carries out the policy
+static volatile unsigned char slow_pending[LOOPS];
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// Reprogram whichever rate changed, with what depends on it
+static void apply_rates(int current_hz, int position_hz)
+{
+    if (current_hz != getCurrentLoopRate())
+    {
+        setCurrentLoopRate(current_hz);
+        biquad_Retime(BQ_CURRENT);
+        velocityControl_Retime();
+    }
+    if (position_hz != getPositionLoopRate())
+    {
+        setPositionLoopRate(position_hz);
+        biquad_Retime(BQ_RATE);
+        biquad_Retime(BQ_COMMAND);
+    }
+}
+
+static void fault()
+{
+    set_mode(IDLE);
+    set_PWM(0);
+    OC1RS = 0;          // now, not at the next current tick
+    NU32_LED2 = 0;      // turn on LED2 to flag the fault
+}
+
+int setLoopRates(int current_hz, int position_hz)
+{
+    const float core_hz = NU32_SYS_FREQ / 2;
+    if ((get_mode() != IDLE) || (current_hz < LOOPRATE_CURRENT_MIN) || (current_hz > LOOPRATE_CURRENT_MAX)
+        || (position_hz < LOOPRATE_POSITION_MIN) || (position_hz > LOOPRATE_POSITION_MAX))
+    {
+        return 1;
+    }
+
+    float current_load = max_ticks[LOOP_CURRENT] * current_hz / core_hz;
+    float position_load = max_ticks[LOOP_POSITION] * position_hz / core_hz;
+    if ((current_load > LOOPRATE_LOAD_MAX) || (position_load > LOOPRATE_LOAD_MAX)
+        || (current_load + position_load > LOOPRATE_LOAD_MAX))
+    {
+        return 1;
+    }
+
+    apply_rates(current_hz, position_hz);
+    return 0;
+}
+
+unsigned int looprate_MaxTicks(enum loop_t loop)
+{
+    return max_ticks[loop];
+}
+
+void looprate_ResetTimes()
+{
+    for (int i = 0; i < LOOPS; i++)
+    {
+        max_ticks[i] = 0;
+    }
+}
+
+int looprate_SetPolicy(enum loop_t loop, enum overrun_policy_t p)
+{
+    if ((loop >= LOOPS) || (p >= OVERRUN_POLICIES))
+    {
+        return 1;
+    }
+    policy[loop] = p;
+    respond[loop] = 0;
+    slow_pending[loop] = 0;
+    return 0;
+}
+
+enum overrun_policy_t looprate_GetPolicy(enum loop_t loop)
+{
+    return policy[loop];
+}
+
+void looprate_GetOverruns(enum loop_t loop, struct overrun_stats_t * stats)
+{
+    __builtin_disable_interrupts();
+    *stats = overruns[loop];
+    __builtin_enable_interrupts();
+}
+
+void looprate_ResetOverruns()
+{
+    __builtin_disable_interrupts();
+    for (int i = 0; i < LOOPS; i++)
+    {
+        overruns[i].overruns = overruns[i].lost = overruns[i].worst = overruns[i].responses = 0;
+    }
+    __builtin_enable_interrupts();
+}
+
+// Half the rate of each loop that asked, with the run going on, unless the run
+// is one the loop times sample by sample. Both ISRs use what changes, so
+// neither runs until it is all in place.
+void looprate_Poll()
+{
+    if (!slow_pending[LOOP_CURRENT] && !slow_pending[LOOP_POSITION])
+    {
+        return;
+    }
+    __builtin_disable_interrupts();
+    int rates[LOOPS] = {getCurrentLoopRate(), getPositionLoopRate()};
+    const int rate_min[LOOPS] = {LOOPRATE_CURRENT_MIN, LOOPRATE_POSITION_MIN};
+    const enum mode_t timed[LOOPS] = {ITEST, TRACK};   // a sample a tick, from an array made for the rate
+    for (int i = 0; i < LOOPS; i++)
+    {
+        if (!slow_pending[i])
+        {
+            continue;
+        }
+        if (rates[i] == rate_min[i])
+        {
+            slow_pending[i] = 0;
+            ++overruns[i].responses;
+            fault();        // nothing slower to go to
+            continue;
+        }
+        if (get_mode() == timed[i])
+        {
+            continue;       // left pending, slowed once the run ends
+        }
+        slow_pending[i] = 0;
+        ++overruns[i].responses;
+        rates[i] /= 2;
+        rates[i] = (rates[i] < rate_min[i]) ? rate_min[i] : rates[i];
+    }
+    apply_rates(rates[LOOP_CURRENT], rates[LOOP_POSITION]);
+    __builtin_enable_interrupts();
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT void looprate_Record(enum loop_t loop, unsigned int ticks, unsigned int count)
+{
+    if (ticks > max_ticks[loop])
+    {
+        max_ticks[loop] = ticks;
+    }
+
+    respond[loop] = 0;
+    unsigned int period = (((loop == LOOP_CURRENT) ? PR2 : PR4) + 1) * timer_scale[loop];
+    unsigned int late = count * timer_scale[loop] + ticks;     // from the match to now
+    if (late < period)
+    {
+        return;
+    }
+    volatile struct overrun_stats_t * s = &overruns[loop];
+    ++s->overruns;
+    s->lost += late / period;
+    s->worst = (late > s->worst) ? late : s->worst;
+    switch (policy[loop])
+    {
+    case OVERRUN_SKIP_LOG:
+    case OVERRUN_HOLD:
+        respond[loop] = 1;
+        ++s->responses;
+        break;
+    case OVERRUN_SLOW:
+        slow_pending[loop] = 1;     // counted when the main loop acts on it
+        break;
+    case OVERRUN_FAULT:
+        fault();
+        ++s->responses;
+        break;
+    default:
+        break;
+    }
+}
+
+HOT int looprate_SkipLog(enum loop_t loop)
+{
+    return respond[loop] && (policy[loop] == OVERRUN_SKIP_LOG);
+}
+
+HOT int looprate_HoldCommand(enum loop_t loop)
+{
+    return respond[loop] && (policy[loop] == OVERRUN_HOLD);
+}
@@ -0,0 +1,104 @@
+#ifndef LOOPRATE_H_
+#define LOOPRATE_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+
+// Run-time rates for the current (Timer2) and position (Timer4) loops, and the
+// ISR times that decide whether a pair of rates can be run.
+//
+// Both ISRs record how long each call took on the core timer. A new pair of
+// rates is refused unless, by the longest calls seen so far, the current ISR
+// stays under LOOPRATE_LOAD_MAX of its period, the position ISR under
+// LOOPRATE_LOAD_MAX of its own, and both together under LOOPRATE_LOAD_MAX of the
+// CPU. The position ISR's time includes the current ISRs that preempt it, so
+// the sum counts those twice, which errs on the safe side. Run a HOLD at the
+// present rates first so there are times to judge by.
+//
+// Changing a rate reprograms its timer, the period the loop integrates and
+// differentiates over, the velocity loop divider and the log rates reported to
+// the host. The integrators are scaled so the I gains mean the same at any rate.
+// Filters at a loop point whose rate changed are designed again for the new
+// rate, see biquad_Retime.
+//
+// Each ISR also passes its timer's count at entry, how long after the period
+// match it got going. With the time it ran that gives how far past the match
+// it left; at or past a whole period the next match came while it ran, and as
+// the ISR clears its flag on the way out that interrupt is lost. Such a call
+// is an overrun, counted with the periods it swallowed, and the loop's policy
+// decides the response:
+//   OVERRUN_COUNT      count it, nothing more
+//   OVERRUN_SKIP_LOG   the next call leaves out what only the host sees: the
+//                      position loop's telemetry record and timestamps, the
+//                      current loop's applied time. The run log is kept so
+//                      the dump lines up.
+//   OVERRUN_HOLD       the next call of a HOLD, TRACK or ITEST leaves the last
+//                      command where it is and does no control work
+//   OVERRUN_SLOW       the main loop halves the loop's rate, as setLoopRates
+//                      would, with a HOLD going on. A TRACK takes a sample of
+//                      its trajectory and ILC table each position tick and an
+//                      ITEST a waveform sample each current tick, so the loop
+//                      that times the run is only slowed once the run ends,
+//                      and it overruns until then. A loop at its minimum
+//                      faults straight away.
+//   OVERRUN_FAULT      IDLE with the PWM zeroed and LED2 on, from the ISR
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define LOOPRATE_CURRENT_MIN 1000       // Hz
+#define LOOPRATE_CURRENT_MAX 10000
+#define LOOPRATE_POSITION_MIN 50        // Hz, Timer4's 16 bit period at 1:64
+#define LOOPRATE_POSITION_MAX 1000
+#define LOOPRATE_LOAD_MAX 0.8
+
+enum loop_t {
+    LOOP_CURRENT,
+    LOOP_POSITION,
+    LOOPS
+};
+
+enum overrun_policy_t {
+    OVERRUN_COUNT,
+    OVERRUN_SKIP_LOG,
+    OVERRUN_HOLD,
+    OVERRUN_SLOW,
+    OVERRUN_FAULT,
+    OVERRUN_POLICIES
+};
+
+struct overrun_stats_t {
+    unsigned int overruns;      // calls that left at or past the next match
+    unsigned int lost;          // periods those calls swallowed
+    unsigned int worst;         // core timer ticks from the match to the exit, the most seen
+    unsigned int responses;     // times the policy acted
+};
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int setLoopRates(int current_hz, int position_hz);  // 0 on success, only while IDLE
+unsigned int looprate_MaxTicks(enum loop_t loop);   // longest ISR call, core timer ticks
+void looprate_ResetTimes();
+
+int looprate_SetPolicy(enum loop_t loop, enum overrun_policy_t policy);     // 0 on success
+enum overrun_policy_t looprate_GetPolicy(enum loop_t loop);
+void looprate_GetOverruns(enum loop_t loop, struct overrun_stats_t * stats);
+void looprate_ResetOverruns();
+void looprate_Poll();                                   // main loop, carries out OVERRUN_SLOW
+
+// ISR side
+void looprate_Record(enum loop_t loop, unsigned int ticks, unsigned int count);     // ISR time, timer count at entry
+int looprate_SkipLog(enum loop_t loop);                 // 1 when this call is to leave out its logging
+int looprate_HoldCommand(enum loop_t loop);             // 1 when this call is to keep the last command
+
+
+#endif
@@ -5,6 +5,24 @@
 #include "ina219.h"
 #include "currentcontrol.h"
 #include "positioncontrol.h"
+#include "cmdqueue.h"
+#include "binproto.h"
+#include "config.h"
+#include "ilc.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "cogging.h"
+#include "scurve.h"
+#include "segqueue.h"
+#include "looprate.h"
+#include "itest.h"
+#include "runlog.h"
+#include "telemetry.h"
+#include "uartdma.h"
+#include "logdump.h"
+#include "format.h"
+#include "trace.h"
+#include "record.h"
 #include <string.h>
 
 
@@ -21,15 +39,23 @@
 static int request_encoder_position();  
 static void zero_encoder_count();
 static void request_mode_to_buffer();   // To report current mode
-void send_itest_data();                 // Sending ITEST array data back for visualization 
+static void begin_report(enum mode_t);  // Arm the data dump for when the given mode finishes
+static void service_pending_report();   // Send the armed dump once its mode has finished
 void accept_trajectory();               // Recieving trajectory from python script into array to reference later
-void send_track_data();                 // Send TRACK arrays data back for visualization
-void send_hold_data();                  // Send HOLD arrays data back for visualization
+static void send_int(int);              // One number reply line, without sprintf
+static void send_float(float);          // The same for %f
+static void send_latency(enum cmd_kind_t);  // Report command latency stats for one message kind
+static void send_trajectory_list();     // Report the trajectories stored in flash
+static void accept_filter();            // Load the biquad sections at one loop point
+static void accept_segment();           // Append to, start or clear the TRACK segment queue
 
 /*************************
  * PRIVATE GLOBAL VARIABLES
 *************************/
 static char buffer[BUF_SIZE];
+static int report_pending = 0;
+static enum mode_t report_mode = IDLE;
+static unsigned int report_abort_count = 0;
 
 
 /*************************
@@ -49,38 +75,71 @@ int main()
   INA219_Startup();
   currentControl_Startup();
   positionControl_Startup();
+  cmdQueue_Startup();
+  binProto_Startup();
+  uartDma_Startup();
+  config_Startup();       // gains and trajectory from flash, if any were saved
   __builtin_enable_interrupts();
 
   while (1)
   {
-    NU32_ReadUART3(buffer, BUF_SIZE);   // we expect the next character to be a menu command
+    ilc_Poll();                           // learn from a TRACK run that has ended
+    cogging_Poll();                       // fit the cogging table once its sweep has ended
+    looprate_Poll();                      // slow a loop that overran, if its policy says so
+    uartDma_Poll();                       // format more of a log dump as its DMA asks
+    if (uartDma_Busy())
+    {
+      // the dump has UART3: a frame is answered between two of its lines, a
+      // menu line waits for its end, its reply could not be told from the dump
+      if ((cmdQueue_NextKind() >= CMD_FRAME) && uartDma_CanInsert())
+      {
+        trace_Record(TRACE_COMMAND, TRACE_BEGIN, 0);
+        binProto_Service();
+        trace_Record(TRACE_COMMAND, TRACE_END, 0);
+      }
+      continue;
+    }
+    telemetry_Poll();                     // stream subscribed signals while the UART has room
+    service_pending_report();             // finish off an ITEST/HOLD/TRACK run that has ended
+    binProto_Poll();
+    if (cmdQueue_NextKind() >= CMD_FRAME)
+    {
+      trace_Record(TRACE_COMMAND, TRACE_BEGIN, 0);
+      binProto_Service();                 // binary request, answered in one reply frame
+      trace_Record(TRACE_COMMAND, TRACE_END, 0);
+      continue;
+    }
+    if (!cmdQueue_GetLine(buffer, BUF_SIZE))
+    {
+      continue;                           // nothing queued, the runs carry on in the ISRs
+    }
     NU32_LED2 = 1;                      // clear the error LED
+    trace_Record(TRACE_COMMAND, TRACE_BEGIN, buffer[0]);
+    telemetry_Flush();                    // replies go out between telemetry frames
     switch (buffer[0])
     {
 
 
     case 'b':
     {
-      float current = INA219_read_current();
-      sprintf(buffer, "%f\r\n", current);
-      NU32_WriteUART3(buffer);
+      float current = readCurrent();
+      send_float(current);
       break;
     } 
 
     case 'c':
     {
-      int count = request_encoder_position();
-      sprintf(buffer, "%d\r\n", count);
+      long long count = readEncoderCount();
+      format_Str(format_Int64(buffer, count), "\r\n");
       NU32_WriteUART3(buffer);
       break;
     }
 
      case 'd':
      {
-      int count = request_encoder_position();
-      double degs = 360.0/(334*4) * count;
-      sprintf(buffer, "%f\r\n", degs);
-      NU32_WriteUART3(buffer);
+      long long count = readEncoderCount();
+      double degs = 360.0/COUNTS_PER_REV * count;
+      send_float(degs);
       break;
     }
 
@@ -88,22 +147,20 @@ int main()
      {
       zero_encoder_count();
       int count = request_encoder_position();
-      sprintf(buffer, "%d\r\n", count);
-      NU32_WriteUART3(buffer);
+      send_int(count);
       break;
     }
 
     case 'f':
      {
       int pwm = 0;
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%d", &pwm);
       set_PWM(pwm);
       
       // Returning for confirmation
       int set_pwm = get_PWM();
-      sprintf(buffer, "%d\r\n", set_pwm);
-      NU32_WriteUART3(buffer);
+      send_int(set_pwm);
       set_mode(PWM);
       break;
     }
@@ -111,20 +168,18 @@ int main()
     case 'g':
      {
       float p=0.0, i=0.0;
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%f", &p);
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%f", &i);
       setCurrentGains(p, i);
 
       // Returning for confirmation
       float _p = getCurrentP();     
-      sprintf(buffer, "%f\r\n", _p);
-      NU32_WriteUART3(buffer);
+      send_float(_p);
 
       float _i = getCurrentI();
-      sprintf(buffer, "%f\r\n", _i);
-      NU32_WriteUART3(buffer);
+      send_float(_i);
 
       break;
     }
@@ -132,38 +187,33 @@ int main()
     case 'h':
      {
       float _p = getCurrentP();     
-      sprintf(buffer, "%f\r\n", _p);
-      NU32_WriteUART3(buffer);
+      send_float(_p);
 
       float _i = getCurrentI();
-      sprintf(buffer, "%f\r\n", _i);
-      NU32_WriteUART3(buffer);
+      send_float(_i);
       break;
     }
 
     case 'i':
      {
       float p=0.0, i=0.0, d=0.0;
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%f", &p);
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%f", &i);
-      NU32_ReadUART3(buffer, BUF_SIZE);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
       sscanf(buffer, "%f", &d);
       setPositionGains(p, i, d); 
 
       // Returning for confirmation
       float _p = getPositionP();     
-      sprintf(buffer, "%f\r\n", _p);
-      NU32_WriteUART3(buffer);
+      send_float(_p);
 
       float _i = getPositionI();
-      sprintf(buffer, "%f\r\n", _i);
-      NU32_WriteUART3(buffer);
+      send_float(_i);
 
       float _d = getPositionD();
-      sprintf(buffer, "%f\r\n", _d);
-      NU32_WriteUART3(buffer);
+      send_float(_d);
 
       break;
     }
@@ -171,25 +221,21 @@ int main()
     case 'j':
      {
       float _p = getPositionP();     
-      sprintf(buffer, "%f\r\n", _p);
-      NU32_WriteUART3(buffer);
+      send_float(_p);
 
       float _i = getPositionI();
-      sprintf(buffer, "%f\r\n", _i);
-      NU32_WriteUART3(buffer);
+      send_float(_i);
 
       float _d = getPositionD();
-      sprintf(buffer, "%f\r\n", _d);
-      NU32_WriteUART3(buffer);
+      send_float(_d);
 
       break;
     }
     
     case 'k':
      {
+      begin_report(ITEST);
       set_mode(ITEST);
-      while (get_mode()==ITEST){;}
-      send_itest_data();
       break;
     }
 
@@ -199,19 +245,17 @@ int main()
       if (hold_count == 0){
         zero_encoder_count();
       }
-      int angle=0;
-      NU32_ReadUART3(buffer, BUF_SIZE);
-      sscanf(buffer, "%d", &angle);
-      setDesiredAngle(angle);
+      float angle=0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &angle);
+      setDesiredAngle(DEG_TO_Q16(angle));
       
-      int setAng = getDesiredAngle();
-      sprintf(buffer, "%d\r\n", setAng);
-      NU32_WriteUART3(buffer);
+      float setAng = Q16_TO_DEG(getDesiredAngle());
+      send_float(setAng);
       
       hold_count++;
+      begin_report(HOLD);
       set_mode(HOLD);
-      while (get_mode()==HOLD){;}
-      send_hold_data();
 
       break;
     }
@@ -239,9 +283,14 @@ int main()
 
     case 'o':
     {
+      if (get_mode() == TRACK)
+      {
+        NU32_LED2 = 0;      // turn on LED2 to flag the refusal, a run or the queue is going
+        break;
+      }
+      segqueue_Stop();      // track the uploaded array
+      begin_report(TRACK);
       set_mode(TRACK);
-      while (get_mode()==TRACK){;}
-      send_track_data();
       break;
     }
 
@@ -249,11 +298,11 @@ int main()
      {
       set_mode(IDLE);
       set_PWM(0);
+      report_pending = 0;   // an aborted run sends no data
 
       // Returning for confirmation
       int set_pwm = get_PWM();
-      sprintf(buffer, "%d\r\n", set_pwm);
-      NU32_WriteUART3(buffer);
+      send_int(set_pwm);
       break;
     }
 
@@ -269,12 +318,337 @@ int main()
       // handle q for quit. Later you may want to return to IDLE mode here.
       break;
     }
+
+    case 't':
+    {
+      send_latency(CMD_LINE);
+      send_latency(CMD_FRAME);
+      break;
+    }
+
+    case 'u':
+    {
+      // save the gains and the selected trajectory id to flash
+      int ok = (config_Save() == 0);
+      send_int(ok);
+      break;
+    }
+
+    case 'v':
+    {
+      // store the current trajectory in flash under an id and a name
+      int id = -1;
+      char name[CONFIG_NAME_LENGTH];
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &id);
+      cmdQueue_ReadLine(name, CONFIG_NAME_LENGTH);
+      int ok = (config_StoreTrajectory(id, name) == 0);
+      send_int(ok);
+      break;
+    }
+
+    case 'w':
+    {
+      // load a stored trajectory by id for the next TRACK
+      int id = -1;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &id);
+      int length = config_SelectTrajectory(id);
+      send_int(length);
+      break;
+    }
+
+    case 'x':
+    {
+      send_trajectory_list();
+      break;
+    }
+
+    case 'y':
+    {
+      // iterative learning control: enable, learning gain, Q-filter, lead
+      int enabled = 0, lead = 0;
+      float gain = 0, q = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &enabled);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &gain);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &q);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &lead);
+      setILC(enabled, gain, q, lead);
+
+      send_int(getILCEnabled());
+      send_float(getILCGain());
+      send_float(getILCQ());
+      send_int(getILCLead());
+      break;
+    }
+
+    case 'V':
+    {
+      // cascade: enable, velocity loop Hz, outer P, velocity P and I, velocity and current limits
+      int enabled = 0, rate = 0;
+      float outer = 0, p = 0, i = 0, vlimit = 0, climit = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &enabled);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &rate);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &outer);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &p);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &i);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &vlimit);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &climit);
+      setCascadeOuterGain(outer);
+      setVelocityGains(p, i);
+      setCascadeLimits(vlimit, climit);
+      setCascade(enabled, rate);   // left as it is while HOLD or TRACK runs
+
+      sprintf(buffer, "%d %d\r\n", getCascadeEnabled(), getVelocityRate());
+      NU32_WriteUART3(buffer);
+      send_float(getCascadeOuterGain());
+      sprintf(buffer, "%f %f\r\n", getVelocityP(), getVelocityI());
+      NU32_WriteUART3(buffer);
+      sprintf(buffer, "%f %f\r\n", getVelocityLimit(), getVelocityCurrentLimit());
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'F':
+    {
+      accept_filter();
+      break;
+    }
+
+    case 'B':
+    {
+      // CPU cycles for one sample through 0 to BIQUAD_MAX_SECTIONS sections,
+      // against the 16000 cycles of a 5 kHz period
+      for (int n = 0; n <= BIQUAD_MAX_SECTIONS; n++)
+      {
+        sprintf(buffer, "%d %u\r\n", n, biquad_Benchmark(n));
+        NU32_WriteUART3(buffer);
+      }
+      break;
+    }
+
+    case 'C':
+    {
+      // cogging calibration, sweeps from where the shaft is and ends in IDLE,
+      // replies with the seconds it takes or -1 if the motor is not IDLE
+      int start = countsToQ16(readEncoderCount());
+      float seconds = cogging_StartCalibration(start);
+      if (seconds > 0)
+      {
+        setDesiredAngle(start);
+        set_mode(HOLD);
+      }
+      send_float(seconds);
+      break;
+    }
+
+    case 'G':
+    {
+      // cogging compensation on or off, replies with enabled, calibrating,
+      // table valid, friction and the table's peak to peak in mA
+      int enabled = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &enabled);
+      setCoggingCompensation(enabled);
+      sprintf(buffer, "%d %d %d %f %f\r\n", getCoggingCompensation(), cogging_Calibrating(),
+              coggingTable.valid, getCoggingFriction(), getCoggingRipple());
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'S':
+    {
+      // HOLD setpoint shaping: enable, velocity, acceleration and jerk limits,
+      // a limit of 0 puts back its default
+      int enabled = 0;
+      float v = 0, a = 0, j = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &enabled);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &v);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &a);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%f", &j);
+      setScurve(enabled, v, a, j);
+
+      send_int(getScurveEnabled());
+      sprintf(buffer, "%f %f %f\r\n", getScurveVelocity(), getScurveAcceleration(), getScurveJerk());
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'Q':
+    {
+      accept_segment();
+      break;
+    }
+
+    case 'R':
+    {
+      // current and position loop rates in Hz, 0 0 only reports. Replies with
+      // whether they were taken, the rates in use, which are also the ITEST and
+      // HOLD/TRACK log rates, and the longest current and position ISR in us
+      int current_hz = 0, position_hz = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d %d", &current_hz, &position_hz);
+      int ok = ((current_hz == 0) && (position_hz == 0)) || (setLoopRates(current_hz, position_hz) == 0);
+      if (!ok)
+      {
+        NU32_LED2 = 0;      // turn on LED2 to flag the refused rates
+      }
+      unsigned int ticks_per_us = NU32_SYS_FREQ / 2 / 1000000;
+      sprintf(buffer, "%d %d %d %u %u\r\n", ok, getCurrentLoopRate(), getPositionLoopRate(),
+              looprate_MaxTicks(LOOP_CURRENT) / ticks_per_us, looprate_MaxTicks(LOOP_POSITION) / ticks_per_us);
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'O':
+    {
+      // overrun policies of the current and position loops (looprate.h, 0 count,
+      // 1 skip logging, 2 hold the last command, 3 halve the rate, 4 fault), -1
+      // keeps one, a third number 1 clears the counters. Replies with whether
+      // they were taken, the policies and rates in use, then for the current and
+      // the position loop its overruns, periods lost, furthest exit past a match
+      // in us and responses
+      int current_policy = -1, position_policy = -1, reset = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d %d %d", &current_policy, &position_policy, &reset);
+      int ok = (current_policy < 0) || (looprate_SetPolicy(LOOP_CURRENT, current_policy) == 0);
+      ok = ((position_policy < 0) || (looprate_SetPolicy(LOOP_POSITION, position_policy) == 0)) && ok;
+      if (!ok)
+      {
+        NU32_LED2 = 0;      // turn on LED2 to flag the refused policy
+      }
+      if (reset)
+      {
+        looprate_ResetOverruns();
+      }
+      struct overrun_stats_t c, p;
+      looprate_GetOverruns(LOOP_CURRENT, &c);
+      looprate_GetOverruns(LOOP_POSITION, &p);
+      unsigned int ticks_per_us = NU32_SYS_FREQ / 2 / 1000000;
+      sprintf(buffer, "%d %d %d %d %d %u %u %u %u %u %u %u %u\r\n", ok,
+              looprate_GetPolicy(LOOP_CURRENT), looprate_GetPolicy(LOOP_POSITION), getCurrentLoopRate(), getPositionLoopRate(),
+              c.overruns, c.lost, c.worst / ticks_per_us, c.responses, p.overruns, p.lost, p.worst / ticks_per_us, p.responses);
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'W':
+    {
+      // ITEST waveform: shape (0 square, 1 sine, 2 chirp), amplitude mA, period
+      // s, count, chirp end Hz and decimation on one line. Replies with whether
+      // it was taken, the waveform in use, the samples a run logs and the time
+      // between them in s
+      struct itest_params_t p;
+      getITest(&p);
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      int n = sscanf(buffer, "%d %f %f %d %f %d", &p.shape, &p.amplitude, &p.period, &p.count, &p.end_hz, &p.decimation);
+      int ok = (n == 6) && (setITest(&p) == 0);
+      if (!ok)
+      {
+        NU32_LED2 = 0;      // turn on LED2 to flag the refused waveform
+      }
+      getITest(&p);
+      sprintf(buffer, "%d %d %f %f %d %f %d %d %f\r\n", ok, p.shape, p.amplitude, p.period, p.count, p.end_hz,
+              p.decimation, itest_Samples(), itest_SamplePeriod());
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'T':
+    {
+      // timestamps on the HOLD and TRACK logs on or off, replies with enabled
+      int enabled = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &enabled);
+      setTimestamps(enabled);
+      send_int(getTimestamps());
+      break;
+    }
+
+    case 'E':
+    {
+      // event trace: the mask of trace.h events to record from now on, 0 to
+      // stop. Replies with the mask in use and the entries the ring holds
+      unsigned int mask = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%u", &mask);
+      trace_Start(mask);
+      sprintf(buffer, "%u %d\r\n", trace_Mask(), TRACE_LENGTH);
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'D':
+    {
+      // stop the trace and send what it holds, oldest first
+      trace_Dump();
+      break;
+    }
+
+    case 'Y':
+    {
+      // input recording for replay off the board: 1 starts one, only while
+      // IDLE, 0 stops it. Replies with whether it was taken, whether it is
+      // recording and the words used of those it has
+      int start = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);
+      sscanf(buffer, "%d", &start);
+      int ok = 1;
+      if (start)
+      {
+        ok = (record_Start() == 0);
+      }
+      else
+      {
+        record_Stop();
+      }
+      if (!ok)
+      {
+        NU32_LED2 = 0;      // turn on LED2 to flag the refused recording
+      }
+      sprintf(buffer, "%d %d %d %d\r\n", ok, record_Recording(), record_Used(), RECORD_LENGTH);
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
+    case 'X':
+    {
+      // stop the recording and send it, see record.h
+      record_Dump();
+      break;
+    }
+
+    case 'z':
+    {
+      // runs learned so far and the RMS error in degrees of the last one
+      sprintf(buffer, "%d %f\r\n", getILCIteration(), getILCError());
+      NU32_WriteUART3(buffer);
+      break;
+    }
+
     default:
     {
       NU32_LED2 = 0; // turn on LED2 to indicate an error
       break;
     }
     }
+    trace_Record(TRACE_COMMAND, TRACE_END, 0);
+    cmdQueue_CommandDone();             // account this command's latency
   }
   return 0;
 }
@@ -294,7 +668,7 @@ int request_encoder_position()
 
 void zero_encoder_count()
 {
-  WriteUART2("b");
+  encoder_Zero();
   set_encoder_flag(0);
 }
 
@@ -312,56 +686,232 @@ void request_mode_to_buffer()
       }
 }
 
-void send_itest_data()
+void begin_report(enum mode_t m)
 {
-  sprintf(buffer, "%d\n\r", NUM_DATA_POINTS);
-  NU32_WriteUART3(buffer);
+  report_mode = m;
+  report_abort_count = cmdQueue_GetAbortCount();
+  report_pending = 1;
+}
 
-  for (int i =0; i < NUM_DATA_POINTS; i++)
+void service_pending_report()
+{
+  if (!report_pending || (get_mode() == report_mode))
   {
-      sprintf(buffer, "%d %d\n\r",refCurrentArray[i], actCurrentArray[i]); 
-      NU32_WriteUART3(buffer);
-
+    return;
   }
-}
-
-void accept_trajectory()
-{  
-  NU32_ReadUART3(buffer, BUF_SIZE);
-  sscanf(buffer, "%d", &referenceTrajectoryLength);
-  
-  for (int i = 0; i < referenceTrajectoryLength; i++)
+  report_pending = 0;
+  if (cmdQueue_GetAbortCount() != report_abort_count)
   {
-    float val = 0;
-    NU32_ReadUART3(buffer, BUF_SIZE);
-    sscanf(buffer, "%f", &val);
-    referenceTrajectory[i] = val; 
+    return;               // stopped by an abort, not by finishing
   }
+  telemetry_Flush();
+  logDump_Start(report_mode);           // goes out by DMA from the next time round the loop
 }
 
-void send_track_data()
+void send_int(int v)
 {
-  
-  sprintf(buffer, "%d\n\r", referenceTrajectoryLength);
+  format_Str(format_Int(buffer, v), "\r\n");
+  NU32_WriteUART3(buffer);
+}
+
+// the characters sprintf's %f gives, without its soft double arithmetic
+void send_float(float v)
+{
+  format_Str(format_Float(buffer, v, 6), "\r\n");
+  NU32_WriteUART3(buffer);
+}
+
+// count, mean and max in microseconds, the core timer runs at half the system clock
+void send_latency(enum cmd_kind_t kind)
+{
+  struct cmd_latency_t l;
+  cmdQueue_GetLatency(kind, &l);
+  unsigned int ticks_per_us = NU32_SYS_FREQ / 2 / 1000000;
+  unsigned int mean = l.count ? (unsigned int)(l.total / l.count) : 0;
+  sprintf(buffer, "%u %u %u\r\n", l.count, mean / ticks_per_us, l.max / ticks_per_us);
   NU32_WriteUART3(buffer);
+}
 
-  for (int i =0; i < referenceTrajectoryLength; i++)
+void send_trajectory_list()
+{
+  char name[CONFIG_NAME_LENGTH];
+  format_Str(format_Int(buffer, NVM_TRAJ_SLOTS), "\n\r");
+  NU32_WriteUART3(buffer);
+
+  for (int id = 0; id < NVM_TRAJ_SLOTS; id++)
   {
-      sprintf(buffer, "%f %f\n\r", refPositionArray[i] ,actPositionArray[i]); 
+      int length = config_GetTrajectoryInfo(id, name);
+      sprintf(buffer, "%d %d %s\n\r", id, length, name);
       NU32_WriteUART3(buffer);
+  }
+}
 
+// point (0 current, 1 rate, 2 command), section count, then one line per section:
+// "b0 b1 b2 a1 a2" normalised to a0 = 1, or "lp <fc> <q>" / "notch <fc> <q>"
+// designed here at the point's sample rate, and again for the new rate if the
+// loop's rate changes. Replies with the sections in use.
+void accept_filter()
+{
+  struct biquad_spec_t specs[BIQUAD_MAX_SECTIONS];
+  int point = -1, sections = 0, bad = 0;
+  cmdQueue_ReadLine(buffer, BUF_SIZE);
+  sscanf(buffer, "%d", &point);
+  cmdQueue_ReadLine(buffer, BUF_SIZE);
+  sscanf(buffer, "%d", &sections);
+  bad = (point < 0) || (point >= BQ_POINTS) || (sections < 0) || (sections > BIQUAD_MAX_SECTIONS);
+
+  for (int i = 0; i < sections; i++)
+  {
+    struct biquad_spec_t * s = &specs[i];
+    s->fc = 0;
+    s->q = 0.707;
+    cmdQueue_ReadLine(buffer, BUF_SIZE);
+    if (bad)
+    {
+      continue;           // still read every line the host sends
+    }
+    if (sscanf(buffer, "lp %f %f", &s->fc, &s->q) >= 1)
+    {
+      s->kind = BQ_LOWPASS;
+    }
+    else if (sscanf(buffer, "notch %f %f", &s->fc, &s->q) >= 1)
+    {
+      s->kind = BQ_NOTCH;
+    }
+    else if (sscanf(buffer, "%f %f %f %f %f", &s->coeffs[0], &s->coeffs[1], &s->coeffs[2],
+                    &s->coeffs[3], &s->coeffs[4]) == 5)
+    {
+      s->kind = BQ_COEFFS;
+    }
+    else
+    {
+      bad = 1;
+    }
+  }
+  if (bad || biquad_LoadSpecs(point, sections, specs))
+  {
+    NU32_LED2 = 0;        // turn on LED2 to flag the rejected filter
+    send_int(-1);
+  }
+  else
+  {
+    send_int(biquad_GetSections(point));
   }
 }
 
-void send_hold_data()
+// One line naming the operation, then its arguments:
+//   s <n> <relative>   n samples in degrees follow, one per line
+//   m <angle> <seconds> cubic move from where the segment before ends
+//   d <seconds>        dwell
+//   g                  start TRACK on the queue, from IDLE or HOLD
+//   c                  clear, refused while the queue runs
+//   ?                  status only
+// Replies "<ok> <queued> <free segments> <free samples>" so the host can keep
+// appending while earlier segments run.
+void accept_segment()
 {
-  sprintf(buffer, "%d\n\r", MAX_REF_TRAJ_LENGTH);
-  NU32_WriteUART3(buffer);
+  char op = '?';
+  int ok = 1;
+  cmdQueue_ReadLine(buffer, BUF_SIZE);
+  sscanf(buffer, " %c", &op);
 
-  for (int i =0; i < MAX_REF_TRAJ_LENGTH; i++)
+  switch (op)
   {
-      sprintf(buffer, "%f %f\n\r", refPositionArray[i] ,actPositionArray[i]); 
-      NU32_WriteUART3(buffer);
+  case 's':
+  {
+    int n = 0, relative = 0;
+    sscanf(buffer, " %*c %d %d", &n, &relative);
+    ok = (segqueue_BeginSamples(n) == 0);
+    for (int i = 0; i < n; i++)
+    {
+      float val = 0;
+      cmdQueue_ReadLine(buffer, BUF_SIZE);   // every line the host sends is read
+      sscanf(buffer, "%f", &val);
+      segqueue_PutSample(DEG_TO_Q16(val));
+    }
+    ok = ok && (segqueue_EndSamples(relative) == 0);
+    break;
+  }
+  case 'm':
+  {
+    float angle = 0, seconds = 0;
+    ok = (sscanf(buffer, " %*c %f %f", &angle, &seconds) == 2) && (segqueue_AppendCubic(DEG_TO_Q16(angle), seconds) == 0);
+    break;
+  }
+  case 'd':
+  {
+    float seconds = 0;
+    ok = (sscanf(buffer, " %*c %f", &seconds) == 1) && (segqueue_AppendDwell(seconds) == 0);
+    break;
+  }
+  case 'g':
+  {
+    enum mode_t m = get_mode();
+    if ((m != IDLE) && (m != HOLD))
+    {
+      ok = segqueue_Running();    // already going, or busy with something else
+      break;
+    }
+    int from = (m == HOLD) ? getReferenceAngle() : countsToQ16(readEncoderCount());
+    ok = (segqueue_Start(from) > 0);
+    if (ok)
+    {
+      begin_report(TRACK);
+      set_mode(TRACK);
+    }
+    break;
+  }
+  case 'c':
+  {
+    ok = (segqueue_Clear() == 0);
+    break;
+  }
+  case '?':
+  {
+    break;
+  }
+  default:
+  {
+    ok = 0;
+    break;
+  }
+  }
+  if (!ok)
+  {
+    NU32_LED2 = 0;        // turn on LED2 to flag the refused segment
+  }
+  sprintf(buffer, "%d %d %d %d\r\n", ok, segqueue_Queued(), segqueue_FreeSegments(), segqueue_FreeSamples());
+  NU32_WriteUART3(buffer);
+}
 
+void accept_trajectory()
+{  
+  int length = 0;
+  int busy = (get_mode() == TRACK);   // the run is reading the array, the upload is refused
+  cmdQueue_ReadLine(buffer, BUF_SIZE);
+  sscanf(buffer, "%d", &length);
+  
+  // every line the host sends is read, samples past the end of the buffer are dropped
+  for (int i = 0; i < length; i++)
+  {
+    float val = 0;
+    cmdQueue_ReadLine(buffer, BUF_SIZE);
+    sscanf(buffer, "%f", &val);
+    if (!busy && (i < MAX_REF_TRAJ_LENGTH))
+    {
+      referenceTrajectory[i] = DEG_TO_Q16(val); 
+    }
+  }
+  if (busy)
+  {
+    NU32_LED2 = 0;  // turn on LED2 to flag the refused upload
+    return;
+  }
+  if (length > MAX_REF_TRAJ_LENGTH)
+  {
+    NU32_LED2 = 0;  // turn on LED2 to flag the truncation
+    length = MAX_REF_TRAJ_LENGTH;
   }
+  referenceTrajectoryLength = (length > 0) ? length : 0;
+  config_ForgetTrajectory();
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "nvm.h"
+#include <string.h>
+
+#define NVMOP_WORD_PGM 0x4001       // WREN with word program
+#define NVMOP_PAGE_ERASE 0x4004     // WREN with page erase
+#define NVMCON_WR 0x8000
+#define NVMCON_WREN 0x4000
+#define NVMCON_ERR 0x3000           // WRERR | LVDERR
+
+#define NVM_AREA_SIZE (NVM_PAGES * NVM_PAGE_SIZE)
+
+#ifdef NVM_RAM_EMULATION
+
+static unsigned char nvm_area[NVM_AREA_SIZE] __attribute__((aligned(4)));
+static int nvm_area_ready = 0;
+static int erase_counts[NVM_PAGES];
+static int words_left = -1;         // words programmed before the power goes, -1 while it stays
+
+static const unsigned char * area()
+{
+  if (!nvm_area_ready) {
+    memset(nvm_area, 0xFF, sizeof(nvm_area)); // comes up blank, like a fresh part
+    nvm_area_ready = 1;
+  }
+  return nvm_area;
+}
+
+static int erase(unsigned int offset)
+{
+  area();
+  if (words_left == 0) {
+    return 1;
+  }
+  erase_counts[offset / NVM_PAGE_SIZE]++;
+  memset(&nvm_area[offset], 0xFF, NVM_PAGE_SIZE);
+  return 0;
+}
+
+static int program_word(unsigned int offset, unsigned int word)
+{
+  unsigned int old;
+  area();
+  if (words_left == 0) {
+    return 1;                       // the power is gone, the word and all after it are left as they were
+  }
+  words_left = (words_left > 0) ? words_left - 1 : words_left;
+  memcpy(&old, &nvm_area[offset], 4);
+  old &= word;                      // programming can only clear bits
+  memcpy(&nvm_area[offset], &old, 4);
+  return (old == word) ? 0 : 1;     // the word was not blank enough, as flash would fail verify
+}
+
+int nvm_erase_count(int page)
+{
+  return ((page < 0) || (page >= NVM_PAGES)) ? 0 : erase_counts[page];
+}
+
+void nvm_cut_power(int words)
+{
+  words_left = words;
+}
+
+#else
+
+// Lives in program flash next to the code. It is part of the hex file, so loading
+// new firmware through the bootloader starts from a blank store.
+static const unsigned char nvm_area[NVM_AREA_SIZE] __attribute__((aligned(NVM_PAGE_SIZE))) =
+    { [0 ... NVM_AREA_SIZE - 1] = 0xFF };
+
+// The compiler knows the initializer, hide the pointer so reads are not folded to 0xFF
+static const unsigned char * area()
+{
+  const unsigned char * p = nvm_area;
+  __asm__ volatile ("" : "+r" (p));
+  return p;
+}
+
+// The CPU stalls while the flash it runs from is busy, so the control loops stop
+// for the length of an operation (about 20 ms for a page erase). Callers only
+// write while the motor is IDLE.
+static int nvm_operation(unsigned int op)
+{
+  unsigned int status = __builtin_disable_interrupts();
+
+  NVMCON = op;
+  // wait at least 6 us for the low voltage detect to settle
+  unsigned int start = _CP0_GET_COUNT();
+  while ((_CP0_GET_COUNT() - start) < (NU32_SYS_FREQ / 2 / 1000000) * 6) {
+    ;
+  }
+  NVMKEY = 0xAA996655;  // unlock sequence
+  NVMKEY = 0x556699AA;
+  NVMCONSET = NVMCON_WR;
+  while (NVMCON & NVMCON_WR) {
+    ;
+  }
+  NVMCONCLR = NVMCON_WREN;
+
+  if (status & 0x1) {
+    __builtin_enable_interrupts();
+  }
+  return (NVMCON & NVMCON_ERR) ? 1 : 0;
+}
+
+static int erase(unsigned int offset)
+{
+  NVMADDR = KVA_TO_PA(area() + offset);
+  return nvm_operation(NVMOP_PAGE_ERASE);
+}
+
+static int program_word(unsigned int offset, unsigned int word)
+{
+  NVMADDR = KVA_TO_PA(area() + offset);
+  NVMDATA = word;
+  return nvm_operation(NVMOP_WORD_PGM);
+}
+
+#endif // NVM_RAM_EMULATION
+
+const unsigned char * nvm_page(int page)
+{
+  return area() + page * NVM_PAGE_SIZE;
+}
+
+int nvm_erase_page(int page)
+{
+  if ((page < 0) || (page >= NVM_PAGES)) {
+    return 1;
+  }
+  return erase(page * NVM_PAGE_SIZE);
+}
+
+// Program length bytes, the last word is padded with 0xFF. May run on into the
+// following pages, which must already be erased.
+int nvm_write(int page, int offset, const void * data, int length)
+{
+  unsigned int start = page * NVM_PAGE_SIZE + offset;
+  const unsigned char * src = data;
+  if ((page < 0) || (offset & 3) || (length < 0) || (start + length > NVM_AREA_SIZE)) {
+    return 1;
+  }
+  for (int i = 0; i < length; i += 4) {
+    unsigned int word = 0xFFFFFFFF;
+    memcpy(&word, &src[i], (length - i < 4) ? (length - i) : 4);
+    if (word == 0xFFFFFFFF) {
+      continue;           // already erased, saves a program cycle
+    }
+    if (program_word(start + i, word)) {
+      return 1;
+    }
+  }
+  return 0;
+}
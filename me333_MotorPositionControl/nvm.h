@@ -0,0 +1,31 @@
+#ifndef NVM__H__
+#define NVM__H__
+
+#include <xc.h> // processor SFR definitions
+#include <sys/attribs.h> // __ISR macro
+
+#include "NU32.h"
+
+// A block of program flash set aside for stored settings, addressed by page.
+// Pages read like ordinary memory, they are only erased and programmed through here.
+// Build with -DNVM_RAM_EMULATION to back the pages with RAM that follows the flash
+// rules (erase sets all bits, programming can only clear them), so the store above
+// can be exercised without wearing or even having a board.
+
+#define NVM_PAGE_SIZE 4096          // PIC32MX795 erase page
+#define NVM_CONFIG_PAGES 2          // settings records rotate through these
+#define NVM_TRAJ_SLOTS 4            // stored trajectories
+#define NVM_TRAJ_SLOT_PAGES 2       // pages per stored trajectory
+#define NVM_COG_PAGE (NVM_CONFIG_PAGES + NVM_TRAJ_SLOTS * NVM_TRAJ_SLOT_PAGES)  // cogging table
+#define NVM_PAGES (NVM_COG_PAGE + 1)
+
+const unsigned char * nvm_page(int page);   // read pointer to the start of a page
+int nvm_erase_page(int page);               // 0 on success
+int nvm_write(int page, int offset, const void * data, int length); // offset word aligned, 0 on success
+
+#ifdef NVM_RAM_EMULATION
+int nvm_erase_count(int page);              // erases the page has had, for wear
+void nvm_cut_power(int words);              // erasing and programming fail after words more words, -1 restores
+#endif
+
+#endif // NVM__H__
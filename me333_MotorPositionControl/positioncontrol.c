@@ -1,18 +1,35 @@
 #include "positioncontrol.h"
 #include "currentcontrol.h"
+#include "ilc.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "cogging.h"
+#include "scurve.h"
+#include "segqueue.h"
+#include "looprate.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "hotpath.h"
+#include "record.h"
 #include <stdio.h>
 
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static int hold_count = 0;
+static int track_idx = 0;
+
 /*************************
  * HELPER FUNCTIONS
 *************************/
 
 void zero_encoder_count()
 {
-  WriteUART2("b");
+  encoder_Zero();
   set_encoder_flag(0);
 }
 
-int request_encoder_position()
+HOT int request_encoder_position()
 {
   WriteUART2("a"); // asking for position
   while (!get_encoder_flag()){;}
@@ -21,12 +38,89 @@ int request_encoder_position()
   return pos;
 }
 
+// This tick's count into encCount. In cascade the velocity loop owns UART2 and
+// has the latest count, there is none until its first reply is in.
+static HOT int latch_encoder()
+{
+    if (getCascadeEnabled())
+    {
+        long long c;
+        if (!velocityControl_GetCount(&c))
+        {
+            return 0;
+        }
+        encCount = c;
+    }
+    else
+    {
+        request_encoder_position();
+        encCount = get_encoder_count64();
+    }
+    latchTime = _CP0_GET_COUNT();
+    encRevCount = get_encoder_rev_count();
+    return 1;
+}
+
+// With timestamps on, each logged sample gets the time its count was latched
+// and the time its current command reached the PWM. The second is only known
+// a tick later, so a tick first finishes the sample logged before it, then
+// arms the stamp for its own command. Called right before the current command
+// is set, or right after the velocity command in cascade. idx is -1 for a tick
+// that is not logged, a run starts at idx 0 and drops what the last one left.
+static HOT void stamp_sample(int idx)
+{
+    static int waiting = -1;
+    if (!timestamps_enabled)
+    {
+        return;
+    }
+    unsigned int t;
+    if ((waiting >= 0) && (idx != 0) && currentControl_AppliedAt(&t))
+    {
+        applyTimeArray[waiting] = t;
+    }
+    if ((idx >= 0) && looprate_SkipLog(LOOP_POSITION))
+    {
+        latchTimeArray[idx] = applyTimeArray[idx] = 0;     // left out after an overrun
+        idx = -1;
+    }
+    waiting = idx;
+    if (idx >= 0)
+    {
+        latchTimeArray[idx] = latchTime;
+        applyTimeArray[idx] = 0;
+        currentControl_ArmStamp();
+    }
+}
+
+// A record of this tick for the host, once the command is out
+static HOT void sample_telemetry()
+{
+    if (!telemetry_Due())
+    {
+        return;
+    }
+    if (looprate_SkipLog(LOOP_POSITION))
+    {
+        telemetry_Drop();
+        return;
+    }
+    union telemetry_word_t values[TLM_SIGNALS];
+    values[TLM_ANGLE].i = curr_angle;
+    values[TLM_ANGLE_ERROR].f = angle_error;
+    values[TLM_COMMAND].f = getDesiredCurrent();
+    values[TLM_CURRENT].f = readCurrent();
+    values[TLM_PWM].i = get_PWM();
+    values[TLM_ERROR_SUM].f = getCurrentErrorSum();
+    telemetry_Put(values);
+}
+
 void positionControl_Startup()
 {
     // setup 200 HZ interrupt on Timer 4 for position control
 
     T4CONbits.TCKPS = 0b110; // Timer4 prescaler N=64 (1:64)
-    PR4 = 6249;              // period = (PR2+1) * N * 12.5 ns = 5 ms, 200 Hz
+    PR4 = TIMER4_HZ / position_rate - 1;    // period = (PR4+1) * N * 12.5 ns = 5 ms, 200 Hz by default
     TMR4 = 0;                // initialize TMR4 count to 0
     T4CONbits.TGATE = 0;     // gated accumualtion mode disabled
     IPC4 = 20;               // priority level 5
@@ -62,20 +156,124 @@ float getPositionD()
 
 void setDesiredAngle(int angle)
 {
-    prev_angle = 0;
+    long long count = readEncoderCount();   // in HOLD the latest count, no request
+    record_Angle(angle, count);
+    if (getScurveEnabled())
+    {
+        // the reference carries on from where it is, so the loop sees no step
+        if (get_mode() != HOLD)
+        {
+            int start = countsToQ16(count);
+            scurve_Start(start);
+            desired_angle = prev_angle = start;
+            angle_error_sum = 0;
+        }
+        scurve_SetTarget(angle);
+        return;
+    }
+    prev_angle = countsToQ16(count);    // no D kick from wherever the axis is
     desired_angle = angle;
     angle_error_sum = 0;    
 }
 
+// The HOLD setpoint, with shaping the target the reference is heading for
 int getDesiredAngle()
+{
+    return getScurveEnabled() ? scurve_GetTarget() : desired_angle;
+}
+
+// The count scaled to Q48 degrees and cut back to Q16. Only bits 16 to 47 of
+// the product are kept, and those are exact even when the 64 bit product
+// overflows, so any count lands on its angle modulo 2^32.
+int countsToQ16(long long count)
+{
+    return (int)(((unsigned long long)count * Q32_DEG_PER_COUNT) >> 16);
+}
+
+// Only while IDLE, the next period is the first at the new rate
+void setPositionLoopRate(int hz)
+{
+    position_rate = hz;
+    position_dt = 1.0f / hz;
+    angle_error_sum_scale = (float)POSITION_RATE_DEFAULT / hz;
+    PR4 = TIMER4_HZ / hz - 1;
+    TMR4 = 0;
+}
+
+int getPositionLoopRate()
+{
+    return position_rate;
+}
+
+float getPositionDT()
+{
+    return position_dt;
+}
+
+void setTimestamps(int enabled)
+{
+    timestamps_enabled = enabled ? 1 : 0;
+}
+
+int getTimestamps()
+{
+    return timestamps_enabled;
+}
+
+// The reference the loop is following this tick, shaped or queued
+int getReferenceAngle()
 {
     return desired_angle;
 }
 
+// Live encoder read, or the latest count while the position loop owns UART2
+long long readEncoderCount()
+{
+    enum mode_t m = get_mode();
+    if ((m == HOLD) || (m == TRACK))
+    {
+        return encCount;
+    }
+    request_encoder_position();
+    return get_encoder_count64();
+}
+
+void positionControl_GetState(struct position_state_t * s)
+{
+    s->desired_angle = desired_angle;
+    s->prev_angle = prev_angle;
+    s->angle_error_sum = angle_error_sum;
+    s->hold_count = hold_count;
+    s->track_idx = track_idx;
+}
+
+// From set_mode, whenever TRACK starts or ends. An aborted run, or a switch from
+// the segment queue, would otherwise leave the index past a shorter trajectory.
+void positionControl_RestartTrack()
+{
+    track_idx = 0;
+}
+
+// From set_mode, whenever HOLD starts. A HOLD aborted part way would otherwise
+// have the next one log from where it stopped and end short.
+void positionControl_RestartHold()
+{
+    hold_count = 0;
+}
+
+void positionControl_SetState(const struct position_state_t * s)
+{
+    desired_angle = s->desired_angle;
+    prev_angle = s->prev_angle;
+    angle_error_sum = s->angle_error_sum;
+    hold_count = s->hold_count;
+    track_idx = s->track_idx;
+}
+
 /*************************
  * INTERRUPT SERVICE ROUTINES
 *************************/
-void __ISR(_TIMER_4_VECTOR, IPL5SOFT) PositionController(void) // _TIMER_4_VECTOR = 16
+static HOT void position_tick()
 {
 
     // // Test - toggle LED2
@@ -83,68 +281,161 @@ void __ISR(_TIMER_4_VECTOR, IPL5SOFT) PositionController(void) // _TIMER_4_VECTO
 
     // Position Control
 
-    if (get_mode() == HOLD)
+    enum mode_t m = get_mode();
+    if (((m == HOLD) || (m == TRACK)) && looprate_HoldCommand(LOOP_POSITION))
     {
-        static int hold_count = 0;
-        encCount = request_encoder_position();
-
-        curr_angle = 360.0/(334*4) * encCount;
-        angle_error = desired_angle - curr_angle;
-        angle_error_sum += angle_error;
-        angle_rate = (prev_angle - curr_angle)/DT;
-        // angle_rate = (curr_angle - prev_angle)/DT;
+        return;     // the last call overran, the current loop keeps the last command
+    }
+    if (m == HOLD)
+    {
+        if (!latch_encoder())
+        {
+            return;
+        }
+        int sweeping = cogging_Sweeping();
+        if (sweeping)
+        {
+            desired_angle = cogging_CalibrationStep(encRevCount, getDesiredCurrent());
+        }
+        else if (getScurveEnabled())
+        {
+            desired_angle = scurve_Tick();
+        }
+
+        curr_angle = countsToQ16(encCount);
+        angle_error = Q16_TO_DEG(Q16_DIFF(desired_angle, curr_angle));
+        angle_error_sum += angle_error * angle_error_sum_scale;
+        angle_rate = biquad_Filter(BQ_RATE, Q16_TO_DEG(Q16_DIFF(prev_angle, curr_angle))/position_dt);
+        // angle_rate = (curr_angle - prev_angle)/position_dt;
         // angle_rate = (curr_angle - prev_angle);
         prev_angle = curr_angle;
 
         angle_error_sum = angle_error_sum > ANGLE_ERROR_SUM_MAX ? ANGLE_ERROR_SUM_MAX : angle_error_sum;
         angle_error_sum = angle_error_sum < -ANGLE_ERROR_SUM_MAX ? -ANGLE_ERROR_SUM_MAX : angle_error_sum;
         
-        dCurrent = P_position_control * angle_error + I_position_control * angle_error_sum + D_position_control * angle_rate;
-        setDesiredCurrent(dCurrent);
+        if (getCascadeEnabled())
+        {
+            velocityControl_SetCommand(getCascadeOuterGain() * angle_error, cogging_Feedforward(encRevCount, 0));
+            stamp_sample(sweeping ? -1 : hold_count);
+        }
+        else
+        {
+            dCurrent = P_position_control * angle_error + I_position_control * angle_error_sum + D_position_control * angle_rate;
+            dCurrent = biquad_Filter(BQ_COMMAND, dCurrent) + cogging_Feedforward(encRevCount, 0);
+            stamp_sample(sweeping ? -1 : hold_count);
+            setDesiredCurrent(dCurrent);
+        }
+        sample_telemetry();
+
+        if (sweeping)
+        {
+            // a calibration outlasts the HOLD log, it ends the HOLD itself
+            if (!cogging_Sweeping())
+            {
+                set_mode(IDLE);
+            }
+            return;
+        }
  
-        actPositionArray[hold_count] = curr_angle;
-        refPositionArray[hold_count] = desired_angle;  //  ##############
+        runLogAct[hold_count] = curr_angle;
+        runLogRef[hold_count] = desired_angle;  //  ##############
         
         hold_count++;
 
-        if (hold_count == (MAX_REF_TRAJ_LENGTH-1))
+        if (hold_count == (RUNLOG_LENGTH-1))
         {
             set_mode(IDLE);
             hold_count = 0;
         }
 
     }
-    else if (get_mode() == TRACK)
+    else if (m == TRACK)
     {
         
-        static int track_idx = 0;
-        desired_angle = referenceTrajectory[track_idx];
-        encCount = request_encoder_position();
+        if (!latch_encoder())
+        {
+            return;
+        }
+        // this sample and the next, from the segment queue or the uploaded array
+        int queued = segqueue_Running();
+        int next;
+        if (queued)
+        {
+            desired_angle = segqueue_Reference(&next);
+        }
+        else
+        {
+            desired_angle = referenceTrajectory[track_idx];
+            next = (track_idx + 1 < referenceTrajectoryLength) ? referenceTrajectory[track_idx + 1] : desired_angle;
+        }
 
-        curr_angle = 360.0/(334*4) * encCount;
-        angle_error = desired_angle - curr_angle;
-        angle_error_sum += angle_error;
-        angle_rate = (prev_angle - curr_angle)/DT;
+        curr_angle = countsToQ16(encCount);
+        angle_error = Q16_TO_DEG(Q16_DIFF(desired_angle, curr_angle));
+        angle_error_sum += angle_error * angle_error_sum_scale;
+        angle_rate = biquad_Filter(BQ_RATE, Q16_TO_DEG(Q16_DIFF(prev_angle, curr_angle))/position_dt);
 
         prev_angle = curr_angle;
 
         angle_error_sum = angle_error_sum > ANGLE_ERROR_SUM_MAX ? ANGLE_ERROR_SUM_MAX : angle_error_sum;
         angle_error_sum = angle_error_sum < -ANGLE_ERROR_SUM_MAX ? -ANGLE_ERROR_SUM_MAX : angle_error_sum;
         
-        dCurrent = P_position_control * angle_error + I_position_control * angle_error_sum + D_position_control * angle_rate;
-        setDesiredCurrent(dCurrent);
+        // the slope of the trajectory is the velocity feedforward in cascade, and
+        // picks the direction friction is compensated in. Queued runs have no
+        // fixed length for learning to line up against.
+        float slope = Q16_TO_DEG(Q16_DIFF(next, desired_angle)) / position_dt;
+        float feedforward = (queued ? 0 : ilc_Feedforward(track_idx)) + cogging_Feedforward(encRevCount, slope);
+        if (getCascadeEnabled())
+        {
+            velocityControl_SetCommand(getCascadeOuterGain() * angle_error + slope, feedforward);
+            stamp_sample((track_idx < RUNLOG_LENGTH) ? track_idx : -1);
+        }
+        else
+        {
+            dCurrent = P_position_control * angle_error + I_position_control * angle_error_sum + D_position_control * angle_rate;
+            dCurrent = biquad_Filter(BQ_COMMAND, dCurrent) + feedforward;
+            stamp_sample((track_idx < RUNLOG_LENGTH) ? track_idx : -1);
+            setDesiredCurrent(dCurrent);
+        }
+        sample_telemetry();
 
-        actPositionArray[track_idx] = curr_angle;
-        refPositionArray[track_idx] = desired_angle;
+        // a queued run can outlast the log, it keeps the first RUNLOG_LENGTH samples
+        if (track_idx < RUNLOG_LENGTH)
+        {
+            runLogAct[track_idx] = curr_angle;
+            runLogRef[track_idx] = desired_angle;
+            runLogLength = track_idx + 1;
+        }
+        if (!queued)
+        {
+            ilc_Learn(track_idx, angle_error);
+        }
 
         track_idx++;
 
-        if (track_idx == referenceTrajectoryLength){
-            set_mode(HOLD);
-            track_idx = 0;
-
+        if (queued ? !segqueue_Advance() : (track_idx >= referenceTrajectoryLength)){
+            if (!queued)
+            {
+                ilc_RunDone(track_idx);
+            }
+            set_mode(HOLD);                 // track_idx back to 0
+            scurve_Start(desired_angle);    // hold the last sample, shaped or not
         }
     }
+    else
+    {
+        telemetry_Close();      // the run has ended, its last records go out
+    }
+}
 
+void __ISR(_TIMER_4_VECTOR, IPL5SOFT) PositionController(void) // _TIMER_4_VECTOR = 16
+{
+    unsigned int start = _CP0_GET_COUNT();
+    unsigned int count = TMR4;      // how late this call is
+    trace_Record(TRACE_POSITION_ISR, TRACE_BEGIN, get_mode());
+    record_Enter();
+    position_tick();
+    record_LeavePosition(encCount);
+    looprate_Record(LOOP_POSITION, _CP0_GET_COUNT() - start, count);
+    trace_Record(TRACE_POSITION_ISR, TRACE_END, get_mode());
     IFS0bits.T4IF = 0; // clear interrupt flag
 }
\ No newline at end of file
@@ -10,16 +10,43 @@
 #include "utilities.h"
 #include "encoder.h"
 #include "currentcontrol.h"
+#include "runlog.h"
 
 /*************************
  * CONSTANTS
 *************************/
 
 #define ANGLE_ERROR_SUM_MAX 10
-#define DT 0.005
+#define POSITION_RATE_DEFAULT 200  // Hz, the rate the position gains are tuned at
+#define TIMER4_HZ (NU32_SYS_FREQ / 64)
 #define MAX_REF_TRAJ_LENGTH 2000
 #define PBUFF_SIZE 200
 
+// Setpoints, trajectories and the position logs are Q16.16 degrees, so sub-degree
+// moves are not cut down to whole degrees on the way to the controller.
+//
+// The encoder count is 64 bit and its Q16 angle is taken modulo 2^32, which
+// wraps every 65536 degrees. Angles are only ever compared through Q16_DIFF
+// and moved through Q16_ADD, which are exact across the wrap, so the loops
+// work the same however many turns the axis has made. Absolute degrees are
+// only meaningful within +-32768 of zero, the host commands and logs stay there.
+#define Q16_ONE 65536
+#define DEG_TO_Q16(d) ((int)((d) * (float)Q16_ONE + (((d) < 0) ? -0.5f : 0.5f)))
+#define Q16_TO_DEG(q) ((q) / (float)Q16_ONE)
+#define Q16_DIFF(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)))     // a - b
+#define Q16_ADD(a, b) ((int)((unsigned int)(a) + (unsigned int)(b)))      // a + b
+#define Q32_DEG_PER_COUNT 1157326517LL  // 360/COUNTS_PER_REV degrees in Q32
+
+// The loop's state between ticks, for record.c to start a recording from and
+// for a replay to restore
+struct position_state_t {
+    int desired_angle;          // Q16 degrees
+    int prev_angle;             // Q16 degrees
+    float angle_error_sum;
+    int hold_count;             // HOLD and TRACK log indices
+    int track_idx;
+};
+
 /*************************
  * PRIVATE GLOBAL VARIABLES
 *************************/
@@ -27,13 +54,19 @@ static volatile float P_position_control = 30.0;
 static volatile float I_position_control = 5;
 static volatile float D_position_control = 8.0;
 
-static volatile int desired_angle = 0;
+static volatile int desired_angle = 0;        // Q16 degrees
 static volatile float angle_error_sum = 0;
-static volatile float prev_angle = 0;
+static volatile int position_rate = POSITION_RATE_DEFAULT;
+static volatile float position_dt = 1.0 / POSITION_RATE_DEFAULT;
+static volatile float angle_error_sum_scale = 1.0;  // keeps I meaning the same at any rate
+static volatile int prev_angle = 0;           // Q16 degrees
 static char pbuffer[PBUFF_SIZE];
 
-static volatile int encCount;
-static volatile float curr_angle;
+static volatile long long encCount;
+static volatile int encRevCount;              // encCount within the revolution
+static volatile unsigned int latchTime;       // core timer, when encCount was latched
+static volatile int timestamps_enabled = 0;
+static volatile int curr_angle;               // Q16 degrees
 static volatile float angle_error;
 static volatile float angle_rate;
 static volatile float dCurrent;
@@ -41,10 +74,10 @@ static volatile float dCurrent;
 /*************************
  * PUBLIC GLOBAL VARIABLES
 *************************/
-float referenceTrajectory[MAX_REF_TRAJ_LENGTH];
+int referenceTrajectory[MAX_REF_TRAJ_LENGTH];  // Q16 degrees
 volatile int referenceTrajectoryLength;
-float actPositionArray[MAX_REF_TRAJ_LENGTH];
-float refPositionArray[MAX_REF_TRAJ_LENGTH];
+unsigned int latchTimeArray[RUNLOG_LENGTH];    // core timer, with timestamps on, alongside the run log
+unsigned int applyTimeArray[RUNLOG_LENGTH];    // core timer, 0 if the command never reached the PWM
 
 
 
@@ -59,8 +92,20 @@ float getPositionP();
 float getPositionI();
 float getPositionD();
 
-void setDesiredAngle(int angle);
+void setDesiredAngle(int angle);    // Q16 degrees
 int getDesiredAngle();
+int getReferenceAngle();            // Q16 degrees
+void setPositionLoopRate(int hz);
+int getPositionLoopRate();
+float getPositionDT();
+void setTimestamps(int enabled);
+int getTimestamps();
+int countsToQ16(long long count);
+long long readEncoderCount();
+void positionControl_GetState(struct position_state_t * s);
+void positionControl_SetState(const struct position_state_t * s);     // only while IDLE
+void positionControl_RestartTrack();    // set_mode's, the next TRACK runs from sample 0
+void positionControl_RestartHold();     // set_mode's, the next HOLD logs from sample 0
 
 
 
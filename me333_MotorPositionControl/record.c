@@ -0,0 +1,244 @@
+#include "record.h"
+#include "hotpath.h"
+#include "uartdma.h"
+#include "format.h"
+#include "currentcontrol.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "cogging.h"
+#include "scurve.h"
+#include "segqueue.h"
+#include "ilc.h"
+#include <string.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static struct record_header_t header;
+static unsigned int words[RECORD_LENGTH];
+static volatile unsigned int head = 0;          // words claimed, may run past the end once full
+static volatile unsigned int end = RECORD_LENGTH;   // where the first claim that did not fit started
+static volatile int recording = 0;
+static volatile int depth = 0;                  // control ISRs running, nested
+static volatile int reading = 0;                // the INA219 reading of the tick running, RECORD_READING set
+
+// the dump, a line of counts then one line a word
+static int count = 0;
+static int next = -1;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// n words at once, 0 when they do not fit, which ends the recording
+static HOT unsigned int * claim(int n)
+{
+    unsigned int at = __sync_fetch_and_add(&head, n);
+    if (at + n > RECORD_LENGTH)
+    {
+        recording = 0;
+        if (at < end)
+        {
+            end = at;
+        }
+        return 0;
+    }
+    return &words[at];
+}
+
+static HOT void put_count(enum record_type_t type, long long count)
+{
+    unsigned int * w = claim(3);
+    if (w)
+    {
+        w[0] = type << 28;
+        w[1] = (unsigned int)count;
+        w[2] = (unsigned int)((unsigned long long)count >> 32);
+    }
+}
+
+int record_Start()
+{
+    if (get_mode() != IDLE)
+    {
+        return 1;
+    }
+    recording = 0;
+    memset(&header, 0, sizeof(header));
+    header.version = RECORD_VERSION;
+    header.features = (getILCEnabled() ? RECORD_ILC : 0) | (getCoggingCompensation() ? RECORD_COGGING : 0)
+                      | (getScurveEnabled() ? RECORD_SCURVE : 0) | (getCascadeEnabled() ? RECORD_CASCADE : 0)
+                      | ((segqueue_Queued() > 0) ? RECORD_QUEUE : 0);
+    for (int p = 0; p < BQ_POINTS; p++)
+    {
+        header.features |= (biquad_GetSections(p) > 0) ? RECORD_FILTERS : 0;
+    }
+    header.current_hz = getCurrentLoopRate();
+    header.position_hz = getPositionLoopRate();
+    header.current_p = getCurrentP();
+    header.current_i = getCurrentI();
+    header.position_p = getPositionP();
+    header.position_i = getPositionI();
+    header.position_d = getPositionD();
+    header.desired_current = getDesiredCurrent();
+    positionControl_GetState(&header.position);
+    getITest(&header.itest);
+    header.trajectory_length = referenceTrajectoryLength;
+
+    // From the main loop, no control ISR is part way through
+    head = 0;
+    end = RECORD_LENGTH;
+    depth = 0;
+    reading = 0;
+    recording = 1;
+    return 0;
+}
+
+void record_Stop()
+{
+    recording = 0;
+}
+
+int record_Recording()
+{
+    return recording;
+}
+
+int record_Used()
+{
+    return (head < end) ? head : end;
+}
+
+HOT void record_Enter()
+{
+    if (recording)
+    {
+        depth++;
+    }
+}
+
+HOT void record_LeaveCurrent()
+{
+    if (recording)
+    {
+        unsigned int * w = claim(1);
+        if (w)
+        {
+            *w = (RECORD_TICK << 28) | reading;
+        }
+        reading = 0;
+        depth--;
+    }
+}
+
+HOT void record_LeavePosition(long long count)
+{
+    if (recording)
+    {
+        put_count(RECORD_POSITION, count);
+        depth--;
+    }
+}
+
+// Only the current loop's reading is an input, the main loop's are for display
+HOT void record_Current(short raw)
+{
+    if (recording && (depth > 0))
+    {
+        reading = RECORD_READING | (unsigned short)raw;
+    }
+}
+
+void record_Mode(enum mode_t from, enum mode_t to)
+{
+    if (recording && (depth == 0))
+    {
+        unsigned int * w = claim(1);
+        if (w)
+        {
+            *w = (RECORD_MODE << 28) | (from << 8) | to;
+        }
+    }
+}
+
+void record_Angle(int angle, long long count)
+{
+    if (recording && (depth == 0))
+    {
+        unsigned int * w = claim(4);
+        if (w)
+        {
+            w[0] = RECORD_ANGLE << 28;
+            w[1] = angle;
+            w[2] = (unsigned int)count;
+            w[3] = (unsigned int)((unsigned long long)count >> 32);
+        }
+    }
+}
+
+HOT void record_PWM(int pwm)
+{
+    if (recording && (depth == 0))
+    {
+        unsigned int * w = claim(1);
+        if (w)
+        {
+            *w = (RECORD_PWM << 28) | (pwm & 0xFFFFFF);
+        }
+    }
+}
+
+// header, trajectory, recording
+static unsigned int dump_word(int i)
+{
+    if (i < RECORD_HEADER_WORDS)
+    {
+        unsigned int w;
+        memcpy(&w, (const unsigned char *)&header + 4 * i, 4);
+        return w;
+    }
+    i -= RECORD_HEADER_WORDS;
+    if (i < header.trajectory_length)
+    {
+        return referenceTrajectory[i];
+    }
+    return words[i - header.trajectory_length];
+}
+
+static int format_line(char * line)
+{
+    if (next >= count)
+    {
+        return 0;
+    }
+    char * p = line;
+    if (next < 0)
+    {
+        p = format_Int(p, RECORD_HEADER_WORDS);
+        *p++ = ' ';
+        p = format_Int(p, header.trajectory_length);
+        *p++ = ' ';
+        p = format_Int(p, count - RECORD_HEADER_WORDS - header.trajectory_length);
+    }
+    else
+    {
+        p = format_Uint(p, dump_word(next));
+    }
+    p = format_Str(p, "\n\r");
+    next++;
+    return p - line;
+}
+
+int record_Dump()
+{
+    if (uartDma_Busy())
+    {
+        return 1;
+    }
+    recording = 0;
+    count = RECORD_HEADER_WORDS + header.trajectory_length + record_Used();
+    next = -1;
+    return uartDma_StartLines(format_line, 0);
+}
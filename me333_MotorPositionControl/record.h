@@ -0,0 +1,107 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "itest.h"
+#include "positioncontrol.h"
+
+// Recording of every input the control loops take, for replaying a run off the
+// board (sim/replay.c), through the same CurrentController and PositionController.
+//
+// A recording starts while IDLE with a header of the settings and loop state
+// the run starts from, then appends words to a RECORD_LENGTH buffer until it is
+// stopped or full:
+//   - each current loop tick, with the INA219 reading it used if it read one
+//   - each position loop tick, with the encoder count it latched
+//   - the commands that change what the loops do, from the main loop or the
+//     host's abort: mode changes, setDesiredAngle with the count it read, and
+//     set_PWM. Those the loops make themselves, a HOLD ending say, are left out,
+//     the replay makes them again.
+// A tick is recorded as its ISR leaves, so the ticks that preempted a position
+// tick come before it, as their commands were not yet changed by it.
+//
+// Words start with the type in the top 4 bits; a position tick has two more,
+// the count's low and high word, a setpoint three, the angle then the count.
+//
+// The settings the header has no room for are flagged in features. ILC,
+// cogging compensation, filters, shaping, the cascade and the segment queue
+// keep state of their own, a replay of a run with any of them on is not exact.
+//
+// record_Dump() sends the recording by UART3's DMA as a line of the three
+// counts, then the header, the reference trajectory and the recording a word a
+// line, unsigned decimal.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define RECORD_LENGTH 4096      // words
+#define RECORD_VERSION 1
+
+enum record_type_t {
+    RECORD_TICK,                // bit 16 set if the tick read the INA219, the raw reading in the low 16
+    RECORD_POSITION,            // count low, count high
+    RECORD_MODE,                // the old mode << 8 | the new one
+    RECORD_ANGLE,               // angle, count low, count high
+    RECORD_PWM                  // the duty in the low 24 bits, signed
+};
+
+#define RECORD_TYPE(w) ((w) >> 28)
+#define RECORD_READING 0x10000
+
+// features
+#define RECORD_ILC 0x1
+#define RECORD_COGGING 0x2
+#define RECORD_FILTERS 0x4
+#define RECORD_SCURVE 0x8
+#define RECORD_CASCADE 0x10
+#define RECORD_QUEUE 0x20
+
+struct record_header_t {
+    unsigned int version;
+    unsigned int features;
+    int current_hz;
+    int position_hz;
+    float current_p;
+    float current_i;
+    float position_p;
+    float position_i;
+    float position_d;
+    float desired_current;
+    struct position_state_t position;
+    struct itest_params_t itest;
+    int trajectory_length;
+};
+
+#define RECORD_HEADER_WORDS (sizeof(struct record_header_t) / 4)
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int record_Start();                 // 0 on success, only while IDLE
+void record_Stop();
+int record_Recording();
+int record_Used();                  // words recorded
+int record_Dump();                  // stops the recording, 0 on success, 1 while UART3 is busy
+
+// control ISR side
+void record_Enter();
+void record_LeaveCurrent();
+void record_LeavePosition(long long count);
+void record_Current(short raw);     // from the INA219 driver
+
+// command side, ignored from inside the control ISRs
+void record_Mode(enum mode_t from, enum mode_t to);
+void record_Angle(int angle, long long count);
+void record_PWM(int pwm);
+
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef RUNLOG_H_
+#define RUNLOG_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "utilities.h"
+
+// The log every ITEST, HOLD and TRACK run fills, a reference and an actual
+// value per sample. ITEST logs mA, HOLD and TRACK log Q16 degrees. There is one
+// log, a run overwrites what the last one left, so read it out in between.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define RUNLOG_LENGTH 2000
+
+
+/*************************
+ * PUBLIC GLOBAL VARIABLES
+*************************/
+int runLogRef[RUNLOG_LENGTH];
+int runLogAct[RUNLOG_LENGTH];
+volatile int runLogLength;      // samples logged by the last ITEST or TRACK run
+
+
+#endif
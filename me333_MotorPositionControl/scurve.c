@@ -0,0 +1,181 @@
+#include "scurve.h"
+#include "hotpath.h"
+#include <math.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static volatile int shaping_enabled = 0;
+static volatile float velocity_limit = SCURVE_VELOCITY;
+static volatile float acceleration_limit = SCURVE_ACCELERATION;
+static volatile float jerk_limit = SCURVE_JERK;
+
+static volatile int target = 0;             // Q16 degrees
+static volatile int pending_target = 0;
+static volatile int pending = 0;            // a new target waits for the next tick
+
+static float offset = 0;        // degrees, the reference relative to target
+static float velocity = 0;      // deg/s
+static float acceleration = 0;  // deg/s^2
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static HOT float clamp(float v, float limit)
+{
+    v = (v > limit) ? limit : v;
+    v = (v < -limit) ? -limit : v;
+    return v;
+}
+
+// Advance position, velocity and acceleration through t seconds of constant jerk
+static HOT void segment(float * p, float * v, float * a, float j, float t)
+{
+    *p += *v * t + *a * t * t / 2 + j * t * t * t / 6;
+    *v += *a * t + j * t * t / 2;
+    *a += j * t;
+}
+
+// Distance covered bringing v to zero as fast as the acceleration and jerk
+// limits allow: acceleration down to -peak, held, and back up to zero
+static HOT float stopping_distance(float v, float a)
+{
+    const float j = jerk_limit;
+    float p = 0;
+    if ((v <= 0) && (a <= 0))
+    {
+        return 0;
+    }
+    if ((a < 0) && (v <= a * a / (2 * j)))
+    {
+        // easing the deceleration off already stops it
+        segment(&p, &v, &a, j, (-a - sqrtf(a * a - 2 * j * v)) / j);
+        return p;
+    }
+    float peak_sq = j * v + a * a / 2;
+    if (peak_sq <= 0)
+    {
+        return 0;   // moving away, and it never gets going forward again
+    }
+    float peak = sqrtf(peak_sq);
+    float hold = 0;
+    if (peak > acceleration_limit)
+    {
+        peak = acceleration_limit;
+        hold = (v + a * a / (2 * j) - peak * peak / j) / peak;
+    }
+    segment(&p, &v, &a, -j, (a + peak) / j);
+    segment(&p, &v, &a, 0, hold);
+    segment(&p, &v, &a, j, peak / j);
+    return p;
+}
+
+void setScurve(int enabled, float velocity, float acceleration, float jerk)
+{
+    velocity_limit = (velocity > 0) ? velocity : SCURVE_VELOCITY;
+    acceleration_limit = (acceleration > 0) ? acceleration : SCURVE_ACCELERATION;
+    jerk_limit = (jerk > 0) ? jerk : SCURVE_JERK;
+    if (get_mode() != HOLD)
+    {
+        shaping_enabled = enabled ? 1 : 0;  // a running HOLD keeps the reference it has
+    }
+}
+
+int getScurveEnabled()
+{
+    return shaping_enabled;
+}
+
+float getScurveVelocity()
+{
+    return velocity_limit;
+}
+
+float getScurveAcceleration()
+{
+    return acceleration_limit;
+}
+
+float getScurveJerk()
+{
+    return jerk_limit;
+}
+
+void scurve_Start(int position)
+{
+    pending = 0;
+    target = position;
+    offset = velocity = acceleration = 0;
+}
+
+void scurve_SetTarget(int t)
+{
+    pending_target = t;
+    pending = 1;
+}
+
+int scurve_GetTarget()
+{
+    return pending ? pending_target : target;
+}
+
+int scurve_Moving()
+{
+    return pending || (offset != 0) || (velocity != 0) || (acceleration != 0);
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT int scurve_Tick()
+{
+    if (pending)
+    {
+        offset += Q16_TO_DEG(Q16_DIFF(target, pending_target));
+        target = pending_target;
+        pending = 0;
+    }
+    if (!scurve_Moving())
+    {
+        return target;
+    }
+
+    // mirror so the target lies ahead
+    float s = ((offset < 0) || ((offset == 0) && (velocity < 0))) ? 1 : -1;
+    float ahead = -s * offset;
+    float v = s * velocity, a = s * acceleration;
+    const float jerks[3] = {jerk_limit, 0, -jerk_limit};
+    const float dt = getPositionDT();
+    float p1 = 0, v1 = 0, a1 = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+        a1 = clamp(a + jerks[k] * dt, acceleration_limit);
+        p1 = 0;
+        v1 = v;
+        float a0 = a;
+        segment(&p1, &v1, &a0, (a1 - a) / dt, dt);
+        float peak = v1 + a1 * fabsf(a1) / (2 * jerk_limit);
+        if ((peak <= velocity_limit) && (p1 + stopping_distance(v1, a1) <= ahead))
+        {
+            break;  // the first, and fastest, that can still stop in time
+        }
+    }
+
+    offset += s * p1;
+    velocity = s * v1;
+    acceleration = s * a1;
+
+    // within a tick of rest at the target, land on it
+    float slow = jerk_limit * dt * dt;
+    if ((fabsf(offset) < slow * dt) && (fabsf(velocity) < slow) && (fabsf(acceleration) < jerk_limit * dt))
+    {
+        offset = velocity = acceleration = 0;
+    }
+    return Q16_ADD(target, DEG_TO_Q16(offset));
+}
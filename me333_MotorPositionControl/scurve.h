@@ -0,0 +1,56 @@
+#ifndef SCURVE_H_
+#define SCURVE_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "positioncontrol.h"
+
+// Jerk-limited setpoint shaping for HOLD.
+//
+// With shaping on, a new HOLD setpoint becomes the target of an online planner
+// instead of a step. Every position tick the planner moves the reference by one
+// step of a jerk-limited profile, bounded by the velocity, acceleration and jerk
+// limits, and the loop follows the reference. A target that changes while the
+// reference is still moving is picked up from the current velocity and
+// acceleration.
+//
+// Each tick is O(1). It tries, in turn, raising the acceleration, holding it and
+// lowering it, and keeps the first whose closed-form jerk-limited stopping
+// distance still ends at or short of the target and which can still level off
+// under the velocity limit. Close to the target, once the reference has all but
+// stopped, it lands on the target exactly.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define SCURVE_VELOCITY 360.0           // deg/s
+#define SCURVE_ACCELERATION 3000.0      // deg/s^2
+#define SCURVE_JERK 30000.0             // deg/s^3
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+void setScurve(int enabled, float velocity, float acceleration, float jerk);  // enabled only changes outside HOLD
+int getScurveEnabled();
+float getScurveVelocity();
+float getScurveAcceleration();
+float getScurveJerk();
+
+void scurve_Start(int position);    // at rest at position, Q16 degrees, only while HOLD is not running
+void scurve_SetTarget(int target);  // Q16 degrees, picked up on the next tick
+int scurve_GetTarget();
+int scurve_Moving();
+
+// Called from the HOLD branch of the Timer4 ISR, returns the reference for this tick
+int scurve_Tick();
+
+
+#endif
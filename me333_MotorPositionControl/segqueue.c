@@ -0,0 +1,242 @@
+#include "segqueue.h"
+#include "hotpath.h"
+
+
+/*************************
+ * PRIVATE TYPES AND GLOBAL VARIABLES
+*************************/
+struct segment_t {
+    enum segment_kind_t kind;
+    int length;             // position loop ticks
+    unsigned int first;     // sample segments, pool index of the first sample
+    int to;                 // SEG_CUBIC, Q16 degrees
+};
+
+static struct segment_t segments[SEG_QUEUE_LENGTH];
+static int pool[SEG_POOL_LENGTH];
+
+// Free running counters, the ISR moves the heads and the main loop the tails
+static volatile unsigned int seg_head = 0, seg_tail = 0;
+static volatile unsigned int pool_head = 0, pool_tail = 0;
+static volatile int running = 0;
+
+static int staged_length = 0;   // main loop, the sample segment being put together
+static int staged_count = 0;
+
+static int seg_tick = 0;        // ISR, tick within the head segment
+static int seg_from = 0;        // ISR, reference the head segment starts at
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// The compiler must not sink the segment stores past the tail that publishes them
+#define PUBLISH_BARRIER() __asm__ volatile ("" ::: "memory")
+
+static int ticks(float seconds)
+{
+    int n = (int)(seconds / getPositionDT() + 0.5);
+    return (n < 1) ? 1 : n;
+}
+
+static HOT struct segment_t * segment(unsigned int index)
+{
+    return &segments[index % SEG_QUEUE_LENGTH];
+}
+
+static HOT int sample(const struct segment_t * s, int i, int from)
+{
+    switch (s->kind)
+    {
+    case SEG_SAMPLES:
+        return pool[(s->first + i) % SEG_POOL_LENGTH];
+    case SEG_RELATIVE_SAMPLES:
+        return Q16_ADD(from, pool[(s->first + i) % SEG_POOL_LENGTH]);
+    case SEG_CUBIC:
+    {
+        float u = (float)(i + 1) / s->length;     // lands on to at the last tick
+        return Q16_ADD(from, (int)((float)Q16_DIFF(s->to, from) * (3 * u * u - 2 * u * u * u)));
+    }
+    default:
+        return from;
+    }
+}
+
+static int queue_full()
+{
+    return (seg_tail - seg_head) >= SEG_QUEUE_LENGTH;
+}
+
+int segqueue_BeginSamples(int length)
+{
+    if (queue_full() || (length <= 0) || (length > segqueue_FreeSamples()))
+    {
+        staged_length = 0;
+        return 1;
+    }
+    staged_length = length;
+    staged_count = 0;
+    return 0;
+}
+
+void segqueue_PutSample(int s)
+{
+    if (staged_count < staged_length)
+    {
+        pool[(pool_tail + staged_count) % SEG_POOL_LENGTH] = s;
+        staged_count++;
+    }
+}
+
+int segqueue_EndSamples(int relative)
+{
+    if ((staged_length == 0) || (staged_count != staged_length))
+    {
+        staged_length = 0;
+        return 1;
+    }
+    struct segment_t * s = segment(seg_tail);
+    s->kind = relative ? SEG_RELATIVE_SAMPLES : SEG_SAMPLES;
+    s->length = staged_length;
+    s->first = pool_tail;
+    s->to = 0;
+    PUBLISH_BARRIER();
+    pool_tail += staged_length;
+    seg_tail++;
+    staged_length = 0;
+    return 0;
+}
+
+int segqueue_AppendCubic(int to, float seconds)
+{
+    if (queue_full())
+    {
+        return 1;
+    }
+    struct segment_t * s = segment(seg_tail);
+    s->kind = SEG_CUBIC;
+    s->length = ticks(seconds);
+    s->first = 0;
+    s->to = to;
+    PUBLISH_BARRIER();
+    seg_tail++;
+    return 0;
+}
+
+int segqueue_AppendDwell(float seconds)
+{
+    if (queue_full())
+    {
+        return 1;
+    }
+    struct segment_t * s = segment(seg_tail);
+    s->kind = SEG_DWELL;
+    s->length = ticks(seconds);
+    s->first = 0;
+    s->to = 0;
+    PUBLISH_BARRIER();
+    seg_tail++;
+    return 0;
+}
+
+int segqueue_Clear()
+{
+    if (running)
+    {
+        return 1;
+    }
+    seg_head = seg_tail = 0;
+    pool_head = pool_tail = 0;
+    staged_length = 0;
+    seg_tick = 0;
+    return 0;
+}
+
+int segqueue_Start(int from)
+{
+    if (running)
+    {
+        return segqueue_Queued();
+    }
+    if (seg_tail == seg_head)
+    {
+        return -1;
+    }
+    seg_from = from;
+    seg_tick = 0;
+    running = 1;
+    return segqueue_Queued();
+}
+
+void segqueue_Stop()
+{
+    running = 0;
+    seg_tick = 0;   // a segment cut short starts over
+}
+
+int segqueue_Running()
+{
+    return running;
+}
+
+int segqueue_Queued()
+{
+    return seg_tail - seg_head;
+}
+
+int segqueue_FreeSegments()
+{
+    return SEG_QUEUE_LENGTH - segqueue_Queued();
+}
+
+int segqueue_FreeSamples()
+{
+    return SEG_POOL_LENGTH - (pool_tail - pool_head);
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT int segqueue_Reference(int * next)
+{
+    const struct segment_t * s = segment(seg_head);
+    int ref = sample(s, seg_tick, seg_from);
+    if (seg_tick + 1 < s->length)
+    {
+        *next = sample(s, seg_tick + 1, seg_from);
+    }
+    else if (seg_tail - seg_head > 1)
+    {
+        *next = sample(segment(seg_head + 1), 0, sample(s, s->length - 1, seg_from));
+    }
+    else
+    {
+        *next = ref;
+    }
+    return ref;
+}
+
+HOT int segqueue_Advance()
+{
+    const struct segment_t * s = segment(seg_head);
+    if (++seg_tick < s->length)
+    {
+        return 1;
+    }
+    seg_from = sample(s, s->length - 1, seg_from);
+    if ((s->kind == SEG_SAMPLES) || (s->kind == SEG_RELATIVE_SAMPLES))
+    {
+        pool_head += s->length;
+    }
+    seg_tick = 0;
+    seg_head++;
+    if (seg_head == seg_tail)
+    {
+        running = 0;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,70 @@
+#ifndef SEGQUEUE_H_
+#define SEGQUEUE_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "positioncontrol.h"
+
+// Queue of trajectory segments for TRACK, played back to back.
+//
+// A segment is either a run of samples or a parametric profile: a cubic move
+// to an angle or a dwell, each over a number of position loop ticks. Parametric
+// segments start where the segment before them ended. Samples are absolute
+// angles, or offsets from where the segment before ended.
+//
+// Started with the queue, TRACK takes its reference from the head segment, and
+// when that one ends the next starts on the same tick. The loop state carries
+// straight on. Segments can be appended while earlier ones are running. A run
+// that catches up with the end of the queue drops into HOLD at the last
+// reference, as TRACK does at the end of an array.
+//
+// The main loop appends and the Timer4 ISR consumes, each through its own end of
+// the segment ring and of the sample pool, so neither side needs the other to
+// stop. A new segment is published only once its samples are all in place.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define SEG_QUEUE_LENGTH 16         // segments
+#define SEG_POOL_LENGTH 2000        // samples shared by the queued sample segments
+
+enum segment_kind_t {
+    SEG_SAMPLES,
+    SEG_RELATIVE_SAMPLES,
+    SEG_CUBIC,
+    SEG_DWELL
+};
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+// Main loop side, each returns 0 on success and 1 when the queue or pool is full
+int segqueue_BeginSamples(int length);          // reserve room, then put length samples
+void segqueue_PutSample(int sample);            // Q16 degrees
+int segqueue_EndSamples(int relative);          // publish the samples as one segment
+int segqueue_AppendCubic(int to, float seconds);    // to in Q16 degrees
+int segqueue_AppendDwell(float seconds);
+int segqueue_Clear();                           // refused while the queue is running
+
+int segqueue_Start(int from);   // the reference the first segment starts at, returns the segments queued or -1
+void segqueue_Stop();           // TRACK goes back to the array, the queued segments stay
+int segqueue_Running();
+int segqueue_Queued();          // segments not yet finished
+int segqueue_FreeSegments();
+int segqueue_FreeSamples();
+
+// Timer4 ISR side in TRACK. Reference gives this tick's sample and the one after
+// it, Advance steps on and returns 0 once the queue has run dry.
+int segqueue_Reference(int * next);
+int segqueue_Advance();
+
+
+#endif
@@ -0,0 +1,194 @@
+// format.c against the host printf, and the time each takes for a dump line.
+//
+// usage: ./formatcheck          every Q16 angle within +-1000 degrees as the dump writes it,
+//                               ints around zero and at the ends, and random floats, Q16
+//                               numbers and ints at every precision
+//        ./formatcheck all      every one of the 2^32 Q16 angles instead, a few minutes
+//        ./formatcheck bench    ns per HOLD dump line, sprintf against format.c
+//
+// The host printf rounds exactly, an exact half to even, as format.c does. The
+// board's libc is not checked here.
+
+#include "format.h"
+#include "positioncontrol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long long checked = 0, failed = 0;
+
+static void compare(const char * expected, const char * got, const char * what)
+{
+    checked++;
+    if (strcmp(expected, got) != 0)
+    {
+        if (failed++ < 20)
+        {
+            printf("%s: printf \"%s\" format \"%s\"\n", what, expected, got);
+        }
+    }
+}
+
+static unsigned int next_random()
+{
+    static unsigned long long state = 0x9E3779B97F4A7C15ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (unsigned int)state;
+}
+
+static void check_int(int v)
+{
+    char a[64], b[64];
+    sprintf(a, "%d", v);
+    format_Int(b, v);
+    compare(a, b, "int");
+    sprintf(a, "%u", (unsigned int)v);
+    format_Uint(b, v);
+    compare(a, b, "uint");
+}
+
+static void check_int64(long long v)
+{
+    char a[64], b[64];
+    sprintf(a, "%lld", v);
+    format_Int64(b, v);
+    compare(a, b, "int64");
+}
+
+static void check_float(float v, int decimals)
+{
+    char a[128], b[128];
+    snprintf(a, sizeof(a), "%.*f", decimals, v);
+    format_Float(b, v, decimals);
+    compare(a, b, "float");
+}
+
+static void check_q16(int q, int decimals)
+{
+    char a[128], b[128];
+    sprintf(a, "%.*f", decimals, q / 65536.0);
+    format_Q16(b, q, decimals);
+    compare(a, b, "q16");
+}
+
+// The dump's own pair, Q16_TO_DEG rounds to float first
+static void check_angle(int q)
+{
+    char a[64], b[64];
+    sprintf(a, "%f", Q16_TO_DEG(q));
+    format_Float(b, Q16_TO_DEG(q), 6);
+    compare(a, b, "angle");
+}
+
+static double seconds_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void bench()
+{
+    const int n = 2000000;
+    char line[64];
+    unsigned int sum = 0;
+    double start = seconds_now();
+    for (int i = 0; i < n; i++)
+    {
+        int q = (int)next_random() >> 8;
+        sum += sprintf(line, "%f %f\n\r", Q16_TO_DEG(q), Q16_TO_DEG(q + 1234));
+    }
+    double libc = (seconds_now() - start) / n * 1e9;
+    start = seconds_now();
+    for (int i = 0; i < n; i++)
+    {
+        int q = (int)next_random() >> 8;
+        char * p = format_Float(line, Q16_TO_DEG(q), 6);
+        *p++ = ' ';
+        p = format_Float(p, Q16_TO_DEG(q + 1234), 6);
+        p = format_Str(p, "\n\r");
+        sum += p - line;
+    }
+    double fmt = (seconds_now() - start) / n * 1e9;
+    printf("ns per dump line: sprintf %.1f  format %.1f  (%u bytes)\n", libc, fmt, sum);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * mode = (argc > 1) ? argv[1] : "";
+    if (strcmp(mode, "bench") == 0)
+    {
+        bench();
+        return 0;
+    }
+
+    if (strcmp(mode, "all") == 0)
+    {
+        unsigned int q = 0;
+        do
+        {
+            check_angle((int)q);
+        } while (++q != 0);
+    }
+    else
+    {
+        for (int q = DEG_TO_Q16(-1000); q <= DEG_TO_Q16(1000); q++)
+        {
+            check_angle(q);
+        }
+    }
+    printf("angles: %lld checked, %lld failed\n", checked, failed);
+
+    for (int v = -1000000; v <= 1000000; v++)
+    {
+        check_int(v);
+    }
+    const long long ends[] = {0x7FFFFFFFll, -0x7FFFFFFFll - 1, 0xFFFFFFFFll, 0x100000000ll, 999999999, 1000000000,
+                              0x7FFFFFFFFFFFFFFFll, -0x7FFFFFFFFFFFFFFFll - 1, 4294967295999999999ll / 2};
+    for (int i = 0; i < sizeof(ends) / sizeof(ends[0]); i++)
+    {
+        check_int((int)ends[i]);
+        check_int64(ends[i]);
+        check_int64(-ends[i]);
+    }
+    for (int i = 0; i < 4000000; i++)
+    {
+        unsigned int r = next_random();
+        long long wide = ((long long)next_random() << 32) | next_random();
+        check_int((int)r);
+        check_int64(wide >> (r & 63));
+    }
+    printf("ints: %lld checked, %lld failed\n", checked, failed);
+
+    // every float bit pattern below 2^63 is fair game, and the specials
+    const float specials[] = {0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -0.5f, 0.25f, 0.125f, 0.0078125f, 1e-6f, 5e-7f,
+                              0.9999996f, 9.9999995f, 1.0f / 0.0f, -1.0f / 0.0f, 0.0f / 0.0f, 1e-45f, 3e38f / 1e20f};
+    for (int i = 0; i < sizeof(specials) / sizeof(specials[0]); i++)
+    {
+        for (int d = 0; d <= FORMAT_DECIMALS_MAX; d++)
+        {
+            check_float(specials[i], d);
+        }
+    }
+    for (int i = 0; i < 20000000; i++)
+    {
+        union {
+            unsigned int u;
+            float f;
+        } bits = {next_random()};
+        if (((bits.u >> 23) & 0xFF) >= 127 + 63)
+        {
+            bits.u &= 0x807FFFFF | ((127 + 62u) << 23);
+        }
+        check_float(bits.f, i % (FORMAT_DECIMALS_MAX + 1));
+    }
+    for (int i = 0; i < 10000000; i++)
+    {
+        check_q16((int)next_random(), i % (FORMAT_DECIMALS_MAX + 1));
+    }
+    printf("all: %lld checked, %lld failed\n", checked, failed);
+    return failed != 0;
+}
@@ -0,0 +1,7 @@
+#ifndef SIM_ATTRIBS_H
+#define SIM_ATTRIBS_H
+
+// The ISRs become ordinary functions the simulator calls by name
+#define __ISR(vector, ipl)
+
+#endif // SIM_ATTRIBS_H
@@ -0,0 +1,65 @@
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+// Host stand-in for the xc32 <xc.h>. Every SFR is a plain variable defined in
+// sfr.c, and every *bits register shares one bitfield layout, only the field
+// names the firmware uses matter here. The plant reads OC1RS and LATDbits.LATD8
+// to drive the motor, everything else is just storage. DMA channel 0 is the
+// exception, sfr.c moves its cells into a UART3 capture at the line rate.
+//
+// UART3's data registers are byte streams in sfr.c, for the emulator's pty:
+// each use of U3TXREG queues the byte written to it, each read of U3RXREG
+// takes the oldest byte received, URXDA and UTXBF follow the FIFOs.
+
+#include <stdint.h>
+
+typedef struct {
+    unsigned ON:1, TCKPS:3, TGATE:1;                            // timers
+    unsigned OCM:3, OCTSEL:1;                                   // output compare
+    unsigned T2IF:1, T2IE:1, T4IF:1, T4IE:1;                    // IFS0/IEC0
+    unsigned U2RXIF:1, U2RXIE:1, U3RXIF:1, U3RXIE:1;            // IFS1/IEC1
+    unsigned U3TXIF:1, U3TXIE:1, U3EIF:1;
+    unsigned U2IP:3, U2IS:2, U3IP:3, U3IS:2;                    // IPCx
+    unsigned UTXBF:1, URXDA:1, TRMT:1, OERR:1, UTXISEL:2, URXISEL:2;  // UxSTA
+    unsigned DMA0IF:1, DMA0IE:1, DMA0IP:3, DMA0IS:2;            // IFS1/IEC1/IPC9
+    unsigned CHEN:1, CHPRI:2, CHSIRQ:8, SIRQEN:1, CFORCE:1;     // DMACON, DCH0CON/ECON
+    unsigned CHBCIE:1, CHBCIF:1;                                // DCH0INT
+    unsigned LATD8:1, TRISD8:1, LATF0:1, LATF1:1, RD7:1;        // ports
+} sfr_bits_t;
+
+extern volatile unsigned int T2CON, PR2, TMR2, IPC2, PR3, TMR3, OC1RS, OC1R, PR4, TMR4, IPC4;
+extern volatile unsigned int U2TXREG, U2RXREG;
+extern volatile sfr_bits_t T2CONbits, T3CONbits, T4CONbits, OC1CONbits;
+extern volatile sfr_bits_t IFS0bits, IEC0bits, IFS1bits, IEC1bits, IPC7bits, IPC8bits, IPC9bits;
+extern volatile sfr_bits_t DMACONbits, DCH0CONbits, DCH0ECONbits, DCH0INTbits;
+extern volatile uintptr_t DCH0SSA, DCH0DSA;     // wide enough for a host address
+extern volatile unsigned int DCH0SSIZ, DCH0DSIZ, DCH0CSIZ;
+extern volatile sfr_bits_t U2STAbits, U3STAbits;
+extern volatile sfr_bits_t LATDbits, TRISDbits, LATFbits, PORTDbits;
+
+volatile unsigned int * sfr_Uart3Tx(void);
+unsigned int sfr_Uart3Rx(void);
+#define U3TXREG (*sfr_Uart3Tx())
+#define U3RXREG (sfr_Uart3Rx())
+
+// The simulator calls the ISRs in turn, the emulator from a signal handler,
+// which these hold off as the board holds off interrupts
+unsigned int sfr_DisableInterrupts(void);
+void sfr_EnableInterrupts(void);
+#define __builtin_disable_interrupts() sfr_DisableInterrupts()
+#define __builtin_enable_interrupts() sfr_EnableInterrupts()
+
+// Core timer, counts at half the system clock of simulated time
+unsigned int _CP0_GET_COUNT(void);
+
+#define _TIMER_2_VECTOR 8
+#define _TIMER_4_VECTOR 16
+#define _UART_2_VECTOR 32
+#define _UART_3_VECTOR 31
+#define _DMA_0_VECTOR 36
+#define _UART3_TX_IRQ 41
+
+// Physical addresses are the host addresses themselves
+#define KVA_TO_PA(v) ((uintptr_t)(v))
+
+#endif // SIM_XC_H
@@ -0,0 +1,408 @@
+// Control performance regression benchmark: a fixed set of runs through the
+// firmware against the motor model, written as JSON so that two commits can be
+// compared with ../host/benchcmp.py.
+//
+// usage: ./nu32bench [label] > bench.json      (make bench, labelled with the commit)
+//
+// Each run reports
+//   rms_error_deg, max_error_deg   the reference less the logged angle, over the samples the run judges
+//   settling_s                     from the step, the load or the end of the move until the axis
+//                                  stays within 2% of it, null if it never does
+//   overshoot_deg                  past the target in the direction of the move, null for a load
+//   peak_current_ma                the motor model's winding current, not the INA219 reading
+// and, for each ISR sim_Tick calls, the host's time a call, the instructions a
+// call where perf counters are allowed (null where not), and the deepest its
+// stack went, painted on a stack of its own. These are host figures, to compare
+// commits by, not the board's cycles or bytes.
+
+#include "sim.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_VERSION 1
+#define BENCH_STACK (64 * 1024)     // bytes, each ISR's own
+#define BENCH_SAMPLES (1 << 20)     // call times kept for the percentiles
+#define PAINT 0xA5
+
+struct isr_bench_t {
+    const char * name;
+    ucontext_t context;
+    unsigned char stack[BENCH_STACK];
+    void (*handler)(void);
+    int calls;
+    unsigned int ns[BENCH_SAMPLES];
+    long long instructions;
+    long long instructions_max;
+};
+
+struct result_t {
+    double rms_error;
+    double max_error;
+    double settling;
+    double overshoot;
+    double peak_current;
+};
+
+// Where the axis has to settle, from tick from on
+struct settle_t {
+    float target;
+    float band;
+    int from;
+    int last_out;           // the last tick outside the band
+    float direction;        // of the move, 0 for none
+    float overshoot;
+};
+
+static struct isr_bench_t isrs[SIM_ISRS] = {{"current"}, {"position"}, {"dma"}};
+static ucontext_t caller;
+static struct isr_bench_t * running = 0;
+static int counter_fd = -1;
+static int stack_base = 0;          // bytes isr_loop takes before the handler's
+static unsigned char * probe_sp = 0;
+static double peak_current = 0;
+
+
+/*************************
+ * ISR MEASUREMENT
+*************************/
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void open_counter()
+{
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.type = PERF_TYPE_HARDWARE;
+    a.size = sizeof(a);
+    a.config = PERF_COUNT_HW_INSTRUCTIONS;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    counter_fd = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static long long instructions()
+{
+    long long n = 0;
+    if ((counter_fd < 0) || (read(counter_fd, &n, sizeof(n)) != sizeof(n)))
+    {
+        return 0;
+    }
+    return n;
+}
+
+// Runs on the ISR's own stack, a call each time it is switched to
+static void isr_loop()
+{
+    for (;;)
+    {
+        struct isr_bench_t * b = running;
+        long long i0 = instructions();
+        long long t0 = now_ns();
+        b->handler();
+        long long t1 = now_ns();
+        long long di = instructions() - i0;
+        if (b->calls < BENCH_SAMPLES)
+        {
+            b->ns[b->calls] = (unsigned int)(t1 - t0);
+        }
+        b->calls++;
+        b->instructions += di;
+        b->instructions_max = (di > b->instructions_max) ? di : b->instructions_max;
+        swapcontext(&b->context, &caller);
+    }
+}
+
+static void bench_runner(enum sim_isr_t isr, void (*handler)(void))
+{
+    running = &isrs[isr];
+    running->handler = handler;
+    swapcontext(&caller, &running->context);
+}
+
+static void bench_reset()
+{
+    for (int k = 0; k < SIM_ISRS; k++)
+    {
+        struct isr_bench_t * b = &isrs[k];
+        memset(b->stack, PAINT, BENCH_STACK);
+        b->calls = 0;
+        b->instructions = b->instructions_max = 0;
+        getcontext(&b->context);
+        b->context.uc_stack.ss_sp = b->stack;
+        b->context.uc_stack.ss_size = BENCH_STACK;
+        b->context.uc_link = 0;
+        makecontext(&b->context, isr_loop, 0);
+    }
+    peak_current = 0;
+}
+
+static int stack_used(const struct isr_bench_t * b)
+{
+    int i = 0;
+    while ((i < BENCH_STACK) && (b->stack[i] == PAINT))
+    {
+        i++;
+    }
+    return BENCH_STACK - i;
+}
+
+// where a handler's stack starts, past isr_loop's frame
+static void probe()
+{
+    probe_sp = (unsigned char *)__builtin_frame_address(0) + 2 * sizeof(void *);
+}
+
+static int compare_ns(const void * a, const void * b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*************************
+ * RUNS
+*************************/
+
+static void tick()
+{
+    sim_Tick();
+    double c = fabs(plant_Current());
+    peak_current = (c > peak_current) ? c : peak_current;
+}
+
+static void settle_Update(struct settle_t * s, int tick)
+{
+    if (tick < s->from)
+    {
+        return;
+    }
+    float e = plant_Angle() - s->target;
+    s->last_out = (fabsf(e) > s->band) ? tick : s->last_out;
+    s->overshoot = (e * s->direction > s->overshoot) ? e * s->direction : s->overshoot;
+}
+
+static void settle_Result(const struct settle_t * s, int ticks, struct result_t * r)
+{
+    r->settling = (s->last_out == ticks - 1) ? NAN : (double)(s->last_out + 1 - s->from) / getCurrentLoopRate();
+    r->overshoot = (s->direction != 0) ? s->overshoot : NAN;
+}
+
+// log samples [from, to)
+static void log_error(int from, int to, struct result_t * r)
+{
+    double sum = 0;
+    r->max_error = 0;
+    for (int i = from; i < to; i++)
+    {
+        double e = fabs(Q16_TO_DEG(runLogRef[i] - runLogAct[i]));
+        sum += e * e;
+        r->max_error = (e > r->max_error) ? e : r->max_error;
+    }
+    r->rms_error = sqrt(sum / (to - from));
+}
+
+// 45 degree HOLD step, judged over the whole HOLD log
+static void run_step(double noise_ma, struct result_t * r)
+{
+    struct settle_t s = {45, 0.02 * 45, 0, -1, 1, 0};
+    plant_SetCurrentNoise(noise_ma);
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    int ticks = 0;
+    while ((get_mode() == HOLD) && (ticks < 20 * SIM_TICK_HZ))
+    {
+        tick();
+        settle_Update(&s, ticks++);
+    }
+    log_error(0, RUNLOG_LENGTH, r);
+    settle_Result(&s, ticks, r);
+}
+
+static void run_step_clean(struct result_t * r)
+{
+    run_step(0, r);
+}
+
+static void run_step_noise(struct result_t * r)
+{
+    run_step(20, r);
+}
+
+// 90 degrees out and back in a second each, settling judged from the end of
+// the way back
+static void run_track(int quintic, double noise_ma, double load, struct result_t * r)
+{
+    int (*move)(int *, int, float, float, float) = quintic ? sim_Quintic : sim_Cubic;
+    int n = move(referenceTrajectory, 0, 0, 90, 1.0);
+    n = sim_Hold(referenceTrajectory, n, 90, 0.5);
+    n = move(referenceTrajectory, n, 90, 0, 1.0);
+    struct settle_t s = {0, 0.02 * 90, n * SIM_POSITION_DIVIDER, n * SIM_POSITION_DIVIDER - 1, -1, 0};
+    n = sim_Hold(referenceTrajectory, n, 0, 1.0);
+    referenceTrajectoryLength = n;
+    plant_SetCurrentNoise(noise_ma);
+    plant_SetLoad(load);
+    set_mode(TRACK);
+    int ticks = 0;
+    while ((get_mode() == TRACK) && (ticks < 20 * SIM_TICK_HZ))
+    {
+        tick();
+        settle_Update(&s, ticks++);
+    }
+    log_error(0, n, r);
+    settle_Result(&s, ticks, r);
+}
+
+static void run_cubic(struct result_t * r)
+{
+    run_track(0, 0, 0, r);
+}
+
+static void run_quintic(struct result_t * r)
+{
+    run_track(1, 0, 0, r);
+}
+
+static void run_track_noise(struct result_t * r)
+{
+    run_track(0, 20, 0, r);
+}
+
+static void run_track_load(struct result_t * r)
+{
+    run_track(0, 0, 0.03, r);
+}
+
+// A sixth of the stall torque put on a second into a 45 degree HOLD, judged
+// from there on
+static void run_load_step(struct result_t * r)
+{
+    const int at = SIM_TICK_HZ;
+    struct settle_t s = {45, 0.02 * 45, at, at - 1, 0, 0};
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    int ticks = 0;
+    while ((get_mode() == HOLD) && (ticks < 20 * SIM_TICK_HZ))
+    {
+        if (ticks == at)
+        {
+            plant_SetLoad(0.05);
+        }
+        tick();
+        settle_Update(&s, ticks++);
+    }
+    log_error(at / SIM_POSITION_DIVIDER, RUNLOG_LENGTH, r);
+    settle_Result(&s, ticks, r);
+}
+
+static const struct {
+    const char * name;
+    void (*run)(struct result_t *);
+} runs[] = {
+    {"step_hold", run_step_clean},
+    {"step_hold_noise", run_step_noise},
+    {"cubic_track", run_cubic},
+    {"quintic_track", run_quintic},
+    {"cubic_track_noise", run_track_noise},
+    {"cubic_track_load", run_track_load},
+    {"load_step", run_load_step},
+};
+
+
+/*************************
+ * JSON
+*************************/
+
+static void put_number(const char * key, double v, const char * after)
+{
+    if (isnan(v))
+    {
+        printf("\"%s\": null%s", key, after);
+    }
+    else
+    {
+        printf("\"%s\": %.6g%s", key, v, after);
+    }
+}
+
+static void put_isr(struct isr_bench_t * b, const char * after)
+{
+    int kept = (b->calls < BENCH_SAMPLES) ? b->calls : BENCH_SAMPLES;
+    qsort(b->ns, kept, sizeof(b->ns[0]), compare_ns);
+    int used = stack_used(b) - stack_base;
+    double sum = 0;
+    for (int i = 0; i < kept; i++)
+    {
+        sum += b->ns[i];
+    }
+    printf("        \"%s\": {\"calls\": %d, ", b->name, b->calls);
+    put_number("ns_mean", kept ? sum / kept : NAN, ", ");
+    put_number("ns_p50", kept ? b->ns[kept / 2] : NAN, ", ");
+    put_number("ns_p99", kept ? b->ns[kept * 99 / 100] : NAN, ", ");
+    int counted = (counter_fd >= 0) && (b->calls > 0);
+    put_number("instructions_mean", counted ? (double)b->instructions / b->calls : NAN, ", ");
+    put_number("instructions_max", counted ? b->instructions_max : NAN, ", ");
+    printf("\"stack_bytes\": %d}%s\n", (used > 0) ? used : 0, after);
+}
+
+int main(int argc, char ** argv)
+{
+    open_counter();
+
+    // the stack isr_loop takes before the handler's
+    bench_reset();
+    bench_runner(SIM_CURRENT_ISR, probe);
+    stack_base = isrs[SIM_CURRENT_ISR].stack + BENCH_STACK - probe_sp;
+
+    // one run unmeasured, the first is slow with cold caches and clocks
+    struct result_t warm;
+    sim_Startup(0);
+    bench_reset();
+    sim_SetIsrRunner(bench_runner);
+    runs[0].run(&warm);
+
+    printf("{\n");
+    printf("  \"version\": %d,\n", BENCH_VERSION);
+    printf("  \"label\": \"%s\",\n", (argc > 1) ? argv[1] : "");
+    printf("  \"perf_counters\": %s,\n", (counter_fd >= 0) ? "true" : "false");
+    printf("  \"runs\": {\n");
+    int count = sizeof(runs) / sizeof(runs[0]);
+    for (int k = 0; k < count; k++)
+    {
+        struct result_t r;
+        sim_SetIsrRunner(0);
+        sim_Startup(0);
+        bench_reset();
+        sim_SetIsrRunner(bench_runner);
+        runs[k].run(&r);
+        sim_SetIsrRunner(0);
+
+        printf("    \"%s\": {\n      ", runs[k].name);
+        put_number("rms_error_deg", r.rms_error, ", ");
+        put_number("max_error_deg", r.max_error, ", ");
+        put_number("settling_s", r.settling, ", ");
+        put_number("overshoot_deg", r.overshoot, ", ");
+        put_number("peak_current_ma", peak_current, ",\n");
+        printf("      \"isr\": {\n");
+        for (int i = 0; i < SIM_ISRS; i++)
+        {
+            put_isr(&isrs[i], (i < SIM_ISRS - 1) ? "," : "");
+        }
+        printf("      }\n    }%s\n", (k < count - 1) ? "," : "");
+    }
+    printf("  }\n}\n");
+    return 0;
+}
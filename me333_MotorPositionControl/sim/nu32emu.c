@@ -0,0 +1,293 @@
+// NU32 emulator: main.c's menu loop and the control modules against the motor
+// model, behind a pseudo-terminal that stands in for UART3. A host client opens
+// the pty as it would the board's serial port, the ASCII menu, the binary
+// frames, bulk uploads, telemetry and DMA dumps all work as on the board.
+//
+// usage: ./nu32emu [-s speed] [-l link]
+//   -s speed   simulated seconds a wall clock second, 1 by default, 10 runs ten times faster
+//   -l link    a symlink to the pty, /tmp/nu32 say, so clients need not be told the /dev/pts number,
+//              removed again on SIGINT or SIGTERM
+//   e.g. ./nu32emu -l /tmp/nu32 &  python3 ../host/nu32proto.py /tmp/nu32
+//
+// The ISRs run from a SIGALRM handler, every current loop period of wall clock
+// time over speed, catching up on the ticks simulated time owes, and preempt
+// the main loop where they land as interrupts do on the board;
+// __builtin_disable_interrupts holds the signal off. Bytes move each way at
+// UART3's 230400 baud in simulated time. The receive FIFO is 8 bytes deep as on
+// the board and, as NU32_Startup sets UART3 up for RTS/CTS, the line stops
+// while it is full rather than overrun it. A signal that comes late runs
+// several ticks back to back with no main loop in between, the host is held
+// back then just as a stalled firmware would hold it. The other way round, a
+// client that stops reading leaves the pty full; what it will not take waits
+// here, the TX FIFO stays full as with CTS down, and the firmware waits on
+// UTXBF, DMA dumps included. Flash is RAM that lasts as long as the process,
+// nvm.c's NVM_RAM_EMULATION. LED2, the error LED, is echoed on stderr.
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include "currentcontrol.h"
+#include "cmdqueue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CORE_TIMER_HZ (NU32_SYS_FREQ / 2)
+#define CATCH_UP_MAX 0.1        // s of simulated time a signal runs at most, the rest is given up
+#define SIGNAL_MIN_US 200       // the timer is no faster than this, faster speeds run more ticks a signal
+
+int firmware_main(void);        // main.c's main, renamed for this build
+void U3ISR(void);
+
+static int master = -1;
+static double speed = 1;
+static double wall_start = 0;   // s
+static double sim_start = 0;
+static unsigned char received[4096];
+static int received_length = 0, received_pos = 0;
+static double rx_line = 0;      // bytes the line has had time for
+static double tx_line = 0;
+static int led2 = 1;
+static const char * link_name = 0;
+
+
+/*************************
+ * NU32.h, UART3 already set up by the emulator
+*************************/
+
+void NU32_Startup(void)
+{
+    NU32_LED1 = 1;
+    NU32_LED2 = 0;
+}
+
+void NU32_ReadUART3(char * message, int maxLength)
+{
+    int num_bytes = 0;
+    while (1)
+    {
+        if (U3STAbits.URXDA)
+        {
+            char data = U3RXREG;
+            if ((data == '\n') || (data == '\r'))
+            {
+                break;
+            }
+            message[num_bytes++] = data;
+            num_bytes = (num_bytes >= maxLength) ? 0 : num_bytes;
+        }
+    }
+    message[num_bytes] = '\0';
+}
+
+void NU32_WriteUART3(const char * string)
+{
+    while (*string != '\0')
+    {
+        while (U3STAbits.UTXBF)
+        {
+            ;
+        }
+        U3TXREG = *string;
+        ++string;
+    }
+}
+
+
+/*************************
+ * INTERRUPTS
+*************************/
+
+static double wall_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double sim_now()
+{
+    return (double)plant_CoreTicks() / CORE_TIMER_HZ;
+}
+
+static void say(const char * text)
+{
+    if (write(STDERR_FILENO, text, strlen(text)) < 0)
+    {
+        return;
+    }
+}
+
+// One current loop period: the line delivers what it has had time for, UART3's
+// ISR takes it, then Timer2, Timer4 and the DMA channel as sim_Tick runs them,
+// and the line takes what has been sent. RTS drops while the FIFO is full,
+// and the line takes nothing while out has no room, as with CTS down.
+static int tick(char * out, int room)
+{
+    double bytes = SIM_UART_BYTES_HZ * getCurrentDT();
+
+    rx_line += bytes;
+    while ((rx_line >= 1) && (received_pos < received_length) && (sfr_Uart3Room() > 0))
+    {
+        sfr_Uart3Receive(received[received_pos++]);
+        rx_line -= 1;
+    }
+    rx_line = ((received_pos < received_length) && (sfr_Uart3Room() > 0)) ? rx_line : 0;
+    if (U3STAbits.URXDA && IEC1bits.U3RXIE)
+    {
+        U3ISR();
+    }
+
+    sim_Tick();
+
+    tx_line += bytes;
+    int n = sfr_Uart3Take(out, ((int)tx_line < room) ? (int)tx_line : room);
+    tx_line = (U3STAbits.TRMT || (n < (int)tx_line)) ? 0 : tx_line - n;
+    return n;
+}
+
+static void interrupts(int sig)
+{
+    int saved = errno;
+    static char out[4096];      // taken off the line, not yet accepted by the pty
+    static int length = 0;
+
+    if (received_pos == received_length)
+    {
+        int n = read(master, received, sizeof(received));
+        received_length = (n > 0) ? n : 0;
+        received_pos = 0;
+    }
+
+    double due = sim_start + (wall_now() - wall_start) * speed;
+    if (due - sim_now() > CATCH_UP_MAX)
+    {
+        sim_start -= due - sim_now() - CATCH_UP_MAX;     // too far behind, let it go
+        due = sim_now() + CATCH_UP_MAX;
+    }
+    while (sim_now() < due)
+    {
+        length += tick(out + length, sizeof(out) - length);
+    }
+
+    // whatever the pty will not take yet waits here, and the firmware waits on UTXBF
+    int n = (length > 0) ? write(master, out, length) : 0;
+    if (n > 0)
+    {
+        memmove(out, out + n, length - n);
+        length -= n;
+    }
+    if (NU32_LED2 != led2)
+    {
+        led2 = NU32_LED2;
+        say(led2 ? "LED2 off\n" : "LED2 on\n");
+    }
+    errno = saved;
+}
+
+static void stop(int sig)
+{
+    if (link_name)
+    {
+        unlink(link_name);
+    }
+    _exit(0);
+}
+
+
+/*************************
+ * PSEUDO-TERMINAL
+*************************/
+
+static const char * open_pty()
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || grantpt(master) || unlockpt(master))
+    {
+        return 0;
+    }
+    const char * name = ptsname(master);
+    // held open so the master keeps working while no client has the pty
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0)
+    {
+        return 0;
+    }
+    struct termios t;
+    tcgetattr(slave, &t);
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return name;
+}
+
+int main(int argc, char ** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:l:")) != -1)
+    {
+        if (opt == 's')
+        {
+            speed = atof(optarg);
+        }
+        else if (opt == 'l')
+        {
+            link_name = optarg;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-s speed] [-l link]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (speed <= 0)
+    {
+        fprintf(stderr, "speed must be above 0\n");
+        return 1;
+    }
+
+    const char * name = open_pty();
+    if (!name)
+    {
+        perror("pty");
+        return 1;
+    }
+    if (link_name)
+    {
+        unlink(link_name);
+        if (symlink(name, link_name))
+        {
+            perror(link_name);
+            return 1;
+        }
+    }
+    printf("%s\n", link_name ? link_name : name);
+    fflush(stdout);
+
+    sfr_DisableInterrupts();        // until main.c's startup enables them
+    sim_Startup(0);
+    sfr_Uart3Attach(1);
+
+    struct sigaction a;
+    memset(&a, 0, sizeof(a));
+    a.sa_handler = interrupts;
+    a.sa_flags = SA_RESTART;
+    sigaction(SIM_INTERRUPT_SIGNAL, &a, 0);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    wall_start = wall_now();
+    sim_start = sim_now();
+    int us = (int)(getCurrentDT() / speed * 1e6);
+    us = (us < SIGNAL_MIN_US) ? SIGNAL_MIN_US : us;
+    struct itimerval every = {{0, us}, {0, us}};
+    setitimer(ITIMER_REAL, &every, 0);
+
+    return firmware_main();
+}
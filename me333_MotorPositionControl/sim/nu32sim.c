@@ -0,0 +1,1588 @@
+// Host simulator for the motor position controller. The control modules are built
+// unchanged against the register shim in include/ and the plant in plant.c.
+//
+// usage: ./nu32sim ilc [runs]     repeated TRACK of a cubic move with learning on
+//        ./nu32sim setpoint        slow cubic with whole degree and Q16 setpoints
+//        ./nu32sim cascade         PID against position -> velocity -> current
+//        ./nu32sim filter          biquads on the D term and the current reading
+//        ./nu32sim cogging         calibrate a cogging motor, then track with and without the table
+//        ./nu32sim scurve          HOLD steps with and without setpoint shaping
+//        ./nu32sim queue           back to back segments against separate TRACK runs
+//        ./nu32sim telemetry       live frames out of HOLDs through a UART paced at 230400 baud
+//        ./nu32sim telemetry bench time per record of the frame slots against a copying path
+//        ./nu32sim dump            HOLD log out through the UART3 DMA stand-in, main loop polled at several rates
+//        ./nu32sim trace           event trace of a HOLD step and its end, dumped as the 'D' command sends it,
+//                                  for ../host/trace.py:  ./nu32sim trace | python3 ../host/trace.py - > hold.json
+//        ./nu32sim record [file]   noisy HOLD steps recorded, dumped as 'X' sends it, replayed and compared,
+//                                  the dump saved to file for ./nu32sim replay
+//        ./nu32sim replay <file>   a saved 'X' dump replayed, the PWM going into each current loop tick
+//        ./nu32sim overrun         a HOLD step with every 20th position ISR overrunning, under each policy
+//        ./nu32sim abort           a HOLD aborted part way, then a whole one logged after it
+//        ./nu32sim nvm             settings and trajectory slots in flash: page rotation, a bad CRC, an older
+//                                  version, the power cut part way through a save, and an upload over
+//                                  a selected slot
+
+#include "sim.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "ilc.h"
+#include "velocitycontrol.h"
+#include "biquad.h"
+#include "cogging.h"
+#include "scurve.h"
+#include "segqueue.h"
+#include "looprate.h"
+#include "itest.h"
+#include "telemetry.h"
+#include "binproto.h"
+#include "crc16.h"
+#include "uartdma.h"
+#include "logdump.h"
+#include "trace.h"
+#include "record.h"
+#include "replay.h"
+#include "config.h"
+#include "cmdqueue.h"
+#include "nvm.h"
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// against the logged reference, or against ideal when it is given
+static void track_error(const int * ideal, float * rms, float * max)
+{
+    double sum = 0;
+    *max = 0;
+    for (int i = 0; i < referenceTrajectoryLength; i++)
+    {
+        int ref = ideal ? ideal[i] : runLogRef[i];
+        float e = fabsf(Q16_TO_DEG(ref - runLogAct[i]));
+        sum += e * e;
+        *max = (e > *max) ? e : *max;
+    }
+    *rms = sqrt(sum / referenceTrajectoryLength);
+}
+
+static int scenario_ilc(int runs)
+{
+    int n = sim_Cubic(referenceTrajectory, 0, 0, 90, 1.0);
+    n = sim_Hold(referenceTrajectory, n, 90, 0.5);
+    n = sim_Cubic(referenceTrajectory, n, 90, 0, 1.0);
+    n = sim_Hold(referenceTrajectory, n, 0, 0.5);
+    referenceTrajectoryLength = n;
+
+    setILC(1, getILCGain(), getILCQ(), getILCLead());
+    printf("run rms_deg max_deg\n");
+    for (int k = 0; k < runs; k++)
+    {
+        float rms, max;
+        set_mode(TRACK);
+        sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+        track_error(0, &rms, &max);
+        ilc_Poll();
+        printf("%d %.3f %.3f\n", k, rms, max);
+        sim_Run(SIM_TICK_HZ / 2);   // settle in HOLD between runs
+    }
+    return 0;
+}
+
+// The setpoint used to be an int, so each sample was cut to whole degrees
+static int scenario_setpoint()
+{
+    static int ideal[MAX_REF_TRAJ_LENGTH];
+    int n = sim_Cubic(ideal, 0, 0, 10, 4.0);
+    n = sim_Hold(ideal, n, 10, 1.0);
+
+    printf("setpoint rms_deg max_deg\n");
+    for (int whole = 1; whole >= 0; whole--)
+    {
+        float rms, max;
+        sim_Startup(0);
+        for (int i = 0; i < n; i++)
+        {
+            referenceTrajectory[i] = whole ? (ideal[i] / Q16_ONE) * Q16_ONE : ideal[i];
+        }
+        referenceTrajectoryLength = n;
+        set_mode(TRACK);
+        sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+        track_error(ideal, &rms, &max);
+        printf("%s %.3f %.3f\n", whole ? "whole_degree" : "q16", rms, max);
+    }
+    return 0;
+}
+
+// 45 degree step in HOLD: overshoot, 2% settling time and the spread of the
+// current command once settled, where the D term passes on encoder quantization
+static void step_response(float * overshoot, float * settle, float * command_rms)
+{
+    const float target = 45;
+    const int ticks = 2 * SIM_TICK_HZ;
+    double sum = 0, sum_sq = 0;
+    int settled_at = 0, quiet = 0;
+
+    *overshoot = 0;
+    setDesiredAngle(DEG_TO_Q16(target));
+    set_mode(HOLD);
+    for (int i = 0; i < ticks; i++)
+    {
+        sim_Tick();
+        float angle = plant_Angle();
+        *overshoot = (angle - target > *overshoot) ? angle - target : *overshoot;
+        settled_at = (fabsf(angle - target) > 0.02 * target) ? i + 1 : settled_at;
+        if (i >= ticks - SIM_TICK_HZ / 2)
+        {
+            float c = getDesiredCurrent();
+            sum += c;
+            sum_sq += c * c;
+            quiet++;
+        }
+    }
+    *settle = (float)settled_at / SIM_TICK_HZ;
+    *command_rms = sqrt(fmax(sum_sq / quiet - (sum / quiet) * (sum / quiet), 0));
+}
+
+static int scenario_cascade()
+{
+    const int rates[] = {0, 1000, 500, 200};     // 0 for the PID on its own
+
+    printf("structure velocity_hz overshoot_deg settle_s command_noise_ma track_rms_deg track_max_deg\n");
+    for (int k = 0; k < sizeof(rates) / sizeof(rates[0]); k++)
+    {
+        float overshoot, settle, noise, rms, max;
+        int cascade = (rates[k] != 0);
+        sim_Startup(0);
+        setCascade(cascade, rates[k]);
+        step_response(&overshoot, &settle, &noise);
+
+        sim_Startup(0);
+        setCascade(cascade, rates[k]);
+        int n = sim_Cubic(referenceTrajectory, 0, 0, 90, 1.0);
+        referenceTrajectoryLength = sim_Hold(referenceTrajectory, n, 90, 0.5);
+        set_mode(TRACK);
+        sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+        track_error(0, &rms, &max);
+
+        printf("%s %d %.2f %.3f %.1f %.3f %.3f\n", cascade ? "cascade" : "pid", rates[k],
+               overshoot, settle, noise, rms, max);
+    }
+    return 0;
+}
+
+// Once a hold has settled: spread of the true winding current about its mean, and
+// the RMS difference between the current the PI acts on and the true current
+static void hold_noise(float * ripple, float * sensed)
+{
+    double sum = 0, sum_sq = 0, err_sq = 0;
+    int n = SIM_TICK_HZ / 2;
+    for (int i = 0; i < n; i++)
+    {
+        sim_Tick();
+        double c = plant_Current();
+        sum += c;
+        sum_sq += c * c;
+        err_sq += (readCurrent() - c) * (readCurrent() - c);
+    }
+    *ripple = sqrt(fmax(sum_sq / n - (sum / n) * (sum / n), 0));
+    *sensed = sqrt(err_sq / n);
+}
+
+static int scenario_filter()
+{
+    const struct { const char * name; enum biquad_point_t point; float fc; } cases[] = {
+        {"none", BQ_CURRENT, 0},
+        {"rate_lp70", BQ_RATE, 70},
+        {"command_lp70", BQ_COMMAND, 70},
+        {"current_lp1000", BQ_CURRENT, 1000},
+    };
+    float lp[1][5];
+
+    printf("filter overshoot_deg settle_s command_noise_ma winding_ripple_ma sensed_noise_ma\n");
+    for (int k = 0; k < sizeof(cases) / sizeof(cases[0]); k++)
+    {
+        float overshoot, settle, noise, ripple, sensed;
+        sim_Startup(0);
+        plant_SetCurrentNoise(20);
+        if (cases[k].fc > 0)
+        {
+            biquad_DesignLowPass(cases[k].fc, 0.707, biquad_SampleRate(cases[k].point), lp[0]);
+            biquad_Load(cases[k].point, 1, lp);
+        }
+        step_response(&overshoot, &settle, &noise);
+        hold_noise(&ripple, &sensed);
+        printf("%s %.2f %.3f %.1f %.1f %.1f\n", cases[k].name, overshoot, settle, noise, ripple, sensed);
+        biquad_Load(cases[k].point, 0, lp);
+    }
+
+    // host time only, 'B' on the board gives the real cycle counts
+    static struct biquad_cascade_t f;
+    biquad_DesignLowPass(100, 0.707, 5000, lp[0]);
+    for (int n = 1; n <= BIQUAD_MAX_SECTIONS; n++)
+    {
+        const int samples = 1000000;
+        f.sections = n;
+        for (int i = 0; i < n; i++)
+        {
+            f.s[i].b0 = lp[0][0] * (1 << BIQUAD_COEFF_SHIFT);
+            f.s[i].b1 = lp[0][1] * (1 << BIQUAD_COEFF_SHIFT);
+            f.s[i].b2 = lp[0][2] * (1 << BIQUAD_COEFF_SHIFT);
+            f.s[i].a1 = lp[0][3] * (1 << BIQUAD_COEFF_SHIFT);
+            f.s[i].a2 = lp[0][4] * (1 << BIQUAD_COEFF_SHIFT);
+        }
+        clock_t start = clock();
+        volatile int y = 0;
+        for (int i = 0; i < samples; i++)
+        {
+            y += biquad_Run(&f, (i & 0xFF) << 16);
+        }
+        printf("host %d sections %.1f ns/sample\n", n, (clock() - start) * 1e9 / CLOCKS_PER_SEC / samples);
+    }
+    return 0;
+}
+
+// 12 cycles of 20 mNm (80 mA) cogging per revolution on top of the friction
+#define SIM_COGGING 0.02
+#define SIM_COGGING_PERIODS 12
+
+static float cogging_table_error()
+{
+    double sum = 0;
+    for (int b = 0; b < COG_BINS; b++)
+    {
+        double theta = (double)b * COG_BIN_COUNTS / COUNTS_PER_REV * 2 * M_PI;
+        double truth = SIM_COGGING * sin(SIM_COGGING_PERIODS * theta) / plant_default_params.kt * 1000;
+        double e = coggingTable.bins[b] / (double)(1 << COG_SHIFT) - truth;
+        sum += e * e;
+    }
+    return sqrt(sum / COG_BINS);
+}
+
+// slow 120 degree move under a cogging load, calibrated with the same structure
+static int scenario_cogging()
+{
+    printf("structure calibration_s table_error_ma friction_ma (plant %.1f) rms_no_cogging rms_off rms_on max_off max_on\n",
+           plant_default_params.friction / plant_default_params.kt * 1000);
+    for (int cascade = 0; cascade <= 1; cascade++)
+    {
+        float rms[3], max[3];
+        sim_Startup(0);
+        setCascade(cascade, VELOCITY_RATE_MAX);
+        plant_SetCogging(SIM_COGGING, SIM_COGGING_PERIODS);
+        int start = countsToQ16(readEncoderCount());
+        float seconds = cogging_StartCalibration(start);
+        setDesiredAngle(start);
+        set_mode(HOLD);
+        sim_RunWhile(HOLD, (int)(1.1 * seconds * SIM_TICK_HZ));
+        cogging_Poll();
+
+        for (int k = 0; k < 3; k++)     // no cogging in the plant, compensation off, on
+        {
+            sim_Startup(0);
+            setCascade(cascade, VELOCITY_RATE_MAX);
+            plant_SetCogging((k == 0) ? 0 : SIM_COGGING, SIM_COGGING_PERIODS);
+            setCoggingCompensation(k == 2);
+            int n = sim_Cubic(referenceTrajectory, 0, 0, 120, 8.0);
+            referenceTrajectoryLength = sim_Hold(referenceTrajectory, n, 120, 1.0);
+            set_mode(TRACK);
+            sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+            track_error(0, &rms[k], &max[k]);
+        }
+        setCoggingCompensation(0);
+        printf("%s %.0f %.1f %.1f %.3f %.3f %.3f %.3f %.3f\n", cascade ? "cascade" : "pid", seconds,
+               coggingTable.valid ? cogging_table_error() : -1, getCoggingFriction(),
+               rms[0], rms[1], rms[2], max[1], max[2]);
+    }
+    return 0;
+}
+
+// HOLD steps: time the current command asks for more than the supply can drive
+// through the winding, the peak command, overshoot and settling within 0.5 degrees
+static int scenario_scurve()
+{
+    const float steps[] = {10, 45, 180};
+
+    printf("shaping step_deg over_supply_ms peak_command_ma overshoot_deg settle_s\n");
+    for (int k = 0; k < sizeof(steps) / sizeof(steps[0]); k++)
+    {
+        for (int shaped = 0; shaped <= 1; shaped++)
+        {
+            const int ticks = 3 * SIM_TICK_HZ;
+            const float stall = plant_default_params.supply / plant_default_params.resistance * 1000;
+            int saturated = 0, settled_at = 0;
+            float peak = 0, overshoot = 0;
+            sim_Startup(0);
+            setScurve(shaped, 0, 0, 0);
+            setDesiredAngle(DEG_TO_Q16(steps[k]));
+            set_mode(HOLD);
+            for (int i = 0; i < ticks; i++)
+            {
+                sim_Tick();
+                float angle = plant_Angle();
+                saturated += (fabsf(getDesiredCurrent()) > stall);
+                peak = (fabsf(getDesiredCurrent()) > peak) ? fabsf(getDesiredCurrent()) : peak;
+                overshoot = (angle - steps[k] > overshoot) ? angle - steps[k] : overshoot;
+                settled_at = (fabsf(angle - steps[k]) > 0.5) ? i + 1 : settled_at;
+            }
+            sim_RunWhile(HOLD, 10 * SIM_TICK_HZ);     // let the HOLD log fill and end the run
+            printf("%s %.0f %.1f %.0f %.2f %.3f\n", shaped ? "on" : "off", steps[k],
+                   saturated * 1000.0 / SIM_TICK_HZ, peak, overshoot, (float)settled_at / SIM_TICK_HZ);
+        }
+    }
+    set_mode(IDLE);
+    setScurve(0, 0, 0, 0);
+    return 0;
+}
+
+static void put_leg(int leg)
+{
+    segqueue_BeginSamples(leg);
+    for (int i = 0; i < leg; i++)
+    {
+        segqueue_PutSample(DEG_TO_Q16(90.0 * (i + 1) / leg));
+    }
+    segqueue_EndSamples(1);
+}
+
+static float log_max_error(int from, int n)
+{
+    float max = 0;
+    for (int i = from; (i < from + n) && (i < runLogLength); i++)
+    {
+        float e = fabsf(Q16_TO_DEG(runLogRef[i] - runLogAct[i]));
+        max = (e > max) ? e : max;
+    }
+    return max;
+}
+
+// Two 1 s legs at 90 deg/s. Run separately, each leg is its own upload and
+// TRACK, with 50 ms of host turnaround between them. Queued, the second leg and
+// a cubic stop are appended while the first leg runs. The error is the largest
+// in the first 0.2 s of the second leg. Both run on the cascade, the PID lags
+// a 90 deg/s ramp by more than the boundary costs.
+static int scenario_queue()
+{
+    const int leg = (int)(1.0 / getPositionDT());
+    const int window = (int)(0.2 / getPositionDT());
+    float boundary = 0;
+    int ticks = 0;
+
+    printf("run seconds_to_180 boundary_error_deg\n");
+    sim_Startup(0);
+    setCascade(1, VELOCITY_RATE_MAX);
+    for (int k = 0; k < 2; k++)
+    {
+        for (int i = 0; i < leg; i++)
+        {
+            referenceTrajectory[i] = DEG_TO_Q16(90 * k + 90.0 * (i + 1) / leg);
+        }
+        referenceTrajectoryLength = leg;
+        set_mode(TRACK);
+        ticks += sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+        if (k == 0)
+        {
+            sim_Run(SIM_TICK_HZ / 20);
+            ticks += SIM_TICK_HZ / 20;
+        }
+    }
+    printf("separate %.3f %.3f\n", (float)ticks / SIM_TICK_HZ, log_max_error(0, window));
+
+    sim_Startup(0);
+    setCascade(1, VELOCITY_RATE_MAX);
+    segqueue_Clear();
+    put_leg(leg);
+    segqueue_Start(0);
+    set_mode(TRACK);
+    sim_RunWhile(TRACK, leg * SIM_POSITION_DIVIDER / 2);
+    put_leg(leg);
+    segqueue_AppendCubic(DEG_TO_Q16(200), 0.5);
+    sim_RunWhile(TRACK, 10 * SIM_TICK_HZ);
+    printf("queued %.3f %.3f\n", 2.0 * leg * getPositionDT(), log_max_error(leg, window));
+    return 0;
+}
+
+// The 45 degree step at other loop rates. With the integrators scaled the
+// response should barely move. Then a pair the measured ISR times refuse.
+static int scenario_rates()
+{
+    const int rates[][2] = {{5000, 200}, {10000, 200}, {2500, 200}, {5000, 500}, {5000, 1000}, {2000, 100}};
+
+    printf("current_hz position_hz overshoot_deg settle_s\n");
+    for (int k = 0; k < sizeof(rates) / sizeof(rates[0]); k++)
+    {
+        sim_Startup(0);
+        if (setLoopRates(rates[k][0], rates[k][1]))
+        {
+            printf("%d %d refused\n", rates[k][0], rates[k][1]);
+            continue;
+        }
+        const float target = 45;
+        const int ticks = (int)(1.5 * getCurrentLoopRate());
+        float overshoot = 0;
+        int settled_at = 0;
+        setDesiredAngle(DEG_TO_Q16(target));
+        set_mode(HOLD);
+        for (int i = 0; i < ticks; i++)
+        {
+            sim_Tick();
+            float angle = plant_Angle();
+            overshoot = (angle - target > overshoot) ? angle - target : overshoot;
+            settled_at = (fabsf(angle - target) > 0.02 * target) ? i + 1 : settled_at;
+        }
+        sim_RunWhile(HOLD, 10 * getCurrentLoopRate());    // let the HOLD log fill and end the run
+        printf("%d %d %.3f %.3f\n", rates[k][0], rates[k][1], overshoot, settled_at * getCurrentDT());
+    }
+
+    // A current ISR measured at 100 us cannot run at 10 kHz
+    sim_Startup(0);
+    looprate_Record(LOOP_CURRENT, NU32_SYS_FREQ / 2 / 10000, 0);
+    printf("%d %d %s\n", 10000, 200, setLoopRates(10000, 200) ? "refused" : "accepted");
+    looprate_ResetTimes();
+    return 0;
+}
+
+// The simulator's ISRs take no time, so an overrun is put in as scenario_rates
+// puts in a long ISR: after every 20th position ISR, a call recorded as leaving
+// half a period past the next match.
+static int overrun_every = 0;
+static int position_calls = 0;
+
+static void overrun_runner(enum sim_isr_t isr, void (*handler)(void))
+{
+    handler();
+    if ((isr == SIM_POSITION_ISR) && (++position_calls % overrun_every == 0))
+    {
+        looprate_Record(LOOP_POSITION, (PR4 + 1) * 32 * 3 / 2, 0);
+    }
+}
+
+// The 45 degree HOLD step under each position loop policy, then the current
+// loop's fault. The step is cut short where a policy ends the HOLD.
+static int scenario_overrun()
+{
+    const char * names[OVERRUN_POLICIES] = {"count", "skip_log", "hold", "slow", "fault"};
+
+    printf("loop policy overruns lost responses position_hz mode overshoot_deg final_error_deg timestamps_left_out\n");
+    overrun_every = 20;
+    sim_SetIsrRunner(overrun_runner);
+    for (int k = 0; k <= OVERRUN_POLICIES; k++)
+    {
+        enum loop_t loop = (k < OVERRUN_POLICIES) ? LOOP_POSITION : LOOP_CURRENT;
+        enum overrun_policy_t policy = (k < OVERRUN_POLICIES) ? k : OVERRUN_FAULT;
+        sim_Startup(0);
+        looprate_ResetOverruns();
+        looprate_SetPolicy(LOOP_CURRENT, OVERRUN_COUNT);
+        looprate_SetPolicy(LOOP_POSITION, OVERRUN_COUNT);
+        looprate_SetPolicy(loop, policy);
+        setTimestamps(1);
+        memset(latchTimeArray, 0xFF, sizeof(latchTimeArray));
+        position_calls = 0;
+        overrun_every = (loop == LOOP_POSITION) ? 20 : 1 << 30;
+
+        const float target = 45;
+        float overshoot = 0;
+        setDesiredAngle(DEG_TO_Q16(target));
+        set_mode(HOLD);
+        for (int i = 0; (i < 2 * SIM_TICK_HZ) && (get_mode() == HOLD); i++)
+        {
+            if ((loop == LOOP_CURRENT) && (i == SIM_TICK_HZ / 10))
+            {
+                looprate_Record(LOOP_CURRENT, (PR2 + 1) * 4 * 2, 0);   // one long current ISR
+            }
+            sim_Tick();
+            looprate_Poll();        // the main loop, once a tick
+            float angle = plant_Angle();
+            overshoot = (angle - target > overshoot) ? angle - target : overshoot;
+        }
+        struct position_state_t st;
+        positionControl_GetState(&st);
+        int left_out = 0;
+        for (int i = 1; i < st.hold_count; i++)
+        {
+            left_out += (latchTimeArray[i] == 0);
+        }
+        struct overrun_stats_t s;
+        looprate_GetOverruns(loop, &s);
+        printf("%s %s %u %u %u %d %s %.3f %.3f %d\n", (loop == LOOP_CURRENT) ? "current" : "position", names[policy],
+               s.overruns, s.lost, s.responses, getPositionLoopRate(), (get_mode() == HOLD) ? "HOLD" : "IDLE",
+               overshoot, plant_Angle() - target, left_out);
+        set_mode(IDLE);
+        sim_Tick();
+    }
+
+    // "slow" through a TRACK: the run plays a sample a tick at the rate it was
+    // made for, the loop is halved once it ends and its filter designed again
+    sim_Startup(0);
+    looprate_ResetOverruns();
+    looprate_SetPolicy(LOOP_POSITION, OVERRUN_SLOW);
+    struct biquad_spec_t lp = {BQ_LOWPASS, 20, 0.707};
+    biquad_LoadSpecs(BQ_RATE, 1, &lp);
+    int n = sim_Cubic(referenceTrajectory, 0, 0, 45, 1.0);
+    referenceTrajectoryLength = sim_Hold(referenceTrajectory, n, 45, 0.5);
+    position_calls = 0;
+    overrun_every = 20;
+    int slowest = POSITION_RATE_DEFAULT, fastest = POSITION_RATE_DEFAULT, ticks = 0;
+    set_mode(TRACK);
+    while ((get_mode() == TRACK) && (ticks < 10 * SIM_TICK_HZ))
+    {
+        sim_Tick();
+        ticks++;
+        slowest = (getPositionLoopRate() < slowest) ? getPositionLoopRate() : slowest;
+        fastest = (getPositionLoopRate() > fastest) ? getPositionLoopRate() : fastest;
+        looprate_Poll();
+    }
+    int calls = position_calls;
+    struct overrun_stats_t s;
+    looprate_GetOverruns(LOOP_POSITION, &s);
+    printf("\ntrack_samples position_calls track_hz overruns after_hz rate_sections match\n");
+    int match = (calls == referenceTrajectoryLength) && (slowest == fastest) && (s.responses == 1)
+        && (getPositionLoopRate() == POSITION_RATE_DEFAULT / 2) && (biquad_GetSections(BQ_RATE) == 1);
+    printf("%d %d %d %u %d %d %s\n", referenceTrajectoryLength, calls, slowest, s.overruns, getPositionLoopRate(),
+           biquad_GetSections(BQ_RATE), match ? "yes" : "no");
+    set_mode(IDLE);
+    biquad_Load(BQ_RATE, 0, 0);
+
+    sim_SetIsrRunner(0);
+    setTimestamps(0);
+    looprate_SetPolicy(LOOP_CURRENT, OVERRUN_COUNT);
+    looprate_SetPolicy(LOOP_POSITION, OVERRUN_COUNT);
+    return !match;
+}
+
+// The 180 degree HOLD step with the axis already many turns out: near zero,
+// across the Q16 wrap at 32768 degrees, across the 32 bit count and far past
+// where a float count has whole counts. The PID's limit cycle makes the
+// overshoot hop with the last bit of the start angle, so each row averages
+// over starts a whole turn apart. The last column is how far
+// 360/COUNTS_PER_REV * (float)count, the old angle, is off at the start.
+static int scenario_multiturn()
+{
+    const long long offsets[] = {0, 32700LL * COUNTS_PER_REV / 360, 2147483647LL - 300, 5000000000000LL};
+    const int turns = 10;
+
+    printf("start_count overshoot_deg settle_s float_angle_error_deg\n");
+    for (int k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k++)
+    {
+        const float step = 180;
+        const int ticks = 2 * SIM_TICK_HZ;
+        float overshoot_sum = 0, settle_sum = 0, float_error = 0;
+        for (int t = 0; t < turns; t++)
+        {
+            float overshoot = 0;
+            int settled_at = 0;
+            sim_Startup(0);
+            plant_SetEncoderOffset(offsets[k] + t * COUNTS_PER_REV);
+            long long count = readEncoderCount();
+            setDesiredAngle(Q16_ADD(countsToQ16(count), DEG_TO_Q16(step)));
+            set_mode(HOLD);
+            for (int i = 0; i < ticks; i++)
+            {
+                sim_Tick();
+                float moved = plant_Angle();
+                overshoot = (moved - step > overshoot) ? moved - step : overshoot;
+                settled_at = (fabsf(moved - step) > 0.02 * step) ? i + 1 : settled_at;
+            }
+            sim_RunWhile(HOLD, 10 * SIM_TICK_HZ);
+            overshoot_sum += overshoot;
+            settle_sum += (float)settled_at / SIM_TICK_HZ;
+            double exact = 360.0 / COUNTS_PER_REV * count;
+            float old = 360.0f / COUNTS_PER_REV * (float)count;
+            float_error = fmax(float_error, fabs(old - exact));
+        }
+        printf("%lld %.3f %.3f %.1f\n", offsets[k], overshoot_sum / turns, settle_sum / turns, float_error);
+    }
+    return 0;
+}
+
+// A timestamped HOLD log in the form the board sends it, for host/timing.py.
+// The simulator has no encoder wait, so the intervals are exact and the
+// latency is down to when the current loop next runs the command.
+static int scenario_timestamps(int cascade)
+{
+    sim_Startup(0);
+    setCascade(cascade, VELOCITY_RATE_MAX);
+    setTimestamps(1);
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    sim_RunWhile(HOLD, 20 * SIM_TICK_HZ);
+    setTimestamps(0);
+    for (int i = 0; i < RUNLOG_LENGTH - 1; i++)
+    {
+        printf("%f %f %u %u\n", Q16_TO_DEG(runLogRef[i]), Q16_TO_DEG(runLogAct[i]),
+               latchTimeArray[i], applyTimeArray[i]);
+    }
+    return 0;
+}
+
+// An ITEST run printed as the board answers 'W' and then sends the log, for
+// host/itest.py. Arguments as the 'W' line, the original test without them.
+static int scenario_itest(int argc, char ** argv)
+{
+    struct itest_params_t p;
+    sim_Startup(0);
+    getITest(&p);
+    if (argc == 6)
+    {
+        p.shape = atoi(argv[0]);
+        p.amplitude = atof(argv[1]);
+        p.period = atof(argv[2]);
+        p.count = atoi(argv[3]);
+        p.end_hz = atof(argv[4]);
+        p.decimation = atoi(argv[5]);
+    }
+    int ok = (setITest(&p) == 0);
+    getITest(&p);
+    printf("%d %d %f %f %d %f %d %d %f\n", ok, p.shape, p.amplitude, p.period, p.count, p.end_hz,
+           p.decimation, itest_Samples(), itest_SamplePeriod());
+    if (!ok)
+    {
+        return 1;
+    }
+    set_mode(ITEST);
+    sim_RunWhile(ITEST, 100 * SIM_TICK_HZ);
+    printf("%d\n", runLogLength);
+    for (int i = 0; i < runLogLength; i++)
+    {
+        printf("%d %d\n", runLogRef[i], runLogAct[i]);
+    }
+    return 0;
+}
+
+// The copy path the frame slots replaced, for the timing below: the ISR copies
+// the signals into a ring of records, and the main loop copies records into a
+// frame buffer and takes the CRC over the whole frame.
+static union telemetry_word_t copy_ring[TLM_SLOTS * TLM_FRAME_RECORDS][1 + TLM_SIGNALS];
+static unsigned int copy_head = 0, copy_tail = 0;
+
+static void copy_put(unsigned int seq, const union telemetry_word_t * values)
+{
+    union telemetry_word_t * r = copy_ring[copy_head++ % (TLM_SLOTS * TLM_FRAME_RECORDS)];
+    r[0].i = seq;
+    for (int s = 0; s < TLM_SIGNALS; s++)
+    {
+        r[1 + s] = values[s];
+    }
+}
+
+static int copy_frame(unsigned char * frame)
+{
+    int length = 2 + TLM_FRAME_RECORDS * 4 * (1 + TLM_SIGNALS);
+    frame[0] = BIN_MAGIC;
+    frame[1] = BIN_OP_TELEMETRY | BIN_REPLY;
+    frame[2] = length & 0xFF;
+    frame[3] = length >> 8;
+    frame[4] = BIN_OK;
+    frame[5] = TLM_ALL;
+    unsigned char * p = &frame[6];
+    for (int r = 0; r < TLM_FRAME_RECORDS; r++)
+    {
+        const union telemetry_word_t * record = copy_ring[copy_tail++ % (TLM_SLOTS * TLM_FRAME_RECORDS)];
+        for (int w = 0; w < 1 + TLM_SIGNALS; w++, p += 4)
+        {
+            unsigned int v = record[w].i;
+            p[0] = v & 0xFF;
+            p[1] = (v >> 8) & 0xFF;
+            p[2] = (v >> 16) & 0xFF;
+            p[3] = (v >> 24) & 0xFF;
+        }
+    }
+    unsigned short crc = crc16(CRC16_INIT, &frame[1], BIN_HEADER_SIZE + length);
+    p[0] = crc & 0xFF;
+    p[1] = crc >> 8;
+    return 1 + BIN_HEADER_SIZE + length + BIN_CRC_SIZE;
+}
+
+static double seconds_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Host time per record of both paths with every signal subscribed, each frame
+// read byte by byte as the UART would. The bytes are the record's loads and
+// stores on the way from the ISR's values to the UART, CRC reads included.
+static void telemetry_bench()
+{
+    const int n = 4000000;
+    const int record = 4 * (1 + TLM_SIGNALS);
+    union telemetry_word_t values[TLM_SIGNALS] = {{0}};
+    unsigned char frame[TLM_FRAME_MAX];
+    unsigned int sum = 0;
+
+    double start = seconds_now();
+    for (int i = 0; i < n; i++)
+    {
+        values[TLM_ANGLE].i = i;
+        copy_put(i, values);
+        if (copy_head - copy_tail == TLM_FRAME_RECORDS)
+        {
+            int length = copy_frame(frame);
+            for (int b = 0; b < length; b++)
+            {
+                sum += frame[b];
+            }
+        }
+    }
+    double copy_ns = (seconds_now() - start) / n * 1e9;
+
+    telemetry_Subscribe(TLM_ALL, 1);
+    start = seconds_now();
+    for (int i = 0; i < n; i++)
+    {
+        values[TLM_ANGLE].i = i;
+        telemetry_Put(values);
+        int length;
+        const unsigned char * f = telemetry_NextFrame(&length);
+        if (f != 0)
+        {
+            for (int b = 0; b < length; b++)
+            {
+                sum += f[b];
+            }
+            telemetry_Release();
+        }
+    }
+    double slot_ns = (seconds_now() - start) / n * 1e9;
+    telemetry_Subscribe(0, 1);
+
+    printf("path ns_per_record bytes_per_record (checksum %u)\n", sum);
+    printf("copy %.1f %d\n", copy_ns, 5 * record);      // ring store, ring load, frame store, CRC load, UART load
+    printf("slots %.1f %d\n", slot_ns, 2 * record);     // slot store, UART load
+}
+
+// Frames taken off the ring as fast as a 230400 baud UART empties them, then
+// checked and decoded as the host would. Sequence k is HOLD sample k*d + d-1.
+static int scenario_telemetry()
+{
+    const int cases[][3] = {{TLM_ALL, 1, 200}, {TLM_ALL, 1, 1000}, {TLM_ALL, 5, 1000},
+                            {(1 << TLM_ANGLE) | (1 << TLM_ANGLE_ERROR), 1, 1000}};
+    const float bytes_per_tick = 230400 / 10.0 / SIM_TICK_HZ;
+
+    printf("mask decimation position_hz records dropped gaps bad_crc mismatched bytes_per_s\n");
+    for (int k = 0; k < sizeof(cases) / sizeof(cases[0]); k++)
+    {
+        sim_Startup(0);
+        setLoopRates(CURRENT_RATE_DEFAULT, cases[k][2]);
+        telemetry_Subscribe(cases[k][0], cases[k][1]);
+        setDesiredAngle(DEG_TO_Q16(45));
+        set_mode(HOLD);
+
+        const unsigned char * frame;
+        int length, records = 0, gaps = 0, bad_crc = 0, mismatched = 0, ticks = 0, idle = 0;
+        long bytes = 0;
+        float budget = 0;
+        int expected = 0;
+        while (1)
+        {
+            frame = telemetry_NextFrame(&length);
+            idle = (get_mode() == HOLD) ? 0 : idle + 1;
+            if ((frame == 0) && (idle > SIM_TICK_HZ / 20))
+            {
+                break;      // the run is over and its last frame is out
+            }
+            sim_Tick();
+            ticks++;
+            budget += bytes_per_tick;
+            if ((frame == 0) || (budget < length))
+            {
+                budget = (frame == 0) ? 0 : budget;
+                continue;
+            }
+            budget -= length;
+            bytes += length;
+            unsigned short crc = frame[length - 2] | (frame[length - 1] << 8);
+            bad_crc += (crc16(CRC16_INIT, &frame[1], length - 3) != crc);
+            int words = 1;
+            for (int s = 0; s < TLM_SIGNALS; s++)
+            {
+                words += (frame[5] >> s) & 1;
+            }
+            const unsigned char * p = &frame[6];
+            for (int r = 0; r < TLM_FRAME_RECORDS; r++, p += 4 * words)
+            {
+                int seq, angle;
+                memcpy(&seq, p, 4);
+                memcpy(&angle, p + 4, 4);   // TLM_ANGLE is the first word when subscribed
+                if (seq == -1)
+                {
+                    continue;   // a frame published before it was full
+                }
+                gaps += (seq != expected);
+                expected = seq + 1;
+                int idx = seq * cases[k][1] + cases[k][1] - 1;
+                mismatched += (frame[5] & (1 << TLM_ANGLE)) && (idx < RUNLOG_LENGTH) && (angle != runLogAct[idx]);
+                records++;
+            }
+            telemetry_Release();
+        }
+        printf("%#x %d %d %d %u %d %d %d %.0f\n", cases[k][0], cases[k][1], cases[k][2], records,
+               telemetry_Dropped(), gaps, bad_crc, mismatched, bytes / (ticks * getCurrentDT()));
+        telemetry_Subscribe(0, 1);
+    }
+    return 0;
+}
+
+void U3ISR(void);
+
+// A request frame into UART3 as the host sends it, a byte at a time
+static void host_send(unsigned char opcode, const void * payload, int length)
+{
+    unsigned char frame[1 + BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE];
+    frame[0] = BIN_MAGIC;
+    frame[1] = opcode;
+    frame[2] = length & 0xFF;
+    frame[3] = length >> 8;
+    memcpy(&frame[4], payload, length);
+    unsigned short crc = crc16(CRC16_INIT, &frame[1], BIN_HEADER_SIZE + length);
+    frame[4 + length] = crc & 0xFF;
+    frame[5 + length] = crc >> 8;
+    for (int i = 0; i < 1 + BIN_HEADER_SIZE + length + BIN_CRC_SIZE; i++)
+    {
+        sfr_Uart3Receive(frame[i]);
+        U3ISR();
+    }
+}
+
+// The same, answered as the main loop would between menu commands
+static void host_frame(unsigned char opcode, const void * payload, int length)
+{
+    host_send(opcode, payload, length);
+    binProto_Service();
+}
+
+// A menu line into UART3, terminator included
+static void host_line(const char * line)
+{
+    while (*line)
+    {
+        sfr_Uart3Receive(*line++);
+        U3ISR();
+    }
+}
+
+// Whether a "p" line, sent while a HOLD runs, stops it from the ISR
+static int p_aborts()
+{
+    set_mode(HOLD);
+    sim_Run(10);
+    host_line("p\n");
+    sim_Run(10);
+    int aborted = (get_mode() != HOLD);
+    set_mode(IDLE);
+    return aborted;
+}
+
+// A HOLD aborted part way, as the ISR does on a "p" line or BIN_OP_ABORT, then
+// 'l' again. The second HOLD has to log a whole RUNLOG_LENGTH - 1 samples from
+// row 0, with none of the first one's rows left in the dump.
+static int scenario_abort()
+{
+    sim_Startup(0);
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    sim_Run(SIM_TICK_HZ / 2);
+    struct position_state_t st;
+    positionControl_GetState(&st);
+    int aborted_at = st.hold_count;
+    set_mode(IDLE);
+    sim_Run(10);
+
+    const int target = DEG_TO_Q16(-30);
+    setDesiredAngle(target);
+    set_mode(HOLD);
+    int samples = 0;
+    for (int i = 0; (i < 20 * SIM_TICK_HZ) && (get_mode() == HOLD); i++)
+    {
+        positionControl_GetState(&st);
+        int before = st.hold_count;
+        sim_Tick();
+        positionControl_GetState(&st);
+        samples += (st.hold_count != before) || (get_mode() != HOLD);
+    }
+    int stale = 0;
+    for (int i = 0; i < RUNLOG_LENGTH - 1; i++)
+    {
+        stale += (runLogRef[i] != target);
+    }
+    int match = (samples == RUNLOG_LENGTH - 1) && (stale == 0);
+    printf("aborted_at samples expected stale_rows match\n");
+    printf("%d %d %d %d %s\n", aborted_at, samples, RUNLOG_LENGTH - 1, stale, match ? "yes" : "no");
+
+    // "p" only aborts where a command would be: not as the argument of the
+    // command the main loop is in, nor behind a line it has yet to take
+    char line[CMD_LINE_LENGTH];
+    cmdQueue_Startup();
+    int command = p_aborts();
+    cmdQueue_GetLine(line, sizeof(line));
+    cmdQueue_CommandDone();
+    host_line("v\n");
+    cmdQueue_GetLine(line, sizeof(line));
+    int argument = p_aborts();
+    cmdQueue_ReadLine(line, sizeof(line));
+    int argument_read = (strcmp(line, "p") == 0);
+    cmdQueue_CommandDone();
+    host_line("v\n");
+    int queued = p_aborts();
+    cmdQueue_GetLine(line, sizeof(line));
+    cmdQueue_ReadLine(line, sizeof(line));
+    cmdQueue_CommandDone();
+    int after = p_aborts();
+    int p_match = command && !argument && argument_read && !queued && after;
+    printf("command argument argument_read queued after_command match\n");
+    printf("%d %d %d %d %d %s\n", command, argument, argument_read, queued, after, p_match ? "yes" : "no");
+    return !(match && p_match);
+}
+
+// The HOLD dump as the blocking loop used to write it, for comparison
+static int expected_hold_dump(char * out)
+{
+    int n = sprintf(out, "%d\n\r", RUNLOG_LENGTH);
+    for (int i = 0; i < RUNLOG_LENGTH; i++)
+    {
+        n += sprintf(out + n, "%f %f\n\r", Q16_TO_DEG(runLogRef[i]), Q16_TO_DEG(runLogAct[i]));
+    }
+    return n;
+}
+
+// A HOLD's log sent by DMA while the main loop only comes round to refill a
+// block every so often. Two blocks keep the line busy as long as the main loop
+// is back within one block's line time, 256 bytes at 23040 bytes/s is 11 ms.
+static int scenario_dump()
+{
+    static char expected[SIM_CAPTURE_LENGTH];
+    const float poll_ms[] = {0.2, 2, 5, 10, 20, 50};
+
+    sim_Startup(0);
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    sim_RunWhile(HOLD, 20 * SIM_TICK_HZ);
+    int length = expected_hold_dump(expected);
+    uartDma_Startup();
+
+    printf("poll_ms bytes match seconds line_seconds line_busy\n");
+    for (int k = 0; k < sizeof(poll_ms) / sizeof(poll_ms[0]); k++)
+    {
+        int every = (int)(poll_ms[k] * 1e-3 * SIM_TICK_HZ + 0.5);
+        every = (every < 1) ? 1 : every;
+        sfr_ClearCapture();
+        logDump_Start(HOLD);
+        int ticks = 0;
+        while (uartDma_Busy() && (ticks < 60 * SIM_TICK_HZ))
+        {
+            sim_Tick();
+            if (++ticks % every == 0)
+            {
+                uartDma_Poll();
+            }
+        }
+        int captured;
+        const char * out = sfr_Capture(&captured);
+        int match = (captured == length) && (memcmp(out, expected, length) == 0);
+        float line = (float)captured / SIM_UART_BYTES_HZ;
+        float seconds = logDump_Ticks() / (NU32_SYS_FREQ / 2.0);
+        printf("%.1f %d %s %.3f %.3f %.0f%%\n", poll_ms[k], captured, match ? "yes" : "no", seconds, line,
+               100 * line / seconds);
+    }
+
+    // A STATUS and a RUN sent part way through, answered as main.c does while
+    // the dump has the UART. The replies must come whole between two lines and
+    // the dump's text around them must be what it would have been.
+    static char text[SIM_CAPTURE_LENGTH];
+    unsigned char run[5] = {HOLD, 0, 0, 0, 0};
+    unsigned char status[2] = {0xFF, 0xFF};
+    int replies = 0, between = 1, text_length = 0;
+    cmdQueue_Startup();
+    sfr_ClearCapture();
+    logDump_Start(HOLD);
+    for (int ticks = 0; uartDma_Busy() && (ticks < 60 * SIM_TICK_HZ); ticks++)
+    {
+        sim_Tick();
+        uartDma_Poll();
+        if (ticks == SIM_TICK_HZ / 2)
+        {
+            host_send(BIN_OP_STATUS, 0, 0);
+            host_send(BIN_OP_RUN, run, sizeof(run));
+        }
+        if (uartDma_Busy() && (cmdQueue_NextKind() >= CMD_FRAME) && uartDma_CanInsert())
+        {
+            binProto_Service();
+        }
+    }
+    int captured;
+    const unsigned char * out = (const unsigned char *)sfr_Capture(&captured);
+    for (int i = 0; i < captured;)
+    {
+        if (out[i] != BIN_MAGIC)
+        {
+            text[text_length++] = out[i++];
+            continue;
+        }
+        between &= (i > 0) && (out[i - 1] == '\r') && (replies < 2);
+        if (replies < 2)
+        {
+            status[replies++] = out[i + 4];
+        }
+        i += 1 + BIN_HEADER_SIZE + (out[i + 2] | (out[i + 3] << 8)) + BIN_CRC_SIZE;
+    }
+    int text_match = (text_length == length) && (memcmp(text, expected, length) == 0);
+    int match = (replies == 2) && between && text_match && (status[0] == BIN_OK) && (status[1] == BIN_ERR_BUSY);
+    printf("replies between_lines text_match status run_status match\n");
+    printf("%d %s %s %d %d %s\n", replies, between ? "yes" : "no", text_match ? "yes" : "no", status[0], status[1],
+           match ? "yes" : "no");
+    return !match;
+}
+
+// The last TRACE_LENGTH events up to a few ticks after a HOLD is stopped. Sim
+// ISR times are the core timer reads they make, not how long the board takes.
+static int scenario_trace()
+{
+    sim_Startup(0);
+    uartDma_Startup();
+    trace_Start(TRACE_ALL);
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    sim_Run(SIM_TICK_HZ / 2);
+    set_mode(IDLE);
+    sim_Run(10);
+
+    sfr_ClearCapture();
+    trace_Dump();
+    int ticks = 0;
+    while (uartDma_Busy() && (ticks < 60 * SIM_TICK_HZ))
+    {
+        sim_Tick();
+        uartDma_Poll();
+        ticks++;
+    }
+    int captured;
+    const char * out = sfr_Capture(&captured);
+    fwrite(out, 1, captured, stdout);
+    return uartDma_Busy();
+}
+
+struct pwm_out_t {
+    int mode;
+    int oc;
+    int dir;
+};
+
+static struct pwm_out_t recorded_out[RECORD_LENGTH];
+static struct pwm_out_t replayed_out[RECORD_LENGTH];
+
+static void take_out(struct pwm_out_t * out)
+{
+    out->mode = get_mode();
+    out->oc = OC1RS;
+    out->dir = MOTOR_DIR;
+}
+
+static void replayed_tick(int tick, void * context)
+{
+    if (tick < RECORD_LENGTH)
+    {
+        take_out(&replayed_out[tick]);
+    }
+}
+
+// HOLD steps with INA219 noise and a new setpoint part way, recorded until the
+// buffer is full, then sent through the UART3 DMA stand-in and replayed from
+// the text. The PWM going into each tick has to come out the same.
+static int scenario_record(const char * path)
+{
+    static struct replay_t r;
+    static char text[SIM_CAPTURE_LENGTH + 1];
+
+    sim_Startup(0);
+    uartDma_Startup();
+    plant_SetCurrentNoise(20);
+    if (record_Start())
+    {
+        printf("refused\n");
+        return 1;
+    }
+    setDesiredAngle(DEG_TO_Q16(45));
+    set_mode(HOLD);
+    int ticks = 0;
+    while (record_Recording() && (ticks < RECORD_LENGTH))
+    {
+        if (ticks == SIM_TICK_HZ / 4)
+        {
+            setDesiredAngle(DEG_TO_Q16(-30));
+        }
+        take_out(&recorded_out[ticks++]);
+        sim_Tick();
+    }
+    set_mode(IDLE);
+
+    sfr_ClearCapture();
+    record_Dump();
+    int waited = 0;
+    while (uartDma_Busy() && (waited < 60 * SIM_TICK_HZ))
+    {
+        sim_Tick();
+        uartDma_Poll();
+        waited++;
+    }
+    int captured;
+    const char * out = sfr_Capture(&captured);
+    memcpy(text, out, captured);
+    text[captured] = '\0';
+    FILE * f = path ? fopen(path, "wb") : 0;
+    if (f)
+    {
+        fwrite(text, 1, captured, f);
+        fclose(f);
+    }
+    if (replay_Parse(text, &r))
+    {
+        printf("dump did not parse\n");
+        return 1;
+    }
+
+    int replayed;
+    int diverged = replay_Run(&r, replayed_tick, 0, &replayed);
+    int n = (replayed < ticks) ? replayed : ticks;
+    int mismatch = -1;
+    for (int i = 0; (i < n) && (mismatch < 0); i++)
+    {
+        if (memcmp(&recorded_out[i], &replayed_out[i], sizeof(struct pwm_out_t)) != 0)
+        {
+            mismatch = i;
+        }
+    }
+    printf("ticks words dump_bytes replayed diverged first_mismatch match\n");
+    printf("%d %d %d %d %s %d %s\n", ticks, r.length, captured, replayed, diverged ? "yes" : "no", mismatch,
+           (!diverged && (mismatch < 0) && (replayed >= ticks - 1)) ? "yes" : "no");
+    free(r.words);
+    return diverged || (mismatch >= 0);
+}
+
+// config.c's record header, to write the records it would not
+#define NVM_RECORD_MAGIC 0xC0F6
+#define NVM_RECORD_CRC_START 10
+
+struct nvm_record_t {
+    unsigned short magic;
+    unsigned char version;
+    unsigned char type;
+    unsigned int seq;
+    unsigned short length;
+    unsigned short crc;
+};
+
+#define SETTINGS_SIZE (sizeof(struct nvm_record_t) + ((sizeof(struct config_t) + 3) & ~3))
+
+static int nvm_failed = 0;
+
+static void nvm_check(const char * check, int ok, const char * detail)
+{
+    printf("%s %s %s\n", check, ok ? "yes" : "no", detail);
+    nvm_failed |= !ok;
+}
+
+static void nvm_record(struct nvm_record_t * r, int version, int type, unsigned int seq, const void * payload,
+                       int length)
+{
+    r->magic = NVM_RECORD_MAGIC;
+    r->version = version;
+    r->type = type;
+    r->seq = seq;
+    r->length = length;
+    r->crc = crc16(crc16(CRC16_INIT, r, NVM_RECORD_CRC_START), payload, length);
+}
+
+// Where config_Save appends next, past the last header on the page with the
+// newest settings record. bad counts the headers whose CRC does not match.
+static int settings_end(int * page, unsigned int * seq, int * bad)
+{
+    int ends[NVM_CONFIG_PAGES];
+    int found = 0;
+    *page = 0;
+    *seq = 0;
+    *bad = 0;
+    for (int p = 0; p < NVM_CONFIG_PAGES; p++)
+    {
+        int offset = 0;
+        while (offset + sizeof(struct nvm_record_t) <= NVM_PAGE_SIZE)
+        {
+            const struct nvm_record_t * r = (const struct nvm_record_t *)(nvm_page(p) + offset);
+            if ((r->magic != NVM_RECORD_MAGIC) || (offset + sizeof(*r) + r->length > NVM_PAGE_SIZE))
+            {
+                break;
+            }
+            *bad += (crc16(crc16(CRC16_INIT, r, NVM_RECORD_CRC_START), r + 1, r->length) != r->crc);
+            if (!found || (r->seq > *seq))
+            {
+                found = 1;
+                *page = p;
+                *seq = r->seq;
+            }
+            offset += sizeof(*r) + ((r->length + 3) & ~3);
+        }
+        ends[p] = offset;
+    }
+    return ends[*page];
+}
+
+// Settings saved with position_p = value, then put back from flash over a clobbered gain
+static float save_and_load(float value, int * saved)
+{
+    setPositionGains(value, getPositionI(), getPositionD());
+    *saved = (config_Save() == 0);
+    setPositionGains(-1, getPositionI(), getPositionD());
+    config_Startup();
+    return getPositionP();
+}
+
+static int slot_length(int id)
+{
+    return 400 + 500 * id;
+}
+
+static void slot_fill(int id)
+{
+    referenceTrajectoryLength = slot_length(id);
+    for (int i = 0; i < referenceTrajectoryLength; i++)
+    {
+        referenceTrajectory[i] = (id + 1) * 100000 + i * (id + 3);
+    }
+}
+
+static int slot_matches(int id)
+{
+    int length = referenceTrajectoryLength;
+    if (length != slot_length(id))
+    {
+        return 0;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        if (referenceTrajectory[i] != (id + 1) * 100000 + i * (id + 3))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The settings and trajectory store on nvm.c's RAM pages, which follow the flash
+// rules and can have the power cut part way through a write. Every row has to
+// say yes.
+static int scenario_nvm()
+{
+    char detail[128];
+    char name[CONFIG_NAME_LENGTH];
+    int saved, page, bad;
+    unsigned int seq;
+
+    sim_Startup(0);
+    printf("check ok detail\n");
+
+    // Page rotation and wear: records fill one page before the next is erased,
+    // so the pages are erased in turn and each only every other time round
+    const int saves = 1000;
+    const int per_page = NVM_PAGE_SIZE / SETTINGS_SIZE;
+    int loaded = 0;
+    for (int i = 1; i <= saves; i++)
+    {
+        float value = save_and_load(i, &saved);
+        loaded += saved && (value == i);
+    }
+    int erases = 0, most = 0, least = saves;
+    for (int p = 0; p < NVM_CONFIG_PAGES; p++)
+    {
+        erases += nvm_erase_count(p);
+        most = (nvm_erase_count(p) > most) ? nvm_erase_count(p) : most;
+        least = (nvm_erase_count(p) < least) ? nvm_erase_count(p) : least;
+    }
+    sprintf(detail, "%d of %d saves loaded back, %d erases for %d records a page, %d to %d a page", loaded, saves,
+            erases, per_page, least, most);
+    nvm_check("rotation", (loaded == saves) && (erases == (saves - 1) / per_page) && (most - least <= 1), detail);
+
+    // A record whose payload lost a bit is passed over for the one before it,
+    // and the next save goes in after it
+    save_and_load(2000, &saved);
+    save_and_load(2001, &saved);
+    int end = settings_end(&page, &seq, &bad);
+    int offset = end - SETTINGS_SIZE + sizeof(struct nvm_record_t) + offsetof(struct config_t, position_p);
+    unsigned int word;
+    memcpy(&word, nvm_page(page) + offset, 4);
+    word &= word - 1;       // programming clears the lowest set bit
+    int corrupted = (nvm_write(page, offset, &word, 4) == 0);
+    setPositionGains(-1, getPositionI(), getPositionD());
+    config_Startup();
+    float after_bad = getPositionP();
+    float next = save_and_load(2002, &saved);
+    sprintf(detail, "loaded %.0f past the bad record, %.0f saved after it", after_bad, next);
+    nvm_check("bad_crc", corrupted && (after_bad == 2000) && saved && (next == 2002), detail);
+
+    // An older firmware's shorter settings record is loaded over the defaults,
+    // a trajectory of another version is not loaded at all
+    struct config_t old;
+    struct nvm_record_t r;
+    memset(&old, 0, sizeof(old));
+    old.current_p = getCurrentP();
+    old.current_i = getCurrentI();
+    old.position_p = 3000;
+    old.trajectory_id = -1;
+    end = settings_end(&page, &seq, &bad);
+    nvm_record(&r, CONFIG_VERSION - 1, 1, seq + 1, &old, offsetof(struct config_t, cogging_enabled));
+    int written = (end + SETTINGS_SIZE <= NVM_PAGE_SIZE)
+        && !nvm_write(page, end + sizeof(r), &old, offsetof(struct config_t, cogging_enabled))
+        && !nvm_write(page, end, &r, sizeof(r));
+    setCoggingCompensation(1);
+    config_Startup();
+    int kept = getCoggingCompensation();
+    float old_p = getPositionP();
+    setCoggingCompensation(0);
+
+    int slot = NVM_TRAJ_SLOTS - 1;
+    int first = NVM_CONFIG_PAGES + slot * NVM_TRAJ_SLOT_PAGES;
+    static unsigned char payload[CONFIG_NAME_LENGTH + 100 * sizeof(int)];
+    memset(payload, 0, sizeof(payload));
+    strcpy((char *)payload, "old");
+    nvm_record(&r, CONFIG_TRAJ_VERSION - 1, 2, 0, payload, sizeof(payload));
+    written = written && !nvm_erase_page(first) && !nvm_erase_page(first + 1)
+        && !nvm_write(first, sizeof(r), payload, sizeof(payload)) && !nvm_write(first, 0, &r, sizeof(r));
+    int old_info = config_GetTrajectoryInfo(slot, name);
+    int old_select = config_SelectTrajectory(slot);
+    sprintf(detail, "settings v%d loaded p %.0f with cogging left %d, trajectory v%d info %d select %d",
+            CONFIG_VERSION - 1, old_p, kept, CONFIG_TRAJ_VERSION - 1, old_info, old_select);
+    nvm_check("version", written && (old_p == 3000) && kept && (old_info == -1) && (old_select == -1), detail);
+
+    // Power cut after every number of words of a save: the header goes last,
+    // so a cut save leaves no header behind, start up finds either the new
+    // record or the one before, and the save after it still lands
+    float before = save_and_load(4000, &saved);
+    int torn = 0, torn_ok = 1, words;
+    for (words = 0; words < 64; words++)
+    {
+        float value = 4001 + words;
+        int bad_before, bad_after;
+        settings_end(&page, &seq, &bad_before);
+        setPositionGains(value, getPositionI(), getPositionD());
+        nvm_cut_power(words);
+        int failed = config_Save();
+        nvm_cut_power(-1);
+        settings_end(&page, &seq, &bad_after);
+        torn_ok = torn_ok && (bad_after <= bad_before);
+        setPositionGains(-1, getPositionI(), getPositionD());
+        config_Startup();
+        torn_ok = torn_ok && (getPositionP() == (failed ? before : value));
+        if (!failed)
+        {
+            break;
+        }
+        torn++;
+    }
+    float recovered = save_and_load(5000, &saved);
+    sprintf(detail, "%d cut saves left %.0f loaded, whole after %d words, %.0f saved after", torn, before, words,
+            recovered);
+    nvm_check("torn_settings", torn_ok && (torn > 0) && saved && (recovered == 5000), detail);
+
+    // Each slot stored and selected back with its name, and the selected slot
+    // loaded again at start up through the saved settings
+    int slots_ok = 1;
+    for (int id = 0; id < NVM_TRAJ_SLOTS; id++)
+    {
+        char label[CONFIG_NAME_LENGTH];
+        sprintf(label, "slot%d", id);
+        slot_fill(id);
+        slots_ok = slots_ok && (config_StoreTrajectory(id, label) == 0);
+    }
+    for (int id = 0; id < NVM_TRAJ_SLOTS; id++)
+    {
+        char label[CONFIG_NAME_LENGTH];
+        sprintf(label, "slot%d", id);
+        memset(referenceTrajectory, 0, sizeof(referenceTrajectory));
+        referenceTrajectoryLength = 0;
+        slots_ok = slots_ok && (config_SelectTrajectory(id) == slot_length(id)) && slot_matches(id)
+            && (config_GetTrajectoryInfo(id, name) == slot_length(id)) && (strcmp(name, label) == 0);
+    }
+    int refused = (config_StoreTrajectory(NVM_TRAJ_SLOTS, "x") != 0) && (config_SelectTrajectory(-1) == -1);
+    config_SelectTrajectory(2);
+    int startup_saved = (config_Save() == 0);
+    memset(referenceTrajectory, 0, sizeof(referenceTrajectory));
+    referenceTrajectoryLength = 0;
+    config_Startup();
+    int startup_ok = startup_saved && slot_matches(2);
+    sprintf(detail, "%d slots of %d to %d samples, out of range %s, slot 2 at start up %s", NVM_TRAJ_SLOTS,
+            slot_length(0), slot_length(NVM_TRAJ_SLOTS - 1), refused ? "refused" : "taken",
+            startup_ok ? "loaded" : "missing");
+    nvm_check("slots", slots_ok && refused && startup_ok, detail);
+
+    // A trajectory uploaded after a slot was selected is what a save keeps,
+    // start up leaves it alone rather than going back to the slot
+    unsigned char write[4 + 3 * sizeof(float)];
+    const unsigned short count = 3, at = 0;
+    const float uploaded[3] = {10, 20, 30};
+    memcpy(write, &count, 2);
+    memcpy(write + 2, &at, 2);
+    memcpy(write + 4, uploaded, sizeof(uploaded));
+    cmdQueue_Startup();
+    binProto_Startup();
+    config_SelectTrajectory(2);
+    host_frame(BIN_OP_TRAJ_WRITE, write, sizeof(write));
+    int upload_saved = (config_Save() == 0);
+    config_Startup();
+    int kept_upload = (referenceTrajectoryLength == 3) && (referenceTrajectory[2] == DEG_TO_Q16(30));
+    sprintf(detail, "slot 2 selected, 3 samples written over it by frame, at start up %d samples",
+            referenceTrajectoryLength);
+    nvm_check("upload", upload_saved && kept_upload, detail);
+
+    // A cut trajectory store leaves the slot as it was when the erase did not
+    // happen, empty when it did, never with part of a trajectory
+    int total = (sizeof(r) + CONFIG_NAME_LENGTH + slot_length(1) * sizeof(int)) / 4;
+    const int cuts[] = {0, 1, 10, total / 2, total - 3, total - 1};
+    int cut_ok = 1, emptied = 0;
+    for (int k = 0; k < sizeof(cuts) / sizeof(cuts[0]); k++)
+    {
+        slot_fill(1);
+        nvm_cut_power(cuts[k]);
+        int failed = config_StoreTrajectory(1, "cut");
+        nvm_cut_power(-1);
+        memset(referenceTrajectory, 0, sizeof(referenceTrajectory));
+        referenceTrajectoryLength = 0;
+        int length = config_SelectTrajectory(1);
+        int whole = (length == slot_length(1)) && slot_matches(1);
+        cut_ok = cut_ok && (failed ? ((length == -1) || whole) : whole);
+        emptied += (length == -1);
+    }
+    slot_fill(1);
+    int restored = (config_StoreTrajectory(1, "slot1") == 0) && (config_SelectTrajectory(1) == slot_length(1))
+        && slot_matches(1);
+    sprintf(detail, "cut at %d points of %d words, %d left empty, stored again %s",
+            (int)(sizeof(cuts) / sizeof(cuts[0])), total, emptied, restored ? "yes" : "no");
+    nvm_check("torn_slot", cut_ok && (emptied > 0) && restored, detail);
+
+    return nvm_failed;
+}
+
+static int scenario_replay(const char * path)
+{
+    static struct replay_t r;
+    FILE * f = path ? fopen(path, "rb") : 0;
+    if (!f)
+    {
+        fprintf(stderr, "usage: nu32sim replay <file>\n");
+        return 1;
+    }
+    static char text[SIM_CAPTURE_LENGTH + 1];
+    int length = fread(text, 1, SIM_CAPTURE_LENGTH, f);
+    fclose(f);
+    text[length] = '\0';
+    if (replay_Parse(text, &r))
+    {
+        fprintf(stderr, "%s is not a recording\n", path);
+        return 1;
+    }
+    if (replay_Warnings(&r)[0] != '\0')
+    {
+        fprintf(stderr, "%s\n", replay_Warnings(&r));
+    }
+    int replayed;
+    int diverged = replay_Run(&r, replayed_tick, 0, &replayed);
+    printf("tick mode OC1RS dir\n");
+    for (int i = 0; (i < replayed) && (i < RECORD_LENGTH); i++)
+    {
+        printf("%d %d %d %d\n", i, replayed_out[i].mode, replayed_out[i].oc, replayed_out[i].dir);
+    }
+    if (diverged)
+    {
+        fprintf(stderr, "diverged at tick %d\n", replayed - 1);
+    }
+    free(r.words);
+    return diverged;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * scenario = (argc > 1) ? argv[1] : "ilc";
+    sim_Startup(0);
+
+    if (strcmp(scenario, "ilc") == 0)
+    {
+        return scenario_ilc((argc > 2) ? atoi(argv[2]) : 10);
+    }
+    if (strcmp(scenario, "setpoint") == 0)
+    {
+        return scenario_setpoint();
+    }
+    if (strcmp(scenario, "cascade") == 0)
+    {
+        return scenario_cascade();
+    }
+    if (strcmp(scenario, "filter") == 0)
+    {
+        return scenario_filter();
+    }
+    if (strcmp(scenario, "cogging") == 0)
+    {
+        return scenario_cogging();
+    }
+    if (strcmp(scenario, "scurve") == 0)
+    {
+        return scenario_scurve();
+    }
+    if (strcmp(scenario, "queue") == 0)
+    {
+        return scenario_queue();
+    }
+    if (strcmp(scenario, "rates") == 0)
+    {
+        return scenario_rates();
+    }
+    if (strcmp(scenario, "overrun") == 0)
+    {
+        return scenario_overrun();
+    }
+    if (strcmp(scenario, "multiturn") == 0)
+    {
+        return scenario_multiturn();
+    }
+    if (strcmp(scenario, "itest") == 0)
+    {
+        return scenario_itest(argc - 2, argv + 2);
+    }
+    if (strcmp(scenario, "telemetry") == 0)
+    {
+        if ((argc > 2) && (strcmp(argv[2], "bench") == 0))
+        {
+            telemetry_bench();
+            return 0;
+        }
+        return scenario_telemetry();
+    }
+    if (strcmp(scenario, "dump") == 0)
+    {
+        return scenario_dump();
+    }
+    if (strcmp(scenario, "trace") == 0)
+    {
+        return scenario_trace();
+    }
+    if (strcmp(scenario, "record") == 0)
+    {
+        return scenario_record((argc > 2) ? argv[2] : 0);
+    }
+    if (strcmp(scenario, "replay") == 0)
+    {
+        return scenario_replay((argc > 2) ? argv[2] : 0);
+    }
+    if (strcmp(scenario, "abort") == 0)
+    {
+        return scenario_abort();
+    }
+    if (strcmp(scenario, "nvm") == 0)
+    {
+        return scenario_nvm();
+    }
+    if (strcmp(scenario, "timestamps") == 0)
+    {
+        return scenario_timestamps((argc > 2) && (strcmp(argv[2], "cascade") == 0));
+    }
+    fprintf(stderr, "unknown scenario %s\n", scenario);
+    return 1;
+}
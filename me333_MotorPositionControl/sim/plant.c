@@ -0,0 +1,232 @@
+#include "plant.h"
+#include "encoder.h"
+#include "ina219.h"
+#include "trace.h"
+#include "record.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define CORE_TIMER_HZ (NU32_SYS_FREQ / 2)
+#define PWM_PERIOD 4000.0       // PR3 + 1
+#define SUBSTEP 5e-6            // s, well below L/R
+
+const struct plant_params_t plant_default_params = {
+    .supply = 6.0,
+    .resistance = 5.0,
+    .inductance = 5e-3,
+    .kt = 0.25,
+    .inertia = 4e-4,
+    .damping = 2e-3,
+    .friction = 5e-3,
+};
+
+static struct plant_params_t p;
+static double theta = 0;        // rad
+static double omega = 0;        // rad/s
+static double current = 0;      // A
+static double load = 0;         // Nm
+static double cogging = 0;      // Nm
+static int cogging_periods = 0;
+static double noise_ma = 0;
+static double sim_time = 0;     // s
+static long long encoder_offset = 0;
+static long long encoder_zero = 0;
+static int encoder_flag = 0;
+static long long encoder_count = 0;
+static int replaying = 0;
+static long long replay_count = 0;
+static short replay_current = 0;
+static int reads = 0;
+
+static long long raw_count()
+{
+    return (long long)floor(theta / (2 * M_PI) * COUNTS_PER_REV) + encoder_offset;
+}
+
+static double gaussian()
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+void plant_Reset(const struct plant_params_t * params)
+{
+    p = params ? *params : plant_default_params;
+    theta = omega = current = load = cogging = 0;
+    cogging_periods = 0;
+    noise_ma = 0;
+    sim_time = 0;
+    encoder_offset = encoder_zero = encoder_count = 0;
+    encoder_flag = 0;
+    replaying = 0;
+    reads = 0;
+    srand(1);
+}
+
+void plant_Replay(int on)
+{
+    replaying = on;
+    reads = 0;
+}
+
+void plant_SetInputs(long long count, short raw_current)
+{
+    replay_count = count;
+    replay_current = raw_current;
+}
+
+int plant_TakeReads()
+{
+    int n = reads;
+    reads = 0;
+    return n;
+}
+
+void plant_Step(double dt)
+{
+    double duty = OC1RS / PWM_PERIOD;
+    duty = (duty > 1) ? 1 : duty;
+    double volts = p.supply * duty * (LATDbits.LATD8 ? 1 : -1);
+
+    for (double t = 0; t < dt - SUBSTEP / 2; t += SUBSTEP)
+    {
+        current += SUBSTEP * (volts - p.resistance * current - p.kt * omega) / p.inductance;
+
+        double drive = p.kt * current - load - cogging * sin(cogging_periods * theta) - p.damping * omega;
+        if ((omega == 0) && (fabs(drive) <= p.friction))
+        {
+            continue;       // stuck
+        }
+        double accel = (drive - copysign(p.friction, (omega != 0) ? omega : drive)) / p.inertia;
+        double next = omega + SUBSTEP * accel;
+        omega = ((omega != 0) && (next * omega < 0)) ? 0 : next;   // friction stops, it never reverses
+        theta += SUBSTEP * omega;
+    }
+    sim_time += dt;
+}
+
+void plant_SetLoad(double torque)
+{
+    load = torque;
+}
+
+void plant_SetCogging(double amplitude, int periods)
+{
+    cogging = amplitude;
+    cogging_periods = periods;
+}
+
+void plant_SetCurrentNoise(double rms_ma)
+{
+    noise_ma = rms_ma;
+}
+
+void plant_SetEncoderOffset(long long counts)
+{
+    encoder_offset = counts;
+}
+
+double plant_Angle()
+{
+    return theta * 180 / M_PI;
+}
+
+double plant_Velocity()
+{
+    return omega * 180 / M_PI;
+}
+
+double plant_Current()
+{
+    return current * 1000;
+}
+
+unsigned long long plant_CoreTicks()
+{
+    return (unsigned long long)(sim_time * CORE_TIMER_HZ);
+}
+
+/*************************
+ * encoder.h, the encoder PIC answers at once
+*************************/
+
+void UART2_Startup()
+{
+}
+
+void WriteUART2(const char * string)
+{
+    trace_Record(TRACE_ENCODER_REQUEST, TRACE_INSTANT, string[0]);
+    if (string[0] == 'a')
+    {
+        encoder_count = replaying ? replay_count : raw_count() - encoder_zero;
+        encoder_flag = 1;
+        trace_Record(TRACE_ENCODER_REPLY, TRACE_INSTANT, (int)encoder_count);
+    }
+    else if (string[0] == 'b')
+    {
+        encoder_zero = raw_count();
+    }
+}
+
+int get_encoder_flag()
+{
+    return encoder_flag;
+}
+
+void set_encoder_flag(int f)
+{
+    encoder_flag = f;
+}
+
+int get_encoder_count()
+{
+    return (int)encoder_count;
+}
+
+long long get_encoder_count64()
+{
+    return encoder_count;
+}
+
+int get_encoder_rev_count()
+{
+    int c = (int)(encoder_count % COUNTS_PER_REV);
+    return (c < 0) ? c + COUNTS_PER_REV : c;
+}
+
+// Replies are in as soon as they are asked for, so there is never one on the way
+void encoder_DropReply()
+{
+    encoder_flag = 0;
+}
+
+void encoder_Zero()
+{
+    WriteUART2("b");
+    encoder_count = 0;
+}
+
+/*************************
+ * ina219.h, 1/3 mA per LSB as ina219.c configures it
+*************************/
+
+void INA219_Startup()
+{
+}
+
+float INA219_read_current()
+{
+    trace_Record(TRACE_I2C, TRACE_BEGIN, 0);
+    trace_Record(TRACE_I2C, TRACE_END, 0);
+    signed short value = replay_current;
+    if (!replaying)
+    {
+        double ma = plant_Current() + noise_ma * gaussian();
+        value = (signed short)lround(ma * 3.0);
+    }
+    reads++;
+    record_Current(value);
+    return value / 3.0;
+}
@@ -0,0 +1,39 @@
+#ifndef PLANT_H_
+#define PLANT_H_
+
+// Brushed DC motor behind the H-bridge, the encoder and the INA219, for the host
+// simulator. The firmware drives it through OC1RS and the direction pin, and reads
+// it back through the same encoder.h and ina219.h calls it uses on the board,
+// which plant.c implements in place of encoder.c and ina219.c.
+
+struct plant_params_t {
+    double supply;          // V across the H-bridge at 100% duty
+    double resistance;      // ohm
+    double inductance;      // H
+    double kt;              // Nm/A at the output shaft, also the back EMF constant in Vs/rad
+    double inertia;         // kg m^2 at the output shaft
+    double damping;         // Nm s/rad
+    double friction;        // Nm, Coulomb
+};
+
+extern const struct plant_params_t plant_default_params;
+
+void plant_Reset(const struct plant_params_t * params);
+void plant_Step(double dt);                 // advance the motor with the current OC1RS and direction
+void plant_SetLoad(double torque);          // external load torque, Nm
+void plant_SetCogging(double amplitude, int periods);   // Nm, sinusoidal in shaft angle, periods per rev
+void plant_SetCurrentNoise(double rms_ma);  // gaussian noise on INA219 readings
+void plant_SetEncoderOffset(long long counts);  // the count the encoder reads at the shaft's zero, as after many turns
+
+// Replay of a recording from record.c: the encoder and INA219 read the given
+// inputs instead of the motor, which stands still
+void plant_Replay(int on);
+void plant_SetInputs(long long count, short raw_current);
+int plant_TakeReads();          // INA219 reads since the last call
+
+double plant_Angle();           // degrees at the output shaft
+double plant_Velocity();        // degrees/s
+double plant_Current();         // mA, the true winding current
+unsigned long long plant_CoreTicks();   // core timer ticks of simulated time
+
+#endif
@@ -0,0 +1,155 @@
+#include "replay.h"
+#include "sim.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "velocitycontrol.h"
+#include "itest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The ISRs, defined in currentcontrol.c and positioncontrol.c
+void CurrentController(void);
+void PositionController(void);
+
+static long long count_at(const unsigned int * w)
+{
+    return (long long)(((unsigned long long)w[1] << 32) | w[0]);
+}
+
+int replay_Parse(const char * text, struct replay_t * r)
+{
+    int header_words, trajectory_length, length, n;
+    if ((sscanf(text, "%d %d %d%n", &header_words, &trajectory_length, &length, &n) != 3)
+        || (header_words != (int)RECORD_HEADER_WORDS) || (trajectory_length < 0)
+        || (trajectory_length > MAX_REF_TRAJ_LENGTH) || (length < 0))
+    {
+        return 1;
+    }
+    text += n;
+    unsigned int * values = malloc((header_words + trajectory_length + length) * sizeof(unsigned int));
+    for (int i = 0; i < header_words + trajectory_length + length; i++)
+    {
+        if (sscanf(text, "%u%n", &values[i], &n) != 1)
+        {
+            free(values);
+            return 1;
+        }
+        text += n;
+    }
+    memcpy(&r->header, values, sizeof(r->header));
+    for (int i = 0; i < trajectory_length; i++)
+    {
+        r->trajectory[i] = values[header_words + i];
+    }
+    r->length = length;
+    r->words = malloc((length + 1) * sizeof(unsigned int));
+    memcpy(r->words, values + header_words + trajectory_length, length * sizeof(unsigned int));
+    free(values);
+    return (r->header.version == RECORD_VERSION) ? 0 : 1;
+}
+
+const char * replay_Warnings(const struct replay_t * r)
+{
+    static char text[128];
+    const char * names[] = {"ILC", "cogging compensation", "filters", "shaping", "cascade", "segment queue"};
+    text[0] = '\0';
+    for (int i = 0; i < 6; i++)
+    {
+        if (r->header.features & (1u << i))
+        {
+            strcat(text, (text[0] != '\0') ? ", " : "not exact, on: ");
+            strcat(text, names[i]);
+        }
+    }
+    return text;
+}
+
+// The settings and loop state the recording started from, IDLE
+static void restore(const struct replay_t * r)
+{
+    const struct record_header_t * h = &r->header;
+    sim_Startup(0);
+    setCurrentLoopRate(h->current_hz);
+    setPositionLoopRate(h->position_hz);
+    velocityControl_Retime();
+    setCurrentGains(h->current_p, h->current_i);
+    setPositionGains(h->position_p, h->position_i, h->position_d);
+    setDesiredCurrent(h->desired_current);
+    positionControl_SetState(&h->position);
+    setITest(&h->itest);
+    memcpy(referenceTrajectory, r->trajectory, h->trajectory_length * sizeof(int));
+    referenceTrajectoryLength = h->trajectory_length;
+}
+
+int replay_Run(const struct replay_t * r, replay_tick_t each, void * context, int * ticks)
+{
+    restore(r);
+    plant_Replay(1);
+    long long count = 0;       // until the first position tick or setpoint says
+    int diverged = 0;
+    *ticks = 0;
+    for (int i = 0; (i < r->length) && !diverged; i++)
+    {
+        const unsigned int * w = &r->words[i];
+        int left = r->length - i;
+        switch (RECORD_TYPE(*w))
+        {
+        case RECORD_TICK:
+        {
+            int recorded = (*w & RECORD_READING) != 0;
+            if (each)
+            {
+                each(*ticks, context);
+            }
+            plant_SetInputs(count, (short)(*w & 0xFFFF));
+            CurrentController();
+            diverged = (plant_TakeReads() != recorded);
+            (*ticks)++;
+            break;
+        }
+        case RECORD_POSITION:
+        {
+            if (left < 3)
+            {
+                break;
+            }
+            count = count_at(w + 1);
+            plant_SetInputs(count, 0);
+            PositionController();
+            i += 2;
+            break;
+        }
+        case RECORD_MODE:
+        {
+            diverged = (get_mode() != ((*w >> 8) & 0xFF));
+            set_mode(*w & 0xFF);
+            break;
+        }
+        case RECORD_ANGLE:
+        {
+            if (left < 4)
+            {
+                break;
+            }
+            count = count_at(w + 2);
+            plant_SetInputs(count, 0);
+            setDesiredAngle((int)w[1]);
+            i += 3;
+            break;
+        }
+        case RECORD_PWM:
+        {
+            set_PWM(((int)(*w << 8)) >> 8);
+            break;
+        }
+        default:
+        {
+            diverged = 1;
+            break;
+        }
+        }
+    }
+    plant_Replay(0);
+    return diverged;
+}
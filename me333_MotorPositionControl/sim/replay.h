@@ -0,0 +1,28 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include "record.h"
+
+// Replay of a recording made by record.c on the board or in the simulator. The
+// control modules start from the recording's header and its inputs are fed back
+// through CurrentController and PositionController in the order they were taken,
+// the motor model stands still.
+//
+// Each tick is checked against the recording: a tick that reads the INA219 when
+// the recorded one did not, or the other way round, or a command for a mode the
+// replay is not in, means the loops went another way, and the replay stops there.
+
+struct replay_t {
+    struct record_header_t header;
+    int trajectory[MAX_REF_TRAJ_LENGTH];
+    unsigned int * words;
+    int length;
+};
+
+typedef void (*replay_tick_t)(int tick, void * context);    // before each current loop tick, all before it applied
+
+int replay_Parse(const char * text, struct replay_t * r);  // a 'X' dump, 0 on success
+int replay_Run(const struct replay_t * r, replay_tick_t each, void * context, int * ticks);  // 0 to the end, 1 if it diverged, after *ticks
+const char * replay_Warnings(const struct replay_t * r);   // the features on that the header does not cover
+
+#endif
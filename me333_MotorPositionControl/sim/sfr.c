@@ -0,0 +1,195 @@
+#include <xc.h>
+#include "plant.h"
+#include "sim.h"
+#include <signal.h>
+
+#define UART3_FIFO 8                // the hardware's, each way
+#define UART3_RING 4096             // bytes sent and not yet taken, a power of two
+#define UNWRITTEN 0x100             // a claimed cell no byte has been written to
+
+volatile unsigned int T2CON, PR2, TMR2, IPC2, PR3, TMR3, OC1RS, OC1R, PR4, TMR4, IPC4;
+volatile unsigned int U2TXREG, U2RXREG;
+volatile sfr_bits_t T2CONbits, T3CONbits, T4CONbits, OC1CONbits;
+volatile sfr_bits_t IFS0bits, IEC0bits, IFS1bits, IEC1bits, IPC7bits, IPC8bits, IPC9bits;
+volatile sfr_bits_t DMACONbits, DCH0CONbits, DCH0ECONbits, DCH0INTbits;
+volatile uintptr_t DCH0SSA, DCH0DSA;
+volatile unsigned int DCH0SSIZ, DCH0DSIZ, DCH0CSIZ;
+volatile sfr_bits_t U2STAbits, U3STAbits;
+volatile sfr_bits_t LATDbits, TRISDbits, LATFbits, PORTDbits;
+
+static char capture[SIM_CAPTURE_LENGTH];     // what DMA channel 0 has sent to UART3
+static int captured = 0;
+static int cell = 0;                        // bytes of the channel's block moved so far
+
+static int attached = 0;
+static volatile unsigned int tx_ring[UART3_RING];
+static volatile unsigned int tx_head = 0;
+static unsigned int tx_tail = 0;
+static volatile unsigned int tx_open = -1;  // the main loop's latest cell, it may be preempted before writing it
+static volatile unsigned int tx_dropped;    // where bytes go with nothing attached
+static unsigned char rx_fifo[UART3_FIFO];
+static int rx_head = 0, rx_tail = 0;
+
+// Channel 0 as the firmware sets it up, byte cells from the source block to
+// U3TXREG. Paced by UART3 TX requests up to bytes cells move, fewer if the TX
+// FIFO fills, a forced start alone moves one. The block done flag goes up with the last cell, the
+// return is 1 when that asks for the DMA interrupt.
+int sfr_DmaStep(int bytes)
+{
+    int size = DCH0SSIZ ? DCH0SSIZ : 256;
+    int paced = DCH0ECONbits.SIRQEN && (DCH0ECONbits.CHSIRQ == _UART3_TX_IRQ);
+    if (!DMACONbits.ON || !DCH0CONbits.CHEN || !(paced || DCH0ECONbits.CFORCE))
+    {
+        return 0;
+    }
+    bytes = paced ? bytes : 1;
+    DCH0ECONbits.CFORCE = 0;
+    while ((bytes-- > 0) && (cell < size) && !(paced && U3STAbits.UTXBF))
+    {
+        char c = ((const char *)DCH0SSA)[cell++];
+        U3TXREG = c;
+        if (captured < SIM_CAPTURE_LENGTH)
+        {
+            capture[captured++] = c;
+        }
+    }
+    if (cell < size)
+    {
+        return 0;
+    }
+    cell = 0;
+    DCH0CONbits.CHEN = 0;
+    DCH0INTbits.CHBCIF = 1;
+    if (DCH0INTbits.CHBCIE)
+    {
+        IFS1bits.DMA0IF = 1;
+    }
+    return IFS1bits.DMA0IF && IEC1bits.DMA0IE;
+}
+
+const char * sfr_Capture(int * length)
+{
+    *length = captured;
+    return capture;
+}
+
+void sfr_ClearCapture()
+{
+    captured = 0;
+}
+
+/*************************
+ * UART3
+*************************/
+
+void sfr_Uart3Attach(int on)
+{
+    attached = on;
+    tx_head = tx_tail = 0;
+    tx_open = -1;
+    rx_head = rx_tail = 0;
+    U3STAbits.UTXBF = U3STAbits.URXDA = U3STAbits.OERR = 0;
+    U3STAbits.TRMT = 1;
+}
+
+// U3TXREG: a cell for the byte about to be written. Firmware only ever
+// writes U3TXREG, except uartdma.c, which takes its address for DCH0DSA and
+// so leaves a cell that is never written, the taking side skips those.
+volatile unsigned int * sfr_Uart3Tx(void)
+{
+    if (!attached)
+    {
+        return &tx_dropped;
+    }
+    unsigned int enabled = sfr_DisableInterrupts();
+    volatile unsigned int * at = &tx_dropped;
+    if (tx_head - tx_tail < UART3_RING)
+    {
+        at = &tx_ring[tx_head % UART3_RING];
+        *at = UNWRITTEN;
+        tx_open = enabled ? tx_head : tx_open;
+        tx_head++;
+    }
+    U3STAbits.UTXBF = (tx_head - tx_tail >= UART3_FIFO);
+    U3STAbits.TRMT = 0;
+    if (enabled)
+    {
+        sfr_EnableInterrupts();
+    }
+    return at;
+}
+
+int sfr_Uart3Take(char * bytes, int max)
+{
+    int n = 0;
+    while ((n < max) && (tx_tail != tx_head))
+    {
+        unsigned int c = tx_ring[tx_tail % UART3_RING];
+        if ((c == UNWRITTEN) && (tx_tail == tx_open))
+        {
+            break;      // the main loop has the cell and has yet to write it
+        }
+        if (c != UNWRITTEN)
+        {
+            bytes[n++] = (char)c;
+        }
+        tx_tail++;
+    }
+    U3STAbits.UTXBF = (tx_head - tx_tail >= UART3_FIFO);
+    U3STAbits.TRMT = (tx_head == tx_tail);
+    return n;
+}
+
+int sfr_Uart3Receive(unsigned char c)
+{
+    if (rx_head - rx_tail >= UART3_FIFO)
+    {
+        U3STAbits.OERR = 1;
+        return 0;
+    }
+    rx_fifo[rx_head++ % UART3_FIFO] = c;
+    U3STAbits.URXDA = 1;
+    return 1;
+}
+
+unsigned int sfr_Uart3Rx(void)
+{
+    unsigned int c = 0;
+    if (rx_tail != rx_head)
+    {
+        c = rx_fifo[rx_tail++ % UART3_FIFO];
+    }
+    U3STAbits.URXDA = (rx_tail != rx_head);
+    return c;
+}
+
+int sfr_Uart3Room()
+{
+    return UART3_FIFO - (rx_head - rx_tail);
+}
+
+// As the status register's IE bit, 1 if they were on
+unsigned int sfr_DisableInterrupts(void)
+{
+    sigset_t s, old;
+    sigemptyset(&s);
+    sigaddset(&s, SIM_INTERRUPT_SIGNAL);
+    sigprocmask(SIG_BLOCK, &s, &old);
+    return !sigismember(&old, SIM_INTERRUPT_SIGNAL);
+}
+
+void sfr_EnableInterrupts(void)
+{
+    sigset_t s;
+    sigemptyset(&s);
+    sigaddset(&s, SIM_INTERRUPT_SIGNAL);
+    sigprocmask(SIG_UNBLOCK, &s, 0);
+}
+
+// Every read moves the count on by one, as the read itself takes time on the
+// board, so firmware loops that wait on the core timer also end on the host
+unsigned int _CP0_GET_COUNT(void)
+{
+    static unsigned int reads = 0;
+    return (unsigned int)plant_CoreTicks() + reads++;
+}
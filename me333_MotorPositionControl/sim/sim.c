@@ -0,0 +1,122 @@
+#include "sim.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+#include "velocitycontrol.h"
+
+// The ISRs, defined in currentcontrol.c, positioncontrol.c and uartdma.c
+void CurrentController(void);
+void PositionController(void);
+void UartDmaController(void);
+
+static unsigned long long pbclk = 0;            // peripheral bus cycles, both timers count these
+static unsigned long long next_position = 0;
+static double uart_bytes = 0;                   // line time owed to the DMA channel, bytes
+static sim_isr_runner_t runner = 0;
+
+static void run_isr(enum sim_isr_t isr, void (*handler)(void))
+{
+    if (runner)
+    {
+        runner(isr, handler);
+    }
+    else
+    {
+        handler();
+    }
+}
+
+void sim_SetIsrRunner(sim_isr_runner_t r)
+{
+    runner = r;
+}
+
+void sim_Startup(const struct plant_params_t * params)
+{
+    plant_Reset(params);
+    set_mode(IDLE);
+    setDesiredCurrent(0);
+    setCurrentLoopRate(CURRENT_RATE_DEFAULT);
+    setPositionLoopRate(POSITION_RATE_DEFAULT);
+    velocityControl_Retime();
+    currentControl_Startup();
+    positionControl_Startup();
+    pbclk = next_position = 0;
+    uart_bytes = 0;
+    sim_Tick();     // one IDLE tick, the loops reset their run state there as between runs on the board
+}
+
+// One Timer2 period, and the Timer4 expiry that falls in it. When both expire
+// together Timer2 has the higher priority and runs first. The UART3 DMA
+// channel moves the bytes the line has time for, its ISR is the lowest.
+void sim_Tick()
+{
+    unsigned int period = (PR2 + 1) * 8;
+    plant_Step((double)period / NU32_SYS_FREQ);
+    run_isr(SIM_CURRENT_ISR, CurrentController);
+    if (pbclk >= next_position)
+    {
+        run_isr(SIM_POSITION_ISR, PositionController);
+        next_position += (PR4 + 1) * 64;
+    }
+    uart_bytes += (double)period * SIM_UART_BYTES_HZ / NU32_SYS_FREQ;
+    int n = (int)uart_bytes;
+    uart_bytes -= n;
+    if (sfr_DmaStep(n))
+    {
+        run_isr(SIM_DMA_ISR, UartDmaController);
+    }
+    pbclk += period;
+}
+
+int sim_RunWhile(enum mode_t m, int max_ticks)
+{
+    int n = 0;
+    while ((get_mode() == m) && (n < max_ticks))
+    {
+        sim_Tick();
+        n++;
+    }
+    return n;
+}
+
+void sim_Run(int ticks)
+{
+    for (int i = 0; i < ticks; i++)
+    {
+        sim_Tick();
+    }
+}
+
+int sim_Cubic(int * samples, int start, float from, float to, float seconds)
+{
+    int n = (int)(seconds / getPositionDT());
+    for (int i = 0; i < n; i++)
+    {
+        float s = (float)i / n;
+        float deg = from + (to - from) * (3 * s * s - 2 * s * s * s);
+        samples[start + i] = DEG_TO_Q16(deg);
+    }
+    return start + n;
+}
+
+int sim_Quintic(int * samples, int start, float from, float to, float seconds)
+{
+    int n = (int)(seconds / getPositionDT());
+    for (int i = 0; i < n; i++)
+    {
+        float s = (float)i / n;
+        float deg = from + (to - from) * s * s * s * (10 - 15 * s + 6 * s * s);
+        samples[start + i] = DEG_TO_Q16(deg);
+    }
+    return start + n;
+}
+
+int sim_Hold(int * samples, int start, float at, float seconds)
+{
+    int n = (int)(seconds / getPositionDT());
+    for (int i = 0; i < n; i++)
+    {
+        samples[start + i] = DEG_TO_Q16(at);
+    }
+    return start + n;
+}
@@ -0,0 +1,48 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "utilities.h"
+#include "plant.h"
+#include <signal.h>
+
+#define SIM_TICK_HZ 5000        // Timer2, the current loop, at the default rates
+#define SIM_POSITION_DIVIDER 25 // Timer4 fires every 25th Timer2 period, 200 Hz
+#define SIM_UART_BYTES_HZ 23040 // UART3 at 230400 baud, 10 bits a byte
+#define SIM_CAPTURE_LENGTH (1 << 17)
+#define SIM_INTERRUPT_SIGNAL SIGALRM    // the emulator runs the ISRs from its handler
+
+void sim_Startup(const struct plant_params_t * params);    // plant and control modules from reset, default rates
+void sim_Tick();                                            // one current loop period, as PR2 sets it
+int sim_RunWhile(enum mode_t m, int max_ticks);             // ticks run, stops once the mode changes
+void sim_Run(int ticks);
+
+// How sim_Tick calls the ISRs, for nu32bench to time them and measure their
+// stack, 0 calls them directly
+enum sim_isr_t {
+    SIM_CURRENT_ISR,
+    SIM_POSITION_ISR,
+    SIM_DMA_ISR,
+    SIM_ISRS
+};
+
+typedef void (*sim_isr_runner_t)(enum sim_isr_t isr, void (*handler)(void));
+void sim_SetIsrRunner(sim_isr_runner_t runner);
+
+// DMA stand-in in sfr.c, sim_Tick moves channel 0 at the UART3 line rate
+int sfr_DmaStep(int bytes);                         // 1 when a finished block raises the DMA interrupt
+const char * sfr_Capture(int * length);             // bytes channel 0 has sent to UART3
+void sfr_ClearCapture();
+
+// UART3 stand-in in sfr.c, for the emulator. Unattached, bytes written are
+// dropped at once and nothing is received.
+void sfr_Uart3Attach(int on);
+int sfr_Uart3Take(char * bytes, int max);           // sent bytes, oldest first, from the interrupt side
+int sfr_Uart3Receive(unsigned char c);              // 0 and OERR when the receive FIFO is full, the byte is lost
+int sfr_Uart3Room();                                // bytes the receive FIFO has room for
+
+// Trajectories as the Python client builds them, Q16 degrees at the position loop rate
+int sim_Cubic(int * samples, int start, float from, float to, float seconds);
+int sim_Quintic(int * samples, int start, float from, float to, float seconds);
+int sim_Hold(int * samples, int start, float at, float seconds);
+
+#endif
@@ -0,0 +1,251 @@
+#include "telemetry.h"
+#include "hotpath.h"
+#include "binproto.h"
+#include "crc16.h"
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static unsigned char slots[TLM_SLOTS][TLM_FRAME_MAX];
+
+// Free running slot counters, the ISR moves the head and the main loop the tail
+static volatile unsigned int head = 0, tail = 0;
+static volatile unsigned int mask = 0;
+static volatile int decimation = 1;
+static volatile unsigned int dropped = 0;
+static int frame_length = 0;        // bytes, magic to CRC, the same for every slot
+static unsigned short crc_seed;     // CRC of opcode, length, status and mask
+
+static unsigned int sequence = 0;   // ISR, records since the subscription
+static int tick = 0;                // ISR, position ticks since the last record
+static int open = 0;                // ISR, the head slot is being filled
+static int filled = 0;              // ISR, records in it
+static int age = 0;                 // ISR, position ticks since it was opened
+static unsigned char * fill;        // ISR, where its next byte goes
+static unsigned short crc;          // ISR, its CRC so far
+
+static int tx_pos = 0;              // main loop, bytes of the tail slot sent
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// The compiler must not move the slot stores past the head that publishes
+// them, nor the UART's reads of a slot past the tail that hands it back
+#define PUBLISH_BARRIER() __asm__ volatile ("" ::: "memory")
+
+// Stop the ISR first, so the slots can be emptied and laid out for the new mask.
+// A frame on its way out is finished before its header is rewritten.
+int telemetry_Subscribe(unsigned int m, int d)
+{
+    if ((m & ~TLM_ALL) || (d < 1) || (d > TLM_DECIMATION_MAX))
+    {
+        return 1;
+    }
+    mask = 0;
+    PUBLISH_BARRIER();
+    telemetry_Flush();
+
+    int words = 1;
+    for (int s = 0; s < TLM_SIGNALS; s++)
+    {
+        words += (m >> s) & 1;
+    }
+    int length = 2 + TLM_FRAME_RECORDS * 4 * words;     // status, mask and the records
+    frame_length = 1 + BIN_HEADER_SIZE + length + BIN_CRC_SIZE;
+    for (int i = 0; i < TLM_SLOTS; i++)
+    {
+        slots[i][0] = BIN_MAGIC;
+        slots[i][1] = BIN_OP_TELEMETRY | BIN_REPLY;
+        slots[i][2] = length & 0xFF;
+        slots[i][3] = length >> 8;
+        slots[i][4] = BIN_OK;
+        slots[i][5] = m;
+    }
+    crc_seed = crc16(CRC16_INIT, &slots[0][1], BIN_HEADER_SIZE + 2);
+
+    decimation = d;
+    tick = 0;
+    sequence = 0;
+    dropped = 0;
+    open = 0;
+    tail = head;
+    tx_pos = 0;
+    PUBLISH_BARRIER();
+    mask = m;
+    return 0;
+}
+
+unsigned int telemetry_Mask()
+{
+    return mask;
+}
+
+int telemetry_Decimation()
+{
+    return decimation;
+}
+
+unsigned int telemetry_Dropped()
+{
+    return dropped;
+}
+
+const unsigned char * telemetry_NextFrame(int * length)
+{
+    if (head == tail)
+    {
+        return 0;
+    }
+    *length = frame_length;
+    return slots[tail % TLM_SLOTS];
+}
+
+void telemetry_Release()
+{
+    PUBLISH_BARRIER();
+    tail++;
+}
+
+void telemetry_Poll()
+{
+    int length;
+    const unsigned char * frame;
+    while ((frame = telemetry_NextFrame(&length)) != 0)
+    {
+        while ((tx_pos < length) && !U3STAbits.UTXBF)
+        {
+            U3TXREG = frame[tx_pos++];
+        }
+        if (tx_pos < length)
+        {
+            return;     // the UART is full, carry on next time round
+        }
+        tx_pos = 0;
+        telemetry_Release();
+    }
+}
+
+void telemetry_Flush()
+{
+    int length;
+    const unsigned char * frame = telemetry_NextFrame(&length);
+    if ((frame == 0) || (tx_pos == 0))
+    {
+        return;
+    }
+    while (tx_pos < length)
+    {
+        while (U3STAbits.UTXBF)
+        {
+            ;
+        }
+        U3TXREG = frame[tx_pos++];
+    }
+    tx_pos = 0;
+    telemetry_Release();
+}
+
+
+/*************************
+ * ISR SIDE
+*************************/
+
+// Works on a copy of fill and crc, stores through the char pointer would
+// otherwise have them reloaded for every byte
+static HOT unsigned char * put_word(unsigned char * p, unsigned short * c, unsigned int v)
+{
+    unsigned short r = *c;
+    for (int k = 0; k < 4; k++, v >>= 8)
+    {
+        *p++ = v & 0xFF;
+        r = CRC16_UPDATE(r, v);
+    }
+    *c = r;
+    return p;
+}
+
+// Records the frame has no room for are all ones, sequence 0xFFFFFFFF included
+static HOT void publish()
+{
+    unsigned char * end = slots[head % TLM_SLOTS] + frame_length - BIN_CRC_SIZE;
+    while (fill < end)
+    {
+        fill = put_word(fill, &crc, 0xFFFFFFFF);
+    }
+    end[0] = crc & 0xFF;
+    end[1] = crc >> 8;
+    PUBLISH_BARRIER();
+    head++;
+    open = 0;
+}
+
+HOT int telemetry_Due()
+{
+    if (mask == 0)
+    {
+        return 0;
+    }
+    if (open && (++age >= TLM_FRAME_AGE_MAX))
+    {
+        publish();      // slow decimations still arrive every so often
+    }
+    if (++tick < decimation)
+    {
+        return 0;
+    }
+    tick = 0;
+    return 1;
+}
+
+// A due record left out, counted and skipped in the sequence as a dropped one
+HOT void telemetry_Drop()
+{
+    dropped++;
+    sequence++;
+}
+
+HOT void telemetry_Put(const union telemetry_word_t * values)
+{
+    unsigned int m = mask;
+    if (!open)
+    {
+        if (head - tail >= TLM_SLOTS)
+        {
+            dropped++;
+            sequence++;
+            return;
+        }
+        fill = &slots[head % TLM_SLOTS][6];
+        crc = crc_seed;
+        filled = 0;
+        age = 0;
+        open = 1;
+    }
+    unsigned char * p = fill;
+    unsigned short c = crc;
+    p = put_word(p, &c, sequence++);
+    for (int s = 0; s < TLM_SIGNALS; s++)
+    {
+        if (m & (1 << s))
+        {
+            p = put_word(p, &c, values[s].i);
+        }
+    }
+    fill = p;
+    crc = c;
+    if (++filled == TLM_FRAME_RECORDS)
+    {
+        publish();
+    }
+}
+
+HOT void telemetry_Close()
+{
+    if ((mask != 0) && open)
+    {
+        publish();
+    }
+}
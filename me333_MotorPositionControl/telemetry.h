@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+
+// Live telemetry, streamed to the host while HOLD and TRACK run.
+//
+// The host subscribes to a set of signals and a decimation. Every decimation-th
+// HOLD or TRACK tick the Timer4 ISR puts one record into a ring: a sequence
+// number counting records since the subscription, then the subscribed signals
+// in the order below.
+//
+// The ring holds whole outgoing frames. Their headers are written once, at the
+// subscription, and the ISR writes each record straight into the frame being
+// filled, updating its CRC byte by byte. A frame is published once it is full,
+// TLM_FRAME_AGE_MAX ticks after its first record, or when the run ends, and
+// the main loop hands it to the UART from where it is, only as many bytes as
+// the UART can take without waiting. Nothing is copied on the way.
+//
+// The ISR owns the head and the main loop the tail, so neither ever waits for
+// the other. A record that finds every slot taken is dropped and counted, the
+// gap shows in the sequence numbers, as does one a loop overrun leaves out.
+// A frame already started is finished before anything else is written to
+// UART3, so replies never land inside one.
+// While a menu command waits for its next line nothing is sent, the slots take
+// up the slack for TLM_SLOTS * TLM_FRAME_RECORDS records.
+//
+// frame:  BIN_MAGIC, BIN_OP_TELEMETRY | BIN_REPLY, length, status 0, mask,
+//         TLM_FRAME_RECORDS records, CRC-16
+// record: uint32 sequence, then one 4 byte word per subscribed signal. The
+//         records a frame published early has no room for are all 0xFF.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+enum telemetry_signal_t {
+    TLM_ANGLE,          // int32, measured angle, Q16 degrees
+    TLM_ANGLE_ERROR,    // float, degrees
+    TLM_COMMAND,        // float, current command, mA
+    TLM_CURRENT,        // float, measured current, mA
+    TLM_PWM,            // int32, signed duty cycle, %
+    TLM_ERROR_SUM,      // float, current loop integrator
+    TLM_SIGNALS
+};
+
+#define TLM_ALL ((1 << TLM_SIGNALS) - 1)
+#define TLM_SLOTS 16                // frames, a power of two
+#define TLM_FRAME_RECORDS 4
+#define TLM_FRAME_AGE_MAX 20        // position ticks a part filled frame waits for more
+#define TLM_DECIMATION_MAX 1000
+#define TLM_FRAME_MAX (1 + 3 + 2 + TLM_FRAME_RECORDS * 4 * (1 + TLM_SIGNALS) + 2)
+
+union telemetry_word_t {
+    int i;
+    float f;
+};
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int telemetry_Subscribe(unsigned int mask, int decimation);    // mask 0 stops, 0 on success
+unsigned int telemetry_Mask();
+int telemetry_Decimation();
+unsigned int telemetry_Dropped();       // records lost to a full ring since the subscription
+const unsigned char * telemetry_NextFrame(int * length);    // oldest published frame, 0 if none
+void telemetry_Release();   // that frame is sent, its slot goes back to the ISR
+void telemetry_Poll();      // main loop, moves frames out without blocking
+void telemetry_Flush();     // finish the frame in progress, before any other UART3 write
+
+int telemetry_Due();        // ISR side, every HOLD and TRACK tick, 1 if it takes a record
+void telemetry_Put(const union telemetry_word_t * values);     // all TLM_SIGNALS, the mask picks
+void telemetry_Drop();      // a due record left out, counted as dropped
+void telemetry_Close();     // ISR side, the other ticks, publishes a part filled frame
+
+
+#endif
@@ -0,0 +1,96 @@
+#include "trace.h"
+#include "uartdma.h"
+#include "format.h"
+#include "hotpath.h"
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+struct trace_entry_t {
+    unsigned int time;
+    unsigned char event;
+    unsigned char phase;
+    int payload;
+};
+
+static struct trace_entry_t ring[TRACE_LENGTH];
+static volatile unsigned int head = 0;      // entries claimed since the start, the next slot modulo the length
+static volatile unsigned int mask = 0;
+
+// the dump, a count line then one line an entry
+static unsigned int first = 0;
+static int count = 0;
+static int next = -1;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+void trace_Start(unsigned int m)
+{
+    mask = 0;
+    head = 0;
+    mask = m & TRACE_ALL;
+}
+
+unsigned int trace_Mask()
+{
+    return mask;
+}
+
+HOT void trace_Record(enum trace_event_t event, enum trace_phase_t phase, int payload)
+{
+    if (!(mask & (1u << event)))
+    {
+        return;
+    }
+    unsigned int n = __sync_fetch_and_add(&head, 1);
+    struct trace_entry_t * e = &ring[n & (TRACE_LENGTH - 1)];
+    e->time = _CP0_GET_COUNT();
+    e->event = event;
+    e->phase = phase;
+    e->payload = payload;
+}
+
+static int format_line(char * line)
+{
+    if (next >= count)
+    {
+        return 0;
+    }
+    char * p = line;
+    if (next < 0)
+    {
+        p = format_Int(p, count);
+    }
+    else
+    {
+        const struct trace_entry_t * e = &ring[(first + next) & (TRACE_LENGTH - 1)];
+        p = format_Uint(p, e->time);
+        *p++ = ' ';
+        p = format_Int(p, e->event);
+        *p++ = ' ';
+        p = format_Int(p, e->phase);
+        *p++ = ' ';
+        p = format_Int(p, e->payload);
+    }
+    p = format_Str(p, "\n\r");
+    next++;
+    return p - line;
+}
+
+int trace_Dump()
+{
+    if (uartDma_Busy())
+    {
+        return 1;
+    }
+    // From the main loop, so every ISR that claimed a slot has also filled it
+    mask = 0;
+    count = (head < TRACE_LENGTH) ? head : TRACE_LENGTH;
+    first = head - count;
+    next = -1;
+    return uartDma_StartLines(format_line, 0);
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+
+// Event trace, for seeing how the ISRs and the main loop interleave.
+//
+// Each entry is the core timer count, an event id with its phase and a payload
+// word, kept in a ring that holds the last TRACE_LENGTH of them. Recording is
+// off until trace_Start() is given a mask of the events wanted, one bit an id.
+// A record claims its slot with an atomic add, so any ISR may record while it
+// preempts another, and does no more than that and three stores. A preempted
+// record can land a slot after one taken later, the host sorts by time.
+//
+// trace_Dump() stops recording and sends the ring oldest first, as a count line
+// then "<time> <event> <phase> <payload>" a line, by UART3's DMA like the run
+// logs. Recording stays off until it is started again.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define TRACE_LENGTH 1024       // entries, a power of 2
+
+enum trace_event_t {
+    TRACE_CURRENT_ISR,          // Timer2, payload the mode
+    TRACE_POSITION_ISR,         // Timer4, payload the mode
+    TRACE_ENCODER_ISR,          // UART2 RX, payload the byte
+    TRACE_HOST_ISR,             // UART3 RX, payload at the end the bytes read
+    TRACE_DMA_ISR,              // UART3 TX DMA block done
+    TRACE_COMMAND,              // main loop, payload the menu letter, 0 for a binary frame, at the begin
+    TRACE_MODE,                 // payload the old mode << 8 | the new one
+    TRACE_ENCODER_REQUEST,      // payload the letter sent
+    TRACE_ENCODER_REPLY,        // payload the count received
+    TRACE_I2C,                  // start to stop on I2C1
+    TRACE_EVENTS
+};
+
+enum trace_phase_t {
+    TRACE_INSTANT,
+    TRACE_BEGIN,
+    TRACE_END
+};
+
+#define TRACE_ALL ((1u << TRACE_EVENTS) - 1)
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+void trace_Start(unsigned int mask);    // clears the ring, 0 stops recording
+unsigned int trace_Mask();
+int trace_Dump();                       // 0 on success, 1 while UART3 is busy
+
+void trace_Record(enum trace_event_t event, enum trace_phase_t phase, int payload);   // any context
+
+
+#endif
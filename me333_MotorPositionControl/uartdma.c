@@ -0,0 +1,209 @@
+#include "uartdma.h"
+#include "trace.h"
+#include <string.h>
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static char blocks[2][UARTDMA_BLOCK];
+static volatile int lengths[2] = {0, 0};    // bytes waiting in each block, 0 once it is free
+static volatile int sending = -1;           // block on the channel, -1 while it is idle
+static volatile int busy = 0;
+static volatile int exhausted = 0;          // the source has nothing more
+
+static uartdma_source_t source = 0;
+static uartdma_done_t done = 0;
+static int next_fill = 0;                   // main loop, the block to fill next
+
+static uartdma_line_t next_line = 0;
+static char line[UARTDMA_LINE];
+static char insert[UARTDMA_INSERT];
+static int insert_length = 0;               // a reply waiting for the next line boundary, 0 if none
+static const char * piece = line;           // what fill_lines copies from, the line or the reply
+static int piece_length = 0;
+static int piece_pos = 0;
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+// With the channel idle, from the main loop with interrupts off or from its ISR
+static void start_block(int b)
+{
+    sending = b;
+    DCH0SSA = KVA_TO_PA(blocks[b]);
+    DCH0SSIZ = lengths[b] & 0xFF;
+    DCH0INTbits.CHBCIF = 0;
+    DCH0CONbits.CHEN = 1;
+    DCH0ECONbits.CFORCE = 1;    // the first cell, the UART's TX requests pace the rest
+}
+
+static void finish()
+{
+    busy = 0;
+    if (done)
+    {
+        done();
+    }
+}
+
+void uartDma_Startup()
+{
+    U3STAbits.UTXISEL = 0;              // TX request while the FIFO has room
+    DMACONbits.ON = 1;
+    DCH0CONbits.CHPRI = 3;
+    DCH0ECONbits.CHSIRQ = _UART3_TX_IRQ;
+    DCH0ECONbits.SIRQEN = 1;
+    DCH0DSA = KVA_TO_PA(&U3TXREG);
+    DCH0DSIZ = 1;
+    DCH0CSIZ = 1;
+    DCH0INTbits.CHBCIE = 1;             // block done
+    IPC9bits.DMA0IP = 2;                // below the loops and the command queue
+    IPC9bits.DMA0IS = 0;
+    IFS1bits.DMA0IF = 0;
+    IEC1bits.DMA0IE = 1;
+}
+
+int uartDma_Start(uartdma_source_t s, uartdma_done_t d)
+{
+    if (busy)
+    {
+        return 1;
+    }
+    source = s;
+    done = d;
+    exhausted = 0;
+    next_fill = 0;
+    busy = 1;
+    uartDma_Poll();
+    return 0;
+}
+
+// The source uartDma_StartLines gives uartDma_Start, a waiting reply goes
+// before the next line
+static int fill_lines(char * block, int size)
+{
+    int n = 0;
+    while (n < size)
+    {
+        if (piece_pos == piece_length)
+        {
+            if (piece == insert)
+            {
+                insert_length = 0;      // copied out, the slot is free again
+            }
+            piece = (insert_length > 0) ? insert : line;
+            piece_length = (insert_length > 0) ? insert_length : next_line(line);
+            piece_pos = 0;
+            if (piece_length == 0)
+            {
+                break;
+            }
+        }
+        int k = piece_length - piece_pos;
+        k = (k > size - n) ? size - n : k;
+        memcpy(block + n, piece + piece_pos, k);
+        piece_pos += k;
+        n += k;
+    }
+    return n;
+}
+
+int uartDma_StartLines(uartdma_line_t l, uartdma_done_t d)
+{
+    if (busy)
+    {
+        return 1;
+    }
+    next_line = l;
+    piece = line;
+    piece_length = piece_pos = 0;
+    insert_length = 0;
+    return uartDma_Start(fill_lines, d);
+}
+
+int uartDma_Busy()
+{
+    return busy;
+}
+
+void uartDma_Poll()
+{
+    while (busy && !exhausted && (lengths[next_fill] == 0))
+    {
+        int n = source(blocks[next_fill], UARTDMA_BLOCK);
+        if (n == 0)
+        {
+            __builtin_disable_interrupts();
+            exhausted = 1;
+            if (sending < 0)
+            {
+                finish();   // nothing in flight, the end came on a block boundary
+            }
+            __builtin_enable_interrupts();
+            return;
+        }
+        __builtin_disable_interrupts();
+        lengths[next_fill] = n;
+        if (sending < 0)
+        {
+            start_block(next_fill);
+        }
+        __builtin_enable_interrupts();
+        next_fill = 1 - next_fill;
+    }
+}
+
+int uartDma_CanInsert()
+{
+    return busy && (source == fill_lines) && !exhausted && (insert_length == 0);
+}
+
+int uartDma_Insert(const void * bytes, int length)
+{
+    if (!uartDma_CanInsert() || (length <= 0) || (length > UARTDMA_INSERT))
+    {
+        return 1;
+    }
+    memcpy(insert, bytes, length);
+    insert_length = length;
+    uartDma_Poll();     // straight into a free block, if there is one
+    return 0;
+}
+
+void uartDma_Wait()
+{
+    while (busy)
+    {
+        uartDma_Poll();
+    }
+}
+
+
+/*************************
+ * INTERRUPT SERVICE ROUTINES
+*************************/
+
+void __ISR(_DMA_0_VECTOR, IPL2SOFT) UartDmaController(void)
+{
+    trace_Record(TRACE_DMA_ISR, TRACE_BEGIN, 0);
+    DCH0INTbits.CHBCIF = 0;
+    lengths[sending] = 0;
+    int next = 1 - sending;
+    if (lengths[next] > 0)
+    {
+        start_block(next);
+    }
+    else
+    {
+        sending = -1;
+        if (exhausted)
+        {
+            finish();
+        }
+    }
+    trace_Record(TRACE_DMA_ISR, TRACE_END, 0);
+    IFS1bits.DMA0IF = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef UARTDMA_H_
+#define UARTDMA_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+
+// UART3 transmit by DMA, for output too long to write a byte at a time.
+//
+// A transfer is fed by a source the main loop calls to fill a block. There are
+// two blocks: DMA channel 0 sends one to U3TXREG, a cell per UART TX request,
+// while the source fills the other, so the CPU only ever formats and never
+// waits on the UART. The channel's block done interrupt starts the next block
+// if it is ready, and calls the transfer's done callback once the last one is
+// out. That callback runs in the DMA ISR, keep it short.
+//
+// While a transfer runs it owns UART3, nothing else may write there until
+// uartDma_Busy() is 0 again.
+//
+// Text dumps go through uartDma_StartLines instead: the caller formats one
+// line at a time and the blocks are filled here, whole lines where they fit, a
+// line that does not is finished in the next block.
+//
+// A line transfer also takes one short reply to go out between two of its
+// lines, so binary replies are not held back for a whole dump. The reply is
+// put in the next block at a line boundary; a host reading the dump's lines
+// sees it as a frame starting with BIN_MAGIC where a line would start.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define UARTDMA_BLOCK 256       // bytes, DCHxSSIZ is 8 bits and 0 means 256
+#define UARTDMA_LINE 64         // the longest line a line source writes, NUL included
+#define UARTDMA_INSERT 256      // the longest reply uartDma_Insert takes
+
+typedef int (*uartdma_source_t)(char * block, int size);   // main loop, bytes put in block, 0 at the end
+typedef int (*uartdma_line_t)(char * line);                 // main loop, the next line's length, 0 at the end
+typedef void (*uartdma_done_t)(void);                       // DMA ISR, the last byte is in the UART
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+void uartDma_Startup();
+int uartDma_Start(uartdma_source_t source, uartdma_done_t done);     // 0 on success, 1 while busy
+int uartDma_StartLines(uartdma_line_t next_line, uartdma_done_t done);
+int uartDma_Busy();
+void uartDma_Poll();        // main loop, refills a block the channel is done with
+int uartDma_CanInsert();    // 1 while a line transfer has lines to come and no reply waiting
+int uartDma_Insert(const void * bytes, int length);    // main loop, 1 if it cannot take them
+void uartDma_Wait();        // main loop, runs the transfer to its end
+
+
+#endif
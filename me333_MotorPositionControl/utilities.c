@@ -1,10 +1,24 @@
 #include "utilities.h"
+#include "trace.h"
+#include "record.h"
+#include "positioncontrol.h"
+#include "hotpath.h"
 
-enum mode_t get_mode(){
+HOT enum mode_t get_mode(){
     return _mode;
 }
 
 void set_mode(enum mode_t m){
+    trace_Record(TRACE_MODE, TRACE_INSTANT, (_mode << 8) | m);
+    record_Mode(_mode, m);
+    if ((m == TRACK) != (_mode == TRACK))
+    {
+        positionControl_RestartTrack();
+    }
+    if ((m == HOLD) && (_mode != HOLD))
+    {
+        positionControl_RestartHold();
+    }
     _mode = m;
 }
 
@@ -0,0 +1,208 @@
+#include "velocitycontrol.h"
+#include "hotpath.h"
+#include "currentcontrol.h"
+#include "positioncontrol.h"
+
+
+/*************************
+ * PRIVATE GLOBAL VARIABLES
+*************************/
+static volatile int cascade_enabled = 0;
+static volatile int requested_rate = VELOCITY_RATE_MAX;
+static volatile int velocity_divider = CURRENT_RATE_DEFAULT / VELOCITY_RATE_MAX;
+
+static volatile float P_velocity = 1.0;         // mA per deg/s
+static volatile float I_velocity = 80.0;        // mA per degree, the integral of the velocity error
+static volatile float outer_gain = 15.0;        // deg/s per degree
+static volatile float velocity_limit = 500.0;   // deg/s
+static volatile float current_limit = 400.0;    // mA
+
+static volatile float velocity_command = 0;
+static volatile float current_feedforward = 0;
+static volatile float velocity = 0;
+static volatile float velocity_error_sum = 0;
+
+static volatile long long count = 0;     // multi-turn
+static volatile long long prev_count = 0;
+static volatile int primed = 0;         // count holds a real reading
+static volatile int outstanding = 0;    // a request has gone out and not been answered
+static int elapsed = 0;                 // current ticks since the last request
+static int span = 1;                    // current ticks between the last request and the one before
+
+
+/*************************
+ * HELPER FUNCTIONS
+*************************/
+
+static HOT float clamp(float v, float limit)
+{
+    v = (v > limit) ? limit : v;
+    v = (v < -limit) ? -limit : v;
+    return v;
+}
+
+static HOT void request_count()
+{
+    WriteUART2("a");
+    outstanding = 1;
+    span = elapsed;
+    elapsed = 0;
+}
+
+int setCascade(int enabled, int rate)
+{
+    enum mode_t m = get_mode();
+    if ((m == HOLD) || (m == TRACK))
+    {
+        return getVelocityRate();   // the encoder owner cannot change under a running loop
+    }
+    rate = (rate > VELOCITY_RATE_MAX) ? VELOCITY_RATE_MAX : rate;
+    rate = (rate < VELOCITY_RATE_MIN) ? VELOCITY_RATE_MIN : rate;
+    requested_rate = rate;
+    velocityControl_Retime();
+    cascade_enabled = enabled ? 1 : 0;
+    return getVelocityRate();
+}
+
+void velocityControl_Retime()
+{
+    int divider = (getCurrentLoopRate() + requested_rate / 2) / requested_rate;
+    velocity_divider = (divider < 1) ? 1 : divider;
+}
+
+int getCascadeEnabled()
+{
+    return cascade_enabled;
+}
+
+int getVelocityRate()
+{
+    return getCurrentLoopRate() / velocity_divider;
+}
+
+void setVelocityGains(float p, float i)
+{
+    P_velocity = p;
+    I_velocity = i;
+}
+
+float getVelocityP()
+{
+    return P_velocity;
+}
+
+float getVelocityI()
+{
+    return I_velocity;
+}
+
+void setCascadeOuterGain(float p)
+{
+    outer_gain = p;
+}
+
+float getCascadeOuterGain()
+{
+    return outer_gain;
+}
+
+void setCascadeLimits(float velocity, float current)
+{
+    velocity_limit = velocity;
+    current_limit = current;
+}
+
+float getVelocityLimit()
+{
+    return velocity_limit;
+}
+
+float getVelocityCurrentLimit()
+{
+    return current_limit;
+}
+
+/*************************
+ * ISR SIDE
+*************************/
+
+HOT void velocityControl_Tick()
+{
+    ++elapsed;
+    if (!primed)
+    {
+        // first tick of a run, the reply to this one seeds the difference
+        if (!outstanding)
+        {
+            request_count();
+        }
+        else if (get_encoder_flag())
+        {
+            set_encoder_flag(0);
+            outstanding = 0;
+            count = prev_count = get_encoder_count64();
+            velocity = velocity_error_sum = 0;
+            primed = 1;
+            request_count();
+        }
+        return;
+    }
+
+    if ((elapsed < velocity_divider) || !get_encoder_flag())
+    {
+        return;     // not due, or the reply is late: keep the last current command, look again next tick
+    }
+    set_encoder_flag(0);
+    outstanding = 0;
+    prev_count = count;
+    count = get_encoder_count64();
+    int between = span;         // the requests count and prev_count answer
+    float dt = elapsed * getCurrentDT();
+    request_count();
+
+    velocity = Q16_TO_DEG(countsToQ16(count - prev_count)) / (between * getCurrentDT());
+    float error = velocity_command - velocity;
+
+    // integrate only while the output is not pinned in the same direction
+    float out = P_velocity * error + I_velocity * velocity_error_sum + current_feedforward;
+    if ((out < current_limit || error < 0) && (out > -current_limit || error > 0))
+    {
+        velocity_error_sum += error * dt;
+    }
+    out = P_velocity * error + I_velocity * velocity_error_sum + current_feedforward;
+    setDesiredCurrent(clamp(out, current_limit));
+}
+
+// Ticks outside HOLD and TRACK. A request still in flight is handed to the
+// encoder to drop, so its reply cannot be taken for the answer to the next
+// blocking encoder read and this ISR does not wait for it
+void velocityControl_Reset()
+{
+    if (outstanding)
+    {
+        encoder_DropReply();
+        outstanding = 0;
+    }
+    primed = 0;
+    velocity_command = current_feedforward = 0;
+    velocity_error_sum = 0;
+}
+
+void velocityControl_SetCommand(float v, float feedforward)
+{
+    velocity_command = clamp(v, velocity_limit);
+    current_feedforward = feedforward;
+}
+
+int velocityControl_GetCount(long long * c)
+{
+    if (!primed)
+    {
+        return 0;
+    }
+    do
+    {
+        *c = count;     // the current ISR can update it between the two halves
+    } while (*c != count);
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef VELOCITYCONTROL_H_
+#define VELOCITYCONTROL_H_
+
+
+/*************************
+ * PRE PROCESSOR DIRECTIVES
+*************************/
+
+#include "NU32.h"
+#include "utilities.h"
+#include "encoder.h"
+
+// Optional cascade for HOLD and TRACK: position -> velocity -> current.
+//
+// With the cascade on, the position loop turns its error into a velocity command
+// (P on angle, plus the slope of the trajectory in TRACK) instead of a current.
+// A PI velocity loop runs inside the 5 kHz current ISR every
+// velocity_divider ticks and sets the desired current. The divider follows the
+// current loop rate, so the velocity loop keeps the rate it was asked for. Velocity comes from the
+// encoder count difference, so there is no D term on a raw angle difference.
+//
+// In cascade the velocity loop owns UART2. It asks the encoder for a count at
+// the end of its tick and reads the reply at the start of the next one, so the
+// 5 kHz ISR never waits on the encoder. A reply that is late is looked for
+// again every current tick, and the velocity is taken over the ticks between
+// the two requests, so a late one does not show up as a speed step. The
+// position loop uses the latest count it read. A reply takes about 0.5 ms at
+// 230400 baud, which sets the top rate.
+
+/*************************
+ * CONSTANTS
+*************************/
+
+#define VELOCITY_RATE_MAX 1000      // Hz, an encoder reply has to fit in one period
+#define VELOCITY_RATE_MIN 200       // Hz, the position loop rate
+
+
+/*************************
+ * HELPER FUNCTION PROTOTYPES
+*************************/
+
+int setCascade(int enabled, int rate);  // rate in Hz, returns the rate used, only outside HOLD and TRACK
+int getCascadeEnabled();
+int getVelocityRate();
+
+void setVelocityGains(float p, float i);            // mA per deg/s, mA per degree
+float getVelocityP();
+float getVelocityI();
+void setCascadeOuterGain(float p);                  // deg/s of command per degree of error
+float getCascadeOuterGain();
+void setCascadeLimits(float velocity, float current);   // deg/s, mA
+float getVelocityLimit();
+float getVelocityCurrentLimit();
+
+// Called from the ISRs
+void velocityControl_Retime();                      // after the current loop rate changes
+void velocityControl_Tick();                        // every current loop tick in HOLD and TRACK
+void velocityControl_Reset();                       // every current loop tick outside HOLD and TRACK
+void velocityControl_SetCommand(float velocity, float feedforward); // position loop, deg/s and mA
+int velocityControl_GetCount(long long * count);    // latest count read, 0 until the first reply
+
+
+#endif